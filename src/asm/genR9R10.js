@@ -132,7 +132,7 @@ const fullObj = {
     'asm_mrp_rawset': 'mrp_rawset',
     'asm_mrp_rawseti': 'mrp_rawseti',
     'asm_mrp_call': 'mrp_call',
-    'asm_mrp_pcall': 'mrp_pcall',
+    'asm_mrp_pcall': '_mr_plugin_pcall',
     'asm_mrp_load': 'mrp_load',
     'asm_mrp_getgcthreshold': 'mrp_getgcthreshold',
     'asm_mrp_setgcthreshold': 'mrp_setgcthreshold',
@@ -142,7 +142,7 @@ const fullObj = {
     'asm_mrp_getfenv': 'mrp_getfenv',
     'asm_mrp_setfenv': 'mrp_setfenv',
     'asm_mrp_setmetatable': 'mrp_setmetatable',
-    'asm_mrp_cpcall': 'mrp_cpcall',
+    'asm_mrp_cpcall': '_mr_plugin_cpcall',
     'asm_mrp_next': 'mrp_next',
     'asm_mrp_concat': 'mrp_concat',
     'asm_mrp_pushlightuserdata': 'mrp_pushlightuserdata',
@@ -164,6 +164,9 @@ int32 mrc_init(void) {
     // funcs->closedir = br_closedir;
     // funcs->getLen = br_getLen;
     funcs->drawBitmap = br_drawBitmap;
+    funcs->mapFile = NULL;
+    funcs->unmapFile = NULL;
+    funcs->crc32 = NULL;
 
     mythroad = dsm_init(funcs);
 
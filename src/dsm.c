@@ -3,6 +3,7 @@
 #include "./include/encode.h"
 #include "./include/fixR9.h"
 #include "./include/mem.h"
+#include "./include/mr_context.h"
 #include "./include/printf.h"
 #include "./include/string.h"
 
@@ -459,6 +460,29 @@ int32 mr_getLen(const char *filename) {
     return dsmInFuncs->getLen(get_filename(fullpathname, filename));
 }
 
+void *mr_mapFile(const char *filename, uint32 *len) {
+    char fullpathname[DSM_MAX_FILE_LEN] = {0};
+    if (dsmInFuncs->mapFile == NULL) {
+        return NULL;
+    }
+    return dsmInFuncs->mapFile(get_filename(fullpathname, filename), len);
+}
+
+int32 mr_unmapFile(void *p, uint32 len) {
+    if (dsmInFuncs->unmapFile == NULL) {
+        return MR_IGNORE;
+    }
+    return dsmInFuncs->unmapFile(p, len);
+}
+
+int32 mr_crc32(uint32 *crc, const uint8 *buf, uint32 len) {
+    if (dsmInFuncs->crc32 == NULL) {
+        return MR_IGNORE;
+    }
+    *crc = dsmInFuncs->crc32(*crc, buf, len);
+    return MR_SUCCESS;
+}
+
 int32 mr_getScreenInfo(mr_screeninfo *s) {
     if (s) {
         s->width = SCREEN_WIDTH;
@@ -842,6 +866,7 @@ DSM_EXPORT_FUNCS *dsm_init(DSM_REQUIRE_FUNCS *inFuncs) {
     mr_tcp_target_init();
     mr_iolib_target_init();
     mr_strlib_init();
+    mr_arraylib_init();
     mr_pluto_init();
 #endif
     mythroad_init();
@@ -852,5 +877,11 @@ DSM_EXPORT_FUNCS *dsm_init(DSM_REQUIRE_FUNCS *inFuncs) {
     dsm_export_funcs.mr_resumeApp = mr_resumeApp;
     dsm_export_funcs.mr_timer = mr_timer;
     dsm_export_funcs.mr_event = mr_event;
+#ifdef DSM_FULL
+    dsm_export_funcs.mr_contextSize = mr_contextSize;
+    dsm_export_funcs.mr_contextInit = mr_contextInit;
+    dsm_export_funcs.mr_contextSwitch = mr_contextSwitch;
+    dsm_export_funcs.mr_idle = mr_idle;
+#endif
     return &dsm_export_funcs;
 }
\ No newline at end of file
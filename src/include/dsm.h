@@ -62,8 +62,19 @@ typedef struct {
     int32 (*mr_editRelease)(int32 edit);
     const char *(*mr_editGetText)(int32 edit);
 
+    // 可选，不支持时为 NULL：把整个文件映射到内存并返回长度，mrp 中未压缩的文件
+    // 直接用映射里的数据。映射要写时复制（如 mmap 的 MAP_PRIVATE），位图可能被改写
+    void *(*mapFile)(const char *filename, uint32 *len);
+    int32 (*unmapFile)(void *p, uint32 len);
+
+    // 可选，不支持时为 NULL：标准 CRC-32（与 zlib 的 crc32 相同），平台可以用
+    // 硬件指令或优化过的库实现，校验 mrp 和解压时用
+    uint32 (*crc32)(uint32 crc, const uint8 *buf, uint32 len);
+
 } DSM_REQUIRE_FUNCS;
 
+struct mr_context;
+
 // 平台可以调用的函数
 typedef struct {
     int32 version;
@@ -72,6 +83,17 @@ typedef struct {
     int32 (*mr_resumeApp)(void);
     int32 (*mr_timer)(void);
     int32 (*mr_event)(int16 type, int32 param1, int32 param2);
+
+    // 多实例（只在 DSM_FULL 中有，否则为 NULL）：平台分配 mr_contextSize() 字节，
+    // 用 mr_contextInit() 初始化，每次调用上面的函数之前用 mr_contextSwitch()
+    // 切换到对应的实例，NULL 是 dsm_init 时的实例
+    int32 (*mr_contextSize)(void);
+    void (*mr_contextInit)(struct mr_context *ctx);
+    struct mr_context *(*mr_contextSwitch)(struct mr_context *ctx);
+
+    // 空闲时调用（只在 DSM_FULL 中有，否则为 NULL）：做一点启动预读之类的后台工作，
+    // 返回 MR_SUCCESS 表示还有要做的，可以马上再调用，MR_IGNORE 表示暂时没有
+    int32 (*mr_idle)(void);
 } DSM_EXPORT_FUNCS;
 
 DSM_EXPORT_FUNCS *dsm_init(DSM_REQUIRE_FUNCS *inFuncs);
@@ -19,6 +19,10 @@ extern uint32 Origin_LG_mem_len;
 extern char* LG_mem_end;
 extern uint32 LG_mem_left;
 
+/* 内存不够时调用，释放一些可以丢掉的内存(如缓存)，什么都没释放时返回 FALSE */
+typedef int32 (*LG_mem_reclaim_t)(uint32 len);
+extern LG_mem_reclaim_t LG_mem_reclaim;
+
 int32 _mr_mem_init(void);
 void* mr_malloc(uint32 len);
 void mr_free(void* p, uint32 len);
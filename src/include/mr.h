@@ -162,6 +162,11 @@ extern int32 mr_state;
 #define MRP_ERRMEM 4
 #define MRP_ERRERR 5
 
+/* options for binary chunks loaded with `mrp_loadchunk' */
+#define MRP_LOAD_LAZY 1  /* undump nested functions on first use */
+#define MRP_LOAD_ALIAS 2 /* code arrays point into the chunk */
+#define MRP_LOAD_STRIP 4 /* drop line info, local and upvalue names */
+
 typedef struct mrp_State mrp_State;
 
 typedef int (*mrp_CFunction)(mrp_State *L);
@@ -281,6 +286,7 @@ MRP_API void mrp_pushlightuserdata(mrp_State *L, void *p);
 MRP_API void mrp_gettable(mrp_State *L, int idx);
 MRP_API void mrp_rawget(mrp_State *L, int idx);
 MRP_API void mrp_rawgeti(mrp_State *L, int idx, int n);
+MRP_API void mrp_getglobalref(mrp_State *L, int ref, void **slot);
 MRP_API void mrp_newtable(mrp_State *L);
 MRP_API void *mrp_newuserdata(mrp_State *L, size_t sz);
 MRP_API int mrp_getmetatable(mrp_State *L, int objindex);
@@ -303,6 +309,10 @@ MRP_API int mrp_pcall(mrp_State *L, int nargs, int nresults, int errfunc);
 MRP_API int mrp_cpcall(mrp_State *L, mrp_CFunction func, void *ud);
 MRP_API int mrp_load(mrp_State *L, mrp_Chunkreader reader, void *dt,
                      const char *chunkname);
+MRP_API int mrp_loadchunk(mrp_State *L, char *buff, size_t size,
+                          const char *chunkname);
+MRP_API int mrp_setloadmode(mrp_State *L, int mode);
+MRP_API int mrp_getstripped(mrp_State *L);
 
 MRP_API int mrp_dump(mrp_State *L, mrp_Chunkwriter writer, void *data);
 
@@ -452,6 +462,24 @@ MRP_API mrp_Hook mrp_gethook(mrp_State *L);
 MRP_API int mrp_gethookmask(mrp_State *L);
 MRP_API int mrp_gethookcount(mrp_State *L);
 
+/*
+** sampling profiler
+*/
+#define MRP_PROF_OPS 1   /* count executed instructions by opcode */
+#define MRP_PROF_LINES 2 /* folded stacks carry the current line */
+
+MRP_API int mrp_profstart(mrp_State *L, int period, int nsamples, int flags);
+MRP_API void mrp_profstop(mrp_State *L);
+MRP_API void mrp_profsignal(mrp_State *L);
+MRP_API int mrp_profdump(mrp_State *L);
+
+/*
+** instruction budget
+*/
+MRP_API void mrp_setbudget(mrp_State *L, int limit);
+MRP_API int mrp_budgetused(mrp_State *L);
+MRP_API void mrp_budgetstop(mrp_State *L);
+
 #define MRP_IDSIZE 60
 
 struct mrp_Debug {
@@ -0,0 +1,133 @@
+#ifndef _MR_CONTEXT_H_
+#define _MR_CONTEXT_H_
+
+#include "mem.h"
+#include "mr_helper.h"
+#include "mythroad.h"
+
+/*
+ * State of one running application.  The emulator keeps the state of the
+ * active instance in its globals, because their addresses are handed out
+ * to native code (_mr_c_internal_table, _mr_c_function_table) and plugins
+ * keep them; mr_contextSwitch() saves the globals into the context of the
+ * active instance and loads them from the next one.  Several applications
+ * can run side by side as long as the host switches to the right context
+ * before every call into it (start, event, timer, pause, resume, stop);
+ * the host must also give each one its own memory from mem_get.
+ *
+ * Fields have the names of the globals they hold.
+ */
+typedef struct mr_context {
+    /* mythroad.c */
+    mrp_State* vm_state;
+    int32 mr_state;
+    uint16* mr_screenBuf;
+    int32 mr_screen_w;
+    int32 mr_screen_h;
+    int32 mr_screen_bit;
+    mr_bitmapSt mr_bitmap[BITMAPMAX + 1];
+    mr_tileSt mr_tile[TILEMAX];
+    int16* mr_map[TILEMAX];
+    mr_soundSt mr_sound[SOUNDMAX];
+    mr_spriteSt mr_sprite[SPRITEMAX];
+    int32 bi;
+    char pack_filename[MR_MAX_FILENAME_SIZE];
+    char start_filename[MR_MAX_FILENAME_SIZE];
+    char start_fileparameter[MR_MAX_FILENAME_SIZE];
+    char old_pack_filename[MR_MAX_FILENAME_SIZE];
+    char old_start_filename[MR_MAX_FILENAME_SIZE];
+    char mr_entry[MR_MAX_FILENAME_SIZE];
+#ifdef MR_CFG_USE_A_DISK
+    char temp_current_path[MR_MAX_FILENAME_SIZE];
+#endif
+    void* mr_timer_p;
+    int32 mr_timer_state;
+    int32 mr_timer_run_without_pause;
+    mr_handlerRef mr_dealevent_h;
+    mr_handlerRef mr_timer_h;
+#ifdef MR_TRACE
+    mr_handlerRef mr_trace_h;
+#endif
+    uint32 mr_vmcall_count;
+    uint32 mr_vmcall_errors;
+    uint32 mr_vmcall_mark;
+    int32 mr_vmcall_marktime;
+    int32 mr_budget_limit;
+    int32 mr_budget_last;
+    int32 mr_budget_max;
+    uint32 mr_budget_over;
+    char* mr_exception_str;
+    char* mr_ram_file;
+    int mr_ram_file_len;
+    int8 mr_soundOn;
+    int8 mr_shakeOn;
+#ifdef MR_PKZIP_MAGIC
+    int32 mr_zipType;
+#endif
+    MR_LOAD_C_FUNCTION mr_load_c_function;
+    MR_C_FUNCTION mr_c_function;
+    void* mr_c_function_P;
+    int32 mr_c_function_P_len;
+    int32* mr_c_function_fix_p;
+    MR_EVENT_FUNCTION mr_event_function;
+    MR_TIMER_FUNCTION mr_timer_function;
+    MR_STOP_FUNCTION mr_stop_function;
+    MR_PAUSEAPP_FUNCTION mr_pauseApp_function;
+    MR_RESUMEAPP_FUNCTION mr_resumeApp_function;
+    mrc_timerCB mr_exit_cb;
+    int32 mr_exit_cb_data;
+    struct mr_pdir* mr_pdir_cache[MR_PDIR_MAX];
+    int32 mr_pdir_next;
+    struct mr_fmap* mr_fmap_tab[MR_FMAP_MAX];
+#ifdef MR_ACACHE
+    struct mr_acache* mr_acache_head;
+    struct mr_acache* mr_acache_tail;
+    uint32 mr_acache_used;
+    uint32 mr_acache_budget;
+    uint32 mr_acache_hit;
+    uint32 mr_acache_miss;
+    uint32 mr_acache_saved;
+#endif
+#ifdef MR_PREFETCH
+    struct mr_prefetch* mr_prefetch;
+    int32 mr_prefetch_on;
+    uint32 mr_prefetch_count;
+    uint32 mr_prefetch_bytes;
+#endif
+#ifdef MR_PCACHE
+    int32 mr_pcache_on;
+    int32 mr_pcache_hit;
+    int32 mr_pcache_miss;
+#endif
+
+    /* mem.c */
+    uint32 LG_mem_min;
+    uint32 LG_mem_top;
+    LG_mem_free_t LG_mem_free;
+    char* LG_mem_base;
+    uint32 LG_mem_len;
+    char* Origin_LG_mem_base;
+    uint32 Origin_LG_mem_len;
+    char* LG_mem_end;
+    uint32 LG_mem_left;
+    LG_mem_reclaim_t LG_mem_reclaim;
+} mr_context;
+
+/* copies a global into (save != 0) or out of the field of the same name */
+#define MR_CONTEXT_MOVE(ctx, save, var)                  \
+    do {                                                 \
+        if (save) {                                      \
+            MEMCPY(&(ctx)->var, &(var), sizeof(var));    \
+        } else {                                         \
+            MEMCPY(&(var), &(ctx)->var, sizeof(var));    \
+        }                                                \
+    } while (0)
+
+int32 mr_contextSize(void);
+void mr_contextInit(mr_context* ctx);
+mr_context* mr_contextSwitch(mr_context* ctx);
+mr_context* mr_contextCurrent(void);
+
+void _mr_mem_context(mr_context* ctx, int save);
+
+#endif
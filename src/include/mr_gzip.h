@@ -75,6 +75,10 @@ extern uch *mr_gzOutBuf;
 extern unsigned LG_gzinptr;  /* index of next byte to be processed in inbuf */
 extern unsigned LG_gzoutcnt; /* bytes in output buffer */
 
+extern uch *LG_gzsizebuf;     /* input buffer the two sizes below are for */
+extern unsigned LG_gzinsize;  /* bytes in that input buffer */
+extern unsigned LG_gzoutsize; /* bytes of its uncompressed data */
+
 //#//define isize bytes_in
 /* for compatibility with old zip sources (to be cleaned) */
 
@@ -175,5 +179,16 @@ extern unsigned LG_gzoutcnt; /* bytes in output buffer */
 extern int mr_unzip(void);
 extern int mr_get_method(int32 buf_len);
 extern int mr_inflate(void);
+extern int32 mr_deflate(uint8 *out, uint32 outsize, const uint8 *in, uint32 inlen);
+
+/* streaming inflate of a gzip member, see mr_inflate.c */
+typedef struct mr_gzstream mr_gzstream;
+/* reads up to len bytes of compressed data, returns 0 at the end */
+typedef int32 (*mr_gzread_t)(void *ud, uint8 *buf, uint32 len);
+/* the input is in[0..inlen-1], or comes from read(ud, ...) when in is NULL */
+extern mr_gzstream *mr_gzOpen(const uint8 *in, uint32 inlen, mr_gzread_t read, void *ud);
+/* returns the bytes read, less than len at the end, MR_FAILED for bad data */
+extern int32 mr_gzRead(mr_gzstream *z, uint8 *buf, uint32 len);
+extern void mr_gzClose(mr_gzstream *z);
 
 #endif
@@ -27,6 +27,23 @@ MRPLIB_API int mrp_open_file(mrp_State *L);
 #define MRP_STRLIBNAME "string"
 MRPLIB_API int mrp_open_string(mrp_State *L);
 
+#define MRP_ARRAYLIBNAME "array"
+MRPLIB_API int mrp_open_array(mrp_State *L);
+
+/* element types of typed arrays */
+#define MRP_ARRAY_INT8 0
+#define MRP_ARRAY_UINT8 1
+#define MRP_ARRAY_INT16 2
+#define MRP_ARRAY_UINT16 3
+#define MRP_ARRAY_INT32 4
+#define MRP_ARRAY_NTYPES 5
+
+/* the elements of the array at `idx' (NULL if it is not an array of
+   `type', any type if `type' < 0) and their number in `*n' */
+MRPLIB_API void *mr_L_toarray(mrp_State *L, int idx, int type, int *n);
+/* pushes a new zeroed array of `n' elements and returns its elements */
+MRPLIB_API void *mr_L_newarray(mrp_State *L, int type, int n);
+
 #define MRP_MATHLIBNAME "_math"
 MRPLIB_API int mrp_open_math(mrp_State *L);
 
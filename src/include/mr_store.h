@@ -6,6 +6,7 @@
 typedef struct WriterInfo_t {
 	char* buf;
 	size_t buflen;
+	size_t bufsize;
 } WriterInfo;
 
 
@@ -16,7 +17,14 @@ typedef struct LoadInfo_t {
 
 
 
-void mr_store_persist(mrp_State *L, mrp_Chunkwriter writer, void *ud);
+/* A stream starts with MR_STORE_MAGIC and the number of objects in it,
+ * which mr_store_persist returns and writes as 0; callers that can patch
+ * the stream afterwards store it at MR_STORE_COUNTPOS, so that loading
+ * can size its reference table at once. */
+#define MR_STORE_MAGIC 0x31544C50 /* "PLT1" */
+#define MR_STORE_COUNTPOS sizeof(int)
+
+int mr_store_persist(mrp_State *L, mrp_Chunkwriter writer, void *ud);
 
 void mr_store_unpersist(mrp_State *L, mrp_Chunkreader reader, void *ud);
 
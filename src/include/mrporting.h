@@ -353,6 +353,10 @@ typedef struct
 p是启动定时器时传入的Mythroad定时器数据*/
 extern int32 mr_timer(void);
 
+/*平台空闲时调用，Mythroad平台做一点后台工作(启动预读)；
+返回MR_SUCCESS表示还有要做的，MR_IGNORE表示暂时没有*/
+extern int32 mr_idle(void);
+
 /*在Mythroad平台中对按键事件进行处理，press = MR_KEY_PRESS按键按下，
 = MR_KEY_RELEASE按键释放，key 对应的按键编码*/
 extern int32 mr_event(int16 type, int32 param1, int32 param2);
@@ -464,6 +468,11 @@ extern int32 mr_write(int32 f, void* p, uint32 l);
 extern int32 mr_read(int32 f, void* p, uint32 l);
 extern int32 mr_seek(int32 f, int32 pos, int method);
 extern int32 mr_getLen(const char* filename);
+/*把文件映射到内存，平台不支持时返回 NULL；映射的页可写，但写入不影响文件*/
+extern void* mr_mapFile(const char* filename, uint32* len);
+extern int32 mr_unmapFile(void* p, uint32 len);
+/*平台的 CRC-32，*crc 的用法同 zlib 的 crc32；平台不支持时返回 MR_IGNORE*/
+extern int32 mr_crc32(uint32* crc, const uint8* buf, uint32 len);
 extern int32 mr_remove(const char* filename);
 extern int32 mr_rename(const char* oldname, const char* newname);
 extern int32 mr_mkDir(const char* name);
@@ -1026,6 +1035,7 @@ void mr_tablib_init(void);
 void mr_pluto_init(void);
 void mythroad_init(void);
 void mr_strlib_init(void);
+void mr_arraylib_init(void);
 void mr_iolib_target_init(void);
 void mr_tcp_target_init(void);
 void mr_socket_target_init(void);
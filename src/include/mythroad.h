@@ -29,8 +29,21 @@
 /*支持Socket*/
 #define MR_SOCKET_SUPPORT
 
+/*缓存解压后的脚本(按mrp路径+文件CRC索引)，加快冷启动*/
+#define MR_PCACHE
+
+/*在内存池中缓存解压后的 mrp 文件(LRU)，重复加载时不用再解压*/
+#define MR_ACACHE
+
+/*记录应用启动时读的 mrp 文件，下次启动时在空闲时(mr_idle)预先解压到解压缓存，需要 MR_ACACHE*/
+#define MR_PREFETCH
+
 /*配置结束*/
 
+#ifndef MR_ACACHE
+#undef MR_PREFETCH
+#endif
+
 #define MR_TIME_START(a)                         \
     {                                            \
         mr_timerStart(a);                        \
@@ -100,6 +113,13 @@ typedef struct {
 
 #define SOUNDMAX 5
 
+#define MR_PDIR_MAX 4  // 目录缓存的 mrp 个数
+#define MR_PDIR_CHECK_TIME 1000  // 目录缓存至少隔多少毫秒重新校验一次索引
+#define MR_FMAP_MAX 2  // 同时映射的 mrp 个数
+#define MR_ACACHE_SIZE (256 * 1024)  // 解压缓存默认的大小
+#define MR_PREFETCH_TIME 5000        // 记录启动后多少毫秒内读的文件
+#define MR_PREFETCH_MAX 32           // 最多记录的文件个数
+
 #define MR_SPRITE_INDEX_MASK (0x03FF)  // mask of bits used for tile index
 #define MR_SPRITE_TRANSPARENT (0x0400)
 
@@ -131,21 +151,59 @@ typedef struct {
 	uint32	ClrImportant;
 }mr_bitmap_file_header;
 */
+#define MR_SAVE_MAGIC 0x5653524D /* "MRSV" */
+#define MR_SAVE_DEFLATE 1          /* payload is a gzip member */
+#define MR_SAVE_BUFSIZE 1024
+
+typedef struct mr_saveHead {
+    uint32 magic;
+    uint32 flags;
+    uint32 len; /* payload length */
+    uint32 sum; /* Adler-32 of the payload */
+} mr_saveHead;
+
 typedef struct SaveF {
     int32 f;
+    int32 err;      /* a write failed */
+    uint32 flags;   /* MR_SAVE_* */
+    uint32 len;     /* payload bytes written */
+    uint32 sum;     /* Adler-32 of them */
+    int32 count;    /* objects in the stream, see MR_STORE_COUNTPOS */
+    uint8* mem;     /* whole stream, compressed when it is complete */
+    uint32 memlen;
+    uint32 memsize;
+    uint32 n;       /* bytes in buff */
+    uint8 buff[MR_SAVE_BUFSIZE];
 } SaveF;
 
 typedef struct LoadF {
-    int32 f;
-    char buff[MRP_L_BUFFERSIZE];
+    const char* p;
+    uint32 size;
 } LoadF;
 
+/* a global function called from the host, e.g. dealevent */
+typedef struct mr_handlerRef {
+    int ref;          /* registry reference to the interned name, or MRP_NOREF */
+    void* slot;       /* where the globals hold it, see mrp_getglobalref */
+    const char* name; /* the interned name, valid while ref is held */
+} mr_handlerRef;
+
 #define MR_FLAGS_BI 1
 #define MR_FLAGS_AI 2
 #define MR_FLAGS_RI 4
 #define MR_FLAGS_EI 8
 
+/* lookfor: 0 读出, 1 只查是否存在, 2 不解压, 3 读出(可直接引用文件映射), 4 同3且是脚本(查字节码缓存) */
 void* _mr_readFile(const char* filename, int* filelen, int lookfor);
+void _mr_readFileRelease(void* p, int filelen);
+
+/* reads a file of the pack in pieces, inflating it on the way if packed */
+typedef struct mr_stream mr_stream;
+mr_stream* _mr_streamOpen(const char* filename);
+int32 _mr_streamRead(mr_stream* st, void* buf, uint32 len);
+uint32 _mr_streamSize(mr_stream* st);
+void _mr_streamClose(mr_stream* st);
+void* _mr_readFileBig(const char* filename, int* filelen, int lookfor);
 
 extern int32 _mr_smsGetBytes(int32 pos, char* p, int32 len);
 extern void _mr_showErrorInfo(const char* errstr);
@@ -155,6 +213,8 @@ extern int mr_Gb2312toUnicode(mrp_State* L);
 extern int32 _mr_getHost(mrp_State* L, char* host);
 
 extern int _mr_pcall(int nargs, int nresults);
+extern int _mr_plugin_pcall(mrp_State* L, int nargs, int nresults, int errfunc);
+extern int _mr_plugin_cpcall(mrp_State* L, mrp_CFunction func, void* ud);
 
 extern const char* _mr_memfind(const char* s1, size_t l1, const char* s2, size_t l2);
 extern int32 _mr_u2c(char* input, int32 inlen, char* output, int32 outlen);
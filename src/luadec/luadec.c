@@ -73,6 +73,7 @@ int luadec(mrp_State* L, char* filename, char* outputFile) {
     }
 
     f = combine(L, 1);  // 只有一个文件
+    mr_U_loadall(L, f);
     if (functions)
         luaU_decompileFunctions(f, debugging, outputFile);
     else
@@ -16,6 +16,7 @@
 #include <sys/time.h>
 #include <time.h>
 #include <unistd.h>
+#include <zlib.h>
 
 #include "./include/dsm.h"
 
@@ -318,6 +319,41 @@ int32 br_getLen(const char *filename) {
     return s1.st_size;
 }
 
+void *br_mapFile(const char *filename, uint32 *len) {
+    struct stat s1;
+    void *p;
+    int fd;
+    char *str = GBK2UTF8(filename);
+    if (str == NULL) return NULL;
+
+    fd = open(str, O_RDONLY);
+    free(str);
+    if (fd < 0)
+        return NULL;
+    if ((fstat(fd, &s1) != 0) || (s1.st_size == 0)) {
+        close(fd);
+        return NULL;
+    }
+    // 写时复制，写入不影响文件
+    p = mmap(NULL, s1.st_size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (p == MAP_FAILED)
+        return NULL;
+    *len = s1.st_size;
+    return p;
+}
+
+int32 br_unmapFile(void *p, uint32 len) {
+    if (munmap(p, len) != 0)
+        return MR_FAILED;
+    return MR_SUCCESS;
+}
+
+// zlib 的 crc32 在支持的 CPU 上会用硬件指令
+uint32 br_crc32(uint32 crc, const uint8 *buf, uint32 len) {
+    return (uint32)crc32(crc, buf, len);
+}
+
 int32 br_getDatetime(mr_datetime *datetime) {
     if (!datetime)
         return MR_FAILED;
@@ -481,6 +517,26 @@ Uint32 th2(Uint32 interval, void *param) {
     return 0;
 }
 
+// 空闲线程：在事件和定时器之间调用 mr_idle 做启动预读，和别的回调一样要加锁
+static volatile bool idleRun = true;
+
+static int idleThread(void *data) {
+    int32 ret;
+    while (idleRun) {
+        if (pthread_mutex_lock(&mutex) != 0) {
+            perror("mutex lock fail");
+            exit(EXIT_FAILURE);
+        }
+        ret = mythroad->mr_idle ? mythroad->mr_idle() : MR_IGNORE;
+        if (pthread_mutex_unlock(&mutex) != 0) {
+            perror("mutex unlock fail");
+            exit(EXIT_FAILURE);
+        }
+        SDL_Delay(ret == MR_SUCCESS ? 1 : 100);
+    }
+    return 0;
+}
+
 int32 br_timerStart(uint16 t) {
     printf("br_timerStart %d\n", t);
     if (!timeId) {
@@ -629,6 +685,9 @@ int main(int argc, char *args[]) {
     funcs->closedir = br_closedir;
     funcs->getLen = br_getLen;
     funcs->drawBitmap = br_drawBitmap;
+    funcs->mapFile = br_mapFile;
+    funcs->unmapFile = br_unmapFile;
+    funcs->crc32 = br_crc32;
 
 
     if (pthread_mutex_init(&mutex, NULL) != 0) {
@@ -669,6 +728,8 @@ int main(int argc, char *args[]) {
         j2n_startMrp(args[1]);
     }
 
+    SDL_Thread *idle = SDL_CreateThread(idleThread, "idle", NULL);
+
     SDL_Event event;
     bool isLoop = true;
     bool isDown = false;
@@ -701,6 +762,10 @@ int main(int argc, char *args[]) {
             }
         }
     }
+    idleRun = false;
+    if (idle) {
+        SDL_WaitThread(idle, NULL);
+    }
     SDL_DestroyRenderer(renderer);
     SDL_DestroyWindow(window);
     SDL_Quit();
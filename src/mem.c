@@ -1,6 +1,7 @@
 #include "./include/mem.h"
 
 #include "./include/fixR9.h"
+#include "./include/mr_context.h"
 #include "./include/mythroad.h"
 
 uint32 LG_mem_min;  // 从未分配过的长度？
@@ -12,6 +13,7 @@ char* Origin_LG_mem_base;
 uint32 Origin_LG_mem_len;
 char* LG_mem_end;
 uint32 LG_mem_left;  // 剩余内存
+LG_mem_reclaim_t LG_mem_reclaim;
 
 #define realLGmemSize(x) (((x) + 7) & (0xfffffff8))
 #define MRDBGPRINTF mr_printf
@@ -30,6 +32,7 @@ int32 _mr_mem_init(void) {
     ((LG_mem_free_t*)LG_mem_base)->next = LG_mem_len;
     ((LG_mem_free_t*)LG_mem_base)->len = LG_mem_len;
     LG_mem_left = LG_mem_len;
+    LG_mem_reclaim = NULL;
 #ifdef MYTHROAD_DEBUG
     LG_mem_min = LG_mem_len;
     LG_mem_top = 0;
@@ -37,13 +40,27 @@ int32 _mr_mem_init(void) {
     return MR_SUCCESS;
 }
 
+/* 保存/恢复当前实例的内存池，见 mr_contextSwitch */
+void _mr_mem_context(mr_context* ctx, int save) {
+    MR_CONTEXT_MOVE(ctx, save, LG_mem_min);
+    MR_CONTEXT_MOVE(ctx, save, LG_mem_top);
+    MR_CONTEXT_MOVE(ctx, save, LG_mem_free);
+    MR_CONTEXT_MOVE(ctx, save, LG_mem_base);
+    MR_CONTEXT_MOVE(ctx, save, LG_mem_len);
+    MR_CONTEXT_MOVE(ctx, save, Origin_LG_mem_base);
+    MR_CONTEXT_MOVE(ctx, save, Origin_LG_mem_len);
+    MR_CONTEXT_MOVE(ctx, save, LG_mem_end);
+    MR_CONTEXT_MOVE(ctx, save, LG_mem_left);
+    MR_CONTEXT_MOVE(ctx, save, LG_mem_reclaim);
+}
+
 void printMemoryInfo() {
     mr_printf(".......total:%d, min:%d, free:%d, top:%d", LG_mem_len, LG_mem_min, LG_mem_left, LG_mem_top);
     mr_printf(".......base:%p, end:%p", LG_mem_base, LG_mem_end);
     mr_printf(".......obase:%p, olen:%d", Origin_LG_mem_base, Origin_LG_mem_len);
 }
 
-void* mr_malloc(uint32 len) {
+static void* _mr_malloc(uint32 len) {
     LG_mem_free_t *previous, *nextfree, *l;
     void* ret;
 
@@ -102,6 +119,14 @@ end:
     return ret;
 }
 
+void* mr_malloc(uint32 len) {
+    void* ret = _mr_malloc(len);
+    while ((ret == NULL) && (LG_mem_reclaim != NULL) && LG_mem_reclaim(len)) {
+        ret = _mr_malloc(len);
+    }
+    return ret;
+}
+
 void mr_free(void* p, uint32 len) {
     LG_mem_free_t *free, *n;
     len = (uint32)realLGmemSize(len);
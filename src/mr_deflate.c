@@ -0,0 +1,169 @@
+#include "./include/mem.h"
+#include "./include/mr_gzip.h"
+
+/*
+ * Small deflate compressor, the counterpart of mr_inflate: it writes a
+ * gzip member that mr_get_method()/mr_unzip() read back.  The data goes
+ * into a single block with the fixed Huffman codes; matches are found
+ * through a hash of the next 3 bytes that only remembers the last
+ * position (no chains).  That is enough for the repetitive data of
+ * saved tables and keeps the working memory at 16KB.
+ */
+
+#define DF_HASHBITS 12
+#define DF_HASHSIZE (1 << DF_HASHBITS)
+#define DF_MINMATCH 3
+#define DF_MAXMATCH 258
+#define DF_MAXDIST 32768
+
+typedef struct df_stream {
+    uint8* out;
+    uint32 pos;
+    uint32 size;
+    uint32 bitbuf;
+    int bitcnt;
+} df_stream;
+
+static const uint16 df_lbase[29] = {
+    3, 4, 5, 6, 7, 8, 9, 10, 11, 13, 15, 17, 19, 23, 27, 31,
+    35, 43, 51, 59, 67, 83, 99, 115, 131, 163, 195, 227, 258};
+static const uint8 df_lext[29] = {
+    0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2,
+    3, 3, 3, 3, 4, 4, 4, 4, 5, 5, 5, 5, 0};
+static const uint16 df_dbase[30] = {
+    1, 2, 3, 4, 5, 7, 9, 13, 17, 25, 33, 49, 65, 97, 129, 193,
+    257, 385, 513, 769, 1025, 1537, 2049, 3073, 4097, 6145,
+    8193, 12289, 16385, 24577};
+static const uint8 df_dext[30] = {
+    0, 0, 0, 0, 1, 1, 2, 2, 3, 3, 4, 4, 5, 5, 6, 6,
+    7, 7, 8, 8, 9, 9, 10, 10, 11, 11, 12, 12, 13, 13};
+
+static void df_putbyte(df_stream* s, uint32 c) {
+    if (s->pos < s->size) {
+        s->out[s->pos] = (uint8)c;
+    }
+    s->pos++; /* keeps counting, so that overflow can be detected */
+}
+
+static void df_putbits(df_stream* s, uint32 value, int n) {
+    s->bitbuf |= value << s->bitcnt;
+    s->bitcnt += n;
+    while (s->bitcnt >= 8) {
+        df_putbyte(s, s->bitbuf & 0xff);
+        s->bitbuf >>= 8;
+        s->bitcnt -= 8;
+    }
+}
+
+/* Huffman codes are sent starting from their most significant bit */
+static void df_putcode(df_stream* s, uint32 code, int n) {
+    uint32 r = 0;
+    int i;
+    for (i = 0; i < n; i++) {
+        r = (r << 1) | (code & 1);
+        code >>= 1;
+    }
+    df_putbits(s, r, n);
+}
+
+/* a literal/length symbol with the fixed code */
+static void df_putsym(df_stream* s, int sym) {
+    if (sym < 144) {
+        df_putcode(s, 0x30 + sym, 8);
+    } else if (sym < 256) {
+        df_putcode(s, 0x190 + sym - 144, 9);
+    } else if (sym < 280) {
+        df_putcode(s, sym - 256, 7);
+    } else {
+        df_putcode(s, 0xc0 + sym - 280, 8);
+    }
+}
+
+static void df_putmatch(df_stream* s, int len, int dist) {
+    int i = 0;
+    while (i < 28 && df_lbase[i + 1] <= len) i++;
+    df_putsym(s, 257 + i);
+    df_putbits(s, len - df_lbase[i], df_lext[i]);
+    i = 0;
+    while (i < 29 && df_dbase[i + 1] <= dist) i++;
+    df_putcode(s, i, 5);
+    df_putbits(s, dist - df_dbase[i], df_dext[i]);
+}
+
+#define df_hash(p) ((((uint32)(p)[0] << 16 | (uint32)(p)[1] << 8 | (p)[2]) * 2654435761U) >> (32 - DF_HASHBITS))
+
+static void df_put32(df_stream* s, uint32 v) {
+    df_putbyte(s, v);
+    df_putbyte(s, v >> 8);
+    df_putbyte(s, v >> 16);
+    df_putbyte(s, v >> 24);
+}
+
+/*
+ * Compresses in[0..inlen-1] into out as a gzip member.  Returns its size,
+ * or -1 if it does not fit in outsize bytes or there is no memory.
+ */
+int32 mr_deflate(uint8* out, uint32 outsize, const uint8* in, uint32 inlen) {
+    df_stream s;
+    uint32* head; /* last position + 1 of each hash, 0 if none */
+    uint32 i, k;
+
+    head = MR_MALLOC(DF_HASHSIZE * sizeof(uint32));
+    if (head == NULL) {
+        return -1;
+    }
+    MEMSET(head, 0, DF_HASHSIZE * sizeof(uint32));
+    s.out = out;
+    s.pos = 0;
+    s.size = outsize;
+    s.bitbuf = 0;
+    s.bitcnt = 0;
+
+    /* gzip header: magic, method, no flags, no time, no extra flags, unknown OS */
+    df_putbyte(&s, 0x1f);
+    df_putbyte(&s, 0x8b);
+    df_putbyte(&s, DEFLATED);
+    df_put32(&s, 0);
+    df_putbyte(&s, 0);
+    df_putbyte(&s, 0);
+    df_putbyte(&s, 0xff);
+
+    df_putbits(&s, 1, 1); /* last block */
+    df_putbits(&s, 1, 2); /* fixed Huffman codes */
+    i = 0;
+    while (i < inlen && s.pos <= outsize) {
+        uint32 len = 0, dist = 0;
+        if (i + DF_MINMATCH <= inlen) {
+            uint32 h = df_hash(in + i);
+            uint32 cand = head[h];
+            head[h] = i + 1;
+            if (cand != 0 && i - (cand - 1) <= DF_MAXDIST) {
+                const uint8* p = in + cand - 1;
+                uint32 max = inlen - i;
+                if (max > DF_MAXMATCH) max = DF_MAXMATCH;
+                while (len < max && p[len] == in[i + len]) len++;
+                dist = i - (cand - 1);
+            }
+        }
+        if (len >= DF_MINMATCH) {
+            df_putmatch(&s, len, dist);
+            for (k = i + 1; k < i + len && k + DF_MINMATCH <= inlen; k++) {
+                head[df_hash(in + k)] = k + 1;
+            }
+            i += len;
+        } else {
+            df_putsym(&s, in[i]);
+            i++;
+        }
+    }
+    df_putsym(&s, 256); /* end of block */
+    if (s.bitcnt > 0) {
+        df_putbits(&s, 0, 8 - s.bitcnt);
+    }
+    MR_FREE(head, DF_HASHSIZE * sizeof(uint32));
+
+    mr_updcrc(NULL, 0);
+    df_put32(&s, mr_updcrc((uint8*)in, inlen));
+    df_put32(&s, inlen);
+    return (s.pos <= outsize) ? (int32)s.pos : -1;
+}
@@ -1,883 +1,761 @@
-
-
 #include "./include/mem.h"
 #include "./include/mr_gzip.h"
-#define slide mr_gzOutBuf
-
-/* Huffman code lookup table entry--this entry is four bytes for machines
-   that have 16-bit pointers (e.g. PC's in the small or medium model).
-   Valid extra bits are 0..13.  e == 15 is EOB (end of block), e == 16
-   means that v is a literal, 16 < e < 32 means that v is a pointer to
-   the next table, which codes e - 16 bits, and lastly e == 99 indicates
-   an unused code.  If a code with e == 99 is looked up, this implies an
-   error in the data. */
-struct huft {
-  ulg l;
-  uch e;                /* number of extra bits or operation */
-  uch b;                /* number of bits in this code or subcode */
-  union {
-    ush n;              /* literal, length base, or distance base */
-    struct huft *t;     /* pointer to next level of table */
-  } v;
-};
-
 
-/* Function prototypes */
-static int huft_build(unsigned *b,            /* code lengths in bits (all assumed <= BMAX) */
-   unsigned n,             /* number of codes (assumed <= N_MAX) */
-   unsigned s,             /* number of simple-valued codes (0..s-1) */
-   ush *d,                 /* list of base values for non-simple codes */
-   ush *e,                 /* list of extra bits for non-simple codes */
-   struct huft **t,        /* result: starting table */
-   int *m                 /* maximum lookup bits, returns actual */);
-
-static int huft_free(
-struct huft *t         /* table to free */);
-
-static int inflate_codes(
-struct huft *tl, struct huft *td,   /* literal/length and distance decoder tables */
-int bl, int bd             /* number of bits decoded by tl[] and td[] */);
-
-static int inflate_stored(void);
-static int inflate_fixed(void);
-static int inflate_dynamic(void);
-
-static int inflate_block(
-int *e                 /* last block flag */);
-
-int mr_inflate(void);
-
-
-/* The inflate algorithm uses a sliding 32K byte window on the uncompressed
-   stream to find repeated byte strings.  This is implemented here as a
-   circular buffer.  The index is updated simply by incrementing and then
-   and'ing with 0x7fff (32K-1). */
-/* It is left to other modules to supply the 32K area.  It is assumed
-   to be usable as if it were declared "uch slide[32768];" or as just
-   "uch *slide;" and then malloc'ed in the latter case.  The definition
-   must be in unzip.h, included above. */
-/* unsigned wp;             current position in slide */
-#define wp LG_gzoutcnt
-//#define flush_output(w) (wp=(w),flush_window())
-#define flush_output(w) (wp=(w),flush_window())
-
-/* Tables for deflate from PKZIP's appnote.txt. */
-static const unsigned border[] = {    /* Order of the bit length code lengths */
-        16, 17, 18, 0, 8, 7, 9, 6, 10, 5, 11, 4, 12, 3, 13, 2, 14, 1, 15};
-static const ush cplens[] = {         /* Copy lengths for literal codes 257..285 */
-        3, 4, 5, 6, 7, 8, 9, 10, 11, 13, 15, 17, 19, 23, 27, 31,
-        35, 43, 51, 59, 67, 83, 99, 115, 131, 163, 195, 227, 258, 0, 0};
-        /* note: see note #13 above about the 258 in this list. */
-static const ush cplext[] = {         /* Extra bits for literal codes 257..285 */
-        0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2,
-        3, 3, 3, 3, 4, 4, 4, 4, 5, 5, 5, 5, 0, 99, 99}; /* 99==invalid */
-static const ush cpdist[] = {         /* Copy offsets for distance codes 0..29 */
-        1, 2, 3, 4, 5, 7, 9, 13, 17, 25, 33, 49, 65, 97, 129, 193,
-        257, 385, 513, 769, 1025, 1537, 2049, 3073, 4097, 6145,
-        8193, 12289, 16385, 24577};
-static const ush cpdext[] = {         /* Extra bits for distance codes */
-        0, 0, 0, 0, 1, 1, 2, 2, 3, 3, 4, 4, 5, 5, 6, 6,
-        7, 7, 8, 8, 9, 9, 10, 10, 11, 11,
-        12, 12, 13, 13};
-
-
-
-/* Macros for inflate() bit peeking and grabbing.
-   The usage is:
-   
-        NEEDBITS(j)
-        x = b & mask_bits[j];
-        DUMPBITS(j)
-
-   where NEEDBITS makes sure that b has at least j bits in it, and
-   DUMPBITS removes the bits from b.  The macros use the variable k
-   for the number of bits in b.  Normally, b and k are register
-   variables for speed, and are initialized at the beginning of a
-   routine that uses these macros from a global bit buffer and count.
-
-   If we assume that EOB will be the longest code, then we will never
-   ask for bits with NEEDBITS that are beyond the end of the stream.
-   So, NEEDBITS should not read any more bytes than are needed to
-   meet the request.  Then no bytes need to be "returned" to the buffer
-   at the end of the last block.
-
-   However, this assumption is not true for fixed blocks--the EOB code
-   is 7 bits, but the other literal/length codes can be 8 or 9 bits.
-   (The EOB code is shorter than other codes because fixed blocks are
-   generally short.  So, while a block always has an EOB, many other
-   literal/length codes have a significantly lower probability of
-   showing up at all.)  However, by making the first table have a
-   lookup of seven bits, the EOB code will be found in that first
-   lookup, and so will not require that too many bits be pulled from
-   the stream.
+/*
+ * Table-driven inflate.  A code is decoded with one lookup in a table
+ * indexed by the next INF_LBITS (INF_DBITS for distances) bits of the
+ * stream; longer codes continue in a second-level table behind the
+ * first entry.  Where two short literal codes fit in the first-level
+ * index together, the entry holds both literals and they are written
+ * at once.  The bit buffer is 64 bits wide and is refilled to more than
+ * 56 bits before each symbol, which covers a length code, its extra
+ * bits, a distance code and its extra bits without another refill.
+ *
+ * The data goes straight into mr_gzOutBuf.  mr_get_method() must have
+ * seen the input: it gives the sizes of the input and of the output
+ * (from the gzip trailer or the zip local header), so corrupt data can
+ * not make the decoder read or write past them.  Input it did not
+ * accept is rejected as corrupt.
+ *
+ * Returns 0 when done, 1 for corrupt data, 2 for an unknown block type
+ * and 3 when there is no memory for the tables, like the decoder it
+ * replaces.
  */
 
-static ulg bb;                         /* bit buffer */
-static unsigned bk;                    /* bits in bit buffer */
+/* table entry: bits 0-7 code length, 8-15 operation, 16-31 value */
+#define INF_OP_LIT 0   /* literal, value is the byte */
+#define INF_OP_LIT2 1  /* two literals, value is first | second << 8 */
+#define INF_OP_EOB 2   /* end of block */
+#define INF_OP_BAD 3   /* unused code */
+#define INF_OP_BASE 16 /* + number of extra bits, value is the base */
+#define INF_OP_SUB 32  /* + index bits of the second-level table, value is its offset */
 
-static ush const mask_bits[] = {
-    0x0000,
-    0x0001, 0x0003, 0x0007, 0x000f, 0x001f, 0x003f, 0x007f, 0x00ff,
-    0x01ff, 0x03ff, 0x07ff, 0x0fff, 0x1fff, 0x3fff, 0x7fff, 0xffff
-};
+#define INF_ENTRY(len, op, val) ((uint32)(len) | ((uint32)(op) << 8) | ((uint32)(val) << 16))
+#define INF_LEN(e) ((e)&0xff)
+#define INF_OP(e) (((e) >> 8) & 0xff)
+#define INF_VAL(e) ((e) >> 16)
 
-//#ifdef CRYPT
-//  uch cc;
-//#define NEXTBYTE() 
-//        (get_byte())
-//     (mr_decrypt ? (cc = get_byte(), zdecode(cc), cc) : get_byte())
-//#else
-#define NEXTBYTE()  (uch)get_byte()
-//#endif
-#define NEEDBITS(n) {while(k<(n)){b|=((ulg)NEXTBYTE())<<k;k+=8;}}
-#define DUMPBITS(n) {b>>=(n);k-=(n);}
+#define INF_LBITS 10
+#define INF_DBITS 8
+#define INF_CBITS 7
 
+/*
+ * A second-level table of 2^n entries needs at least n + 1 codes, as
+ * the codes are complete; with 286 literal/length codes (30 distance
+ * codes) the second-level tables can not take more than 1512 (416)
+ * entries together.
+ */
+#define INF_LSIZE ((1 << INF_LBITS) + 1512)
+#define INF_DSIZE ((1 << INF_DBITS) + 416)
+#define INF_CSIZE (1 << INF_CBITS)
+#define INF_TABSIZE ((INF_LSIZE + INF_DSIZE + INF_CSIZE) * sizeof(uint32))
+
+#define INF_LITLEN 0
+#define INF_DIST 1
+#define INF_CODES 2
+
+#define INF_MAXBITS 15
+
+#define INF_MORE 4 /* inf_codes() stopped at a limit, the block goes on */
+
+typedef struct inf_state {
+    const uint8* in;
+    uint32 inpos;
+    uint32 inlen;
+    uint8* out;
+    uint32 outpos;
+    uint32 outlen;
+    uint64 bitbuf;
+    int bitcnt;
+    uint32 instop;  /* inf_codes() stops before reading from here on */
+    uint32 outstop; /* ... or writing from here on */
+    uint32* ltab;
+    uint32* dtab;
+    uint32* ctab;
+    int fixed; /* ltab/dtab hold the fixed codes */
+} inf_state;
+
+/* order of the code length code lengths */
+static const uint8 inf_order[19] = {
+    16, 17, 18, 0, 8, 7, 9, 6, 10, 5, 11, 4, 12, 3, 13, 2, 14, 1, 15};
+static const uint16 inf_lbase[29] = {
+    3, 4, 5, 6, 7, 8, 9, 10, 11, 13, 15, 17, 19, 23, 27, 31,
+    35, 43, 51, 59, 67, 83, 99, 115, 131, 163, 195, 227, 258};
+static const uint8 inf_lext[29] = {
+    0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2,
+    3, 3, 3, 3, 4, 4, 4, 4, 5, 5, 5, 5, 0};
+static const uint16 inf_dbase[30] = {
+    1, 2, 3, 4, 5, 7, 9, 13, 17, 25, 33, 49, 65, 97, 129, 193,
+    257, 385, 513, 769, 1025, 1537, 2049, 3073, 4097, 6145,
+    8193, 12289, 16385, 24577};
+static const uint8 inf_dext[30] = {
+    0, 0, 0, 0, 1, 1, 2, 2, 3, 3, 4, 4, 5, 5, 6, 6,
+    7, 7, 8, 8, 9, 9, 10, 10, 11, 11, 12, 12, 13, 13};
 
 /*
-   Huffman code decoding is performed using a multi-level table lookup.
-   The fastest way to decode is to simply build a lookup table whose
-   size is determined by the longest code.  However, the time it takes
-   to build this table can also be a factor if the data being decoded
-   is not very long.  The most common codes are necessarily the
-   shortest codes, so those codes dominate the decoding time, and hence
-   the speed.  The idea is you can have a shorter table that decodes the
-   shorter, more probable codes, and then point to subsidiary tables for
-   the longer codes.  The time it costs to decode the longer codes is
-   then traded against the time it takes to make longer tables.
-
-   This results of this trade are in the variables lbits and dbits
-   below.  lbits is the number of bits the first level table for literal/
-   length codes can decode in one step, and dbits is the same thing for
-   the distance codes.  Subsequent tables are also less than or equal to
-   those sizes.  These values may be adjusted either when all of the
-   codes are shorter than that, in which case the longest code length in
-   bits is used, or when the shortest code is *longer* than the requested
-   table size, in which case the length of the shortest code in bits is
-   used.
-
-   There are two different values for the two tables, since they code a
-   different number of possibilities each.  The literal/length table
-   codes 286 possible values, or in a flat code, a little over eight
-   bits.  The distance table codes 30 possible values, or a little less
-   than five bits, flat.  The optimum values for speed end up being
-   about one bit more than those, so lbits is 8+1 and dbits is 5+1.
-   The optimum values may differ though from machine to machine, and
-   possibly even between compilers.  Your mileage may vary.
+ * The decoding functions keep the input position and the bit buffer in
+ * locals (stores into the output could alias them in the state); they
+ * are loaded from and saved to the state around each block part.
  */
+#define INF_LOCALS       \
+    const uint8* in;     \
+    uint32 inpos, inlen; \
+    uint64 bitbuf;       \
+    int bitcnt
+#define INF_LOAD(s)           \
+    do {                      \
+        in = (s)->in;         \
+        inpos = (s)->inpos;   \
+        inlen = (s)->inlen;   \
+        bitbuf = (s)->bitbuf; \
+        bitcnt = (s)->bitcnt; \
+    } while (0)
+#define INF_SAVE(s)           \
+    do {                      \
+        (s)->inpos = inpos;   \
+        (s)->bitbuf = bitbuf; \
+        (s)->bitcnt = bitcnt; \
+    } while (0)
+
+/* past the end of the input the stream reads as zeros */
+#define INF_REFILL()                                                          \
+    do {                                                                      \
+        if (inpos + 8 <= inlen) {                                             \
+            while (bitcnt <= 56) {                                            \
+                bitbuf |= (uint64)in[inpos++] << bitcnt;                      \
+                bitcnt += 8;                                                  \
+            }                                                                 \
+        } else {                                                              \
+            while (bitcnt <= 56) {                                            \
+                bitbuf |= (uint64)(inpos < inlen ? in[inpos] : 0) << bitcnt; \
+                inpos++;                                                      \
+                bitcnt += 8;                                                  \
+            }                                                                 \
+        }                                                                     \
+    } while (0)
+
+#define INF_BITS(n) ((uint32)bitbuf & ((1U << (n)) - 1))
+#define INF_DROP(n)      \
+    do {                 \
+        bitbuf >>= (n);  \
+        bitcnt -= (n);   \
+    } while (0)
+
+/* more bytes taken than the input has, not counting the read-ahead */
+#define INF_OVERRUN() (inpos - (uint32)(bitcnt >> 3) > inlen)
+
+static uint32 inf_entry(int kind, int sym, int len) {
+    if (kind == INF_LITLEN) {
+        if (sym < 256) return INF_ENTRY(len, INF_OP_LIT, sym);
+        if (sym == 256) return INF_ENTRY(len, INF_OP_EOB, 0);
+        if (sym < 286) return INF_ENTRY(len, INF_OP_BASE + inf_lext[sym - 257], inf_lbase[sym - 257]);
+        return INF_ENTRY(len, INF_OP_BAD, 0);
+    }
+    if (kind == INF_DIST) {
+        if (sym < 30) return INF_ENTRY(len, INF_OP_BASE + inf_dext[sym], inf_dbase[sym]);
+        return INF_ENTRY(len, INF_OP_BAD, 0);
+    }
+    return INF_ENTRY(len, INF_OP_LIT, sym);
+}
 
+/*
+ * Builds the table for the code lengths lens[0..n-1] into t[0..size-1],
+ * the first-level part indexed by `bits' bits.  Over-subscribed sets and
+ * incomplete sets of more than one code are refused.
+ */
+static int inf_build(uint32* t, int size, int bits, const uint8* lens, int n, int kind) {
+    uint16 count[INF_MAXBITS + 1];
+    uint16 offs[INF_MAXBITS + 2];
+    uint16 sorted[288];
+    uint16 codes[288]; /* canonical code of sorted[i] */
+    uint32 e;
+    int left, len, i, j, used, root, code, prefix, sub, off;
+
+    for (len = 0; len <= INF_MAXBITS; len++) count[len] = 0;
+    for (i = 0; i < n; i++) count[lens[i]]++;
+
+    left = 1;
+    for (len = 1; len <= INF_MAXBITS; len++) {
+        left = (left << 1) - count[len];
+        if (left < 0) return 1; /* over-subscribed */
+    }
+    if (left > 0 && n - count[0] > 1) return 1; /* incomplete */
+
+    offs[1] = 0;
+    for (len = 1; len <= INF_MAXBITS; len++) offs[len + 1] = offs[len] + count[len];
+    code = 0;
+    count[0] = 0;
+    for (i = 0; i < n; i++) {
+        if (lens[i]) sorted[offs[lens[i]]++] = (uint16)i;
+    }
+    j = 0;
+    for (len = 1; len <= INF_MAXBITS; len++) {
+        code = (code + count[len - 1]) << 1;
+        for (i = 0; i < count[len]; i++) codes[j++] = (uint16)(code + i);
+    }
 
-static int lbits = 9;          /* bits in base literal/length lookup table */
-static int dbits = 6;          /* bits in base distance lookup table */
-
-
-/* If BMAX needs to be larger than 16, then h and x[] should be ulg. */
-#define BMAX 16         /* maximum bit length of any code (16 for explode) */
-#define N_MAX 288       /* maximum number of codes in any set */
-
-
-static unsigned hufts;         /* track memory usage */
-
-
-
-#if 0
-static int huft_build(b, n, s, d, e, t, m)
-unsigned *b;            /* code lengths in bits (all assumed <= BMAX) */
-unsigned n;             /* number of codes (assumed <= N_MAX) */
-unsigned s;             /* number of simple-valued codes (0..s-1) */
-ush *d;                 /* list of base values for non-simple codes */
-ush *e;                 /* list of extra bits for non-simple codes */
-struct huft **t;        /* result: starting table */
-int *m;                 /* maximum lookup bits, returns actual */
-/* Given a list of code lengths and a maximum table size, make a set of
-   tables to decode that set of codes.  Return zero on success, one if
-   the given code set is incomplete (the tables are still built in this
-   case), two if the input is invalid (all zero length codes or an
-   oversubscribed set of lengths), and three if not enough memory. */
-#endif
-static int huft_build(unsigned *b,            /* code lengths in bits (all assumed <= BMAX) */
-   unsigned n,             /* number of codes (assumed <= N_MAX) */
-   unsigned s,             /* number of simple-valued codes (0..s-1) */
-   ush *d,                 /* list of base values for non-simple codes */
-   ush *e,                 /* list of extra bits for non-simple codes */
-   struct huft **t,        /* result: starting table */
-   int *m                 /* maximum lookup bits, returns actual */)
-
-/* Given a list of code lengths and a maximum table size, make a set of
-   tables to decode that set of codes.  Return zero on success, one if
-   the given code set is incomplete (the tables are still built in this
-   case), two if the input is invalid (all zero length codes or an
-   oversubscribed set of lengths), and three if not enough memory. */
-{
-  unsigned a;                   /* counter for codes of length k */
-  unsigned c[BMAX+1];           /* bit length count table */
-  unsigned f;                   /* i repeats in table every f entries */
-  int g;                        /* maximum code length */
-  int h;                        /* table level */
-  register unsigned i;          /* counter, current code */
-  register unsigned j;          /* counter */
-  register int k;               /* number of bits in current code */
-  int l;                        /* bits per table (returned in m) */
-  register unsigned *p;         /* pointer into c[], b[], or v[] */
-  register struct huft *q;      /* points to current table */
-  struct huft r;                /* table entry for structure assignment */
-  struct huft *u[BMAX];         /* table stack */
-  unsigned v[N_MAX];            /* values in order of bit length */
-  register int w;               /* bits before this table == (l * h) */
-  unsigned x[BMAX+1];           /* bit offsets, then code stack */
-  unsigned *xp;                 /* pointer into x */
-  int y;                        /* number of dummy codes added */
-  unsigned z;                   /* number of entries in current table */
-
-
-  /* Generate counts for each bit length */
-  memzero(c, sizeof(c));
-  p = b;  i = n;
-  do {
-    Tracecv(*p, (stderr, (n-i >= ' ' && n-i <= '~' ? "%c %d\n" : "0x%x %d\n"), 
-	    n-i, *p));
-    c[*p]++;                    /* assume all entries <= BMAX */
-    p++;                      /* Can't combine with above line (Solaris bug) */
-  } while (--i);
-  if (c[0] == n)                /* null input--all zero length codes */
-  {
-    *t = (struct huft *)NULL;
-    *m = 0;
-    return 0;
-  }
-
-
-  /* Find minimum and maximum length, bound *m by those */
-  l = *m;
-  for (j = 1; j <= BMAX; j++)
-    if (c[j])
-      break;
-  k = j;                        /* minimum code length */
-  if ((unsigned)l < j)
-    l = j;
-  for (i = BMAX; i; i--)
-    if (c[i])
-      break;
-  g = i;                        /* maximum code length */
-  if ((unsigned)l > i)
-    l = i;
-  *m = l;
-
-
-  /* Adjust last length count to fill out codes, if needed */
-  for (y = 1 << j; j < i; j++, y <<= 1)
-    if ((y -= c[j]) < 0)
-      return 2;                 /* bad input: more codes than bits */
-  if ((y -= c[i]) < 0)
-    return 2;
-  c[i] += y;
-
-
-  /* Generate starting offsets into the value table for each length */
-  x[1] = j = 0;
-  p = c + 1;  xp = x + 2;
-  while (--i) {                 /* note that i == g from above */
-    *xp++ = (j += *p++);
-  }
-
-
-  /* Make a table of values in order of bit lengths */
-  p = b;  i = 0;
-  do {
-    if ((j = *p++) != 0)
-      v[x[j]++] = i;
-  } while (++i < n);
-
-
-  /* Generate the Huffman codes and for each, make the table entries */
-  x[0] = i = 0;                 /* first Huffman code is zero */
-  p = v;                        /* grab values in bit order */
-  h = -1;                       /* no tables yet--level -1 */
-  w = -l;                       /* bits decoded == (l * h) */
-  u[0] = (struct huft *)NULL;   /* just to keep compilers happy */
-  q = (struct huft *)NULL;      /* ditto */
-  z = 0;                        /* ditto */
-
-  /* go through the bit lengths (k already is bits in shortest code) */
-  for (; k <= g; k++)
-  {
-    a = c[k];
-    while (a--)
-    {
-      /* here i is the Huffman code of length k bits for value *p */
-      /* make tables up to required level */
-      while (k > w + l)
-      {
-        h++;
-        w += l;                 /* previous table always l bits */
-
-        /* compute minimum size table less than or equal to l bits */
-        z = (z = g - w) > (unsigned)l ? l : z;  /* upper limit on table size */
-        if ((f = 1 << (j = k - w)) > a + 1)     /* try a k-w bit table */
-        {                       /* too few codes for k-w bit table */
-          f -= a + 1;           /* deduct codes from patterns left */
-          xp = c + k;
-          while (++j < z)       /* try smaller tables up to z bits */
-          {
-            if ((f <<= 1) <= *++xp)
-              break;            /* enough codes to use up j bits */
-            f -= *xp;           /* else deduct codes from patterns */
-          }
+    root = 1 << bits;
+    if (left > 0) { /* only then some entries stay unused */
+        for (i = 0; i < root; i++) t[i] = INF_ENTRY(0, INF_OP_BAD, 0);
+    }
+    used = root;
+    prefix = -1;
+
+    for (i = 0; i < j; i++) {
+        int sym = sorted[i];
+        uint32 rev = 0;
+        len = lens[sym];
+        code = codes[i];
+        for (off = 0; off < len; off++) rev = (rev << 1) | ((code >> off) & 1);
+
+        if (len <= bits) {
+            e = inf_entry(kind, sym, len);
+            for (off = rev; off < root; off += 1 << len) t[off] = e;
+            continue;
         }
-        z = 1 << j;             /* table entries for j-bit table */
-
-        /* allocate and link in new table */
-        if ((q = (struct huft *)MR_MALLOC((z + 1)*sizeof(struct huft))) == (struct huft *)NULL)
-        {
-          if (h)
-            huft_free(u[0]);
-          return 3;             /* not enough memory */
+        /* codes with the same first bits follow each other in canonical
+           order, so the last of them is the longest */
+        if ((int)(rev & (root - 1)) != prefix) {
+            int k = i, maxlen = len;
+            while (k + 1 < j && (codes[k + 1] >> (lens[sorted[k + 1]] - bits)) == (code >> (len - bits))) {
+                k++;
+                maxlen = lens[sorted[k]];
+            }
+            prefix = rev & (root - 1);
+            sub = maxlen - bits;
+            if (used + (1 << sub) > size) return 1;
+            t[prefix] = INF_ENTRY(bits, INF_OP_SUB + sub, used);
+            if (left > 0) {
+                for (off = 0; off < (1 << sub); off++) t[used + off] = INF_ENTRY(0, INF_OP_BAD, 0);
+            }
+            used += 1 << sub;
         }
+        sub = INF_OP(t[prefix]) - INF_OP_SUB;
+        off = INF_VAL(t[prefix]);
+        e = inf_entry(kind, sym, len - bits);
+        for (rev >>= bits; rev < (uint32)(1 << sub); rev += 1 << (len - bits)) t[off + rev] = e;
+    }
 
-        q->l = (z + 1)*sizeof(struct huft);
-        hufts += z + 1;         /* track memory usage */
-        *t = q + 1;             /* link to list for huft_free() */
-        *(t = &(q->v.t)) = (struct huft *)NULL;
-        u[h] = ++q;             /* table starts after link */
-
-        /* connect to last table, if there is one */
-        if (h)
-        {
-          x[h] = i;             /* save pattern for backing up */
-          r.b = (uch)l;         /* bits to dump before this table */
-          r.e = (uch)(16 + j);  /* bits in this table */
-          r.v.t = q;            /* pointer to this table */
-          j = i >> (w - l);     /* (get around Turbo C bug) */
-          u[h-1][j] = r;        /* connect to last table */
+    if (kind == INF_LITLEN) {
+        /* pair literals whose codes fit in the index together; going down
+           keeps t[i >> len] a single literal while it is read */
+        for (i = root - 1; i >= 0; i--) {
+            uint32 e2;
+            e = t[i];
+            if (INF_OP(e) != INF_OP_LIT) continue;
+            e2 = t[i >> INF_LEN(e)];
+            if (INF_OP(e2) == INF_OP_LIT && INF_LEN(e) + INF_LEN(e2) <= (uint32)bits) {
+                t[i] = INF_ENTRY(INF_LEN(e) + INF_LEN(e2), INF_OP_LIT2, INF_VAL(e) | (INF_VAL(e2) << 8));
+            }
         }
-      }
-
-      /* set up table entry in r */
-      r.b = (uch)(k - w);
-      if (p >= v + n)
-        r.e = 99;               /* out of values--invalid code */
-      else if (*p < s)
-      {
-        r.e = (uch)(*p < 256 ? 16 : 15);    /* 256 is end-of-block code */
-        r.v.n = (ush)(*p);             /* simple code is just the value */
-	p++;                           /* one compiler does not like *p++ */
-      }
-      else
-      {
-        r.e = (uch)e[*p - s];   /* non-simple--look up in lists */
-        r.v.n = d[*p++ - s];
-      }
-
-      /* fill code-like entries with r */
-      f = 1 << (k - w);
-      for (j = i >> w; j < z; j += f)
-        q[j] = r;
-
-      /* backwards increment the k-bit code i */
-      for (j = 1 << (k - 1); i & j; j >>= 1)
-        i ^= j;
-      i ^= j;
-
-      /* backup over finished tables */
-      while ((i & ((1 << w) - 1)) != x[h])
-      {
-        h--;                    /* don't need to update q */
-        w -= l;
-      }
     }
-  }
-
-
-  /* Return true (1) if we were given an incomplete table */
-  return y != 0 && g != 1;
+    return 0;
 }
 
+/* reads the header of a stored block, the length goes to *len */
+static int inf_storedHead(inf_state* s, uint32* len) {
+    INF_LOCALS;
+
+    INF_LOAD(s);
+    /* go to a byte boundary and give back the whole bytes */
+    INF_DROP(bitcnt & 7);
+    inpos -= bitcnt >> 3;
+    s->bitbuf = 0;
+    s->bitcnt = 0;
+
+    if (inpos > inlen || inlen - inpos < 4) return 1;
+    *len = in[inpos] | (in[inpos + 1] << 8);
+    if (*len != (~(uint32)(in[inpos + 2] | (in[inpos + 3] << 8)) & 0xffff)) return 1;
+    s->inpos = inpos + 4;
+    return 0;
+}
 
+static int inf_stored(inf_state* s) {
+    uint32 n;
 
-static int huft_free(
-struct huft *t         /* table to free */)
-/* Free the malloc'ed tables built by huft_build(), which makes a linked
-   list of the tables it made, with the links in a dummy first entry of
-   each table. */
-{
-  register struct huft *p, *q;
-
-
-  /* Go through linked list, freeing from the malloced (t[-1]) address. */
-  p = t;
-  while (p != (struct huft *)NULL)
-  {
-    q = (--p)->v.t;
-    MR_FREE((char*)p, p->l);
-    p = q;
-  } 
-  return 0;
+    if (inf_storedHead(s, &n)) return 1;
+    if (n > s->inlen - s->inpos || n > s->outlen - s->outpos) return 1;
+    MEMCPY(s->out + s->outpos, s->in + s->inpos, n);
+    s->inpos += n;
+    s->outpos += n;
+    return 0;
 }
 
+static int inf_fixed(inf_state* s) {
+    uint8 lens[288];
+    int i;
+
+    if (s->fixed) return 0;
+    for (i = 0; i < 144; i++) lens[i] = 8;
+    for (; i < 256; i++) lens[i] = 9;
+    for (; i < 280; i++) lens[i] = 7;
+    for (; i < 288; i++) lens[i] = 8;
+    if (inf_build(s->ltab, INF_LSIZE, INF_LBITS, lens, 288, INF_LITLEN)) return 1;
+    for (i = 0; i < 32; i++) lens[i] = 5;
+    if (inf_build(s->dtab, INF_DSIZE, INF_DBITS, lens, 32, INF_DIST)) return 1;
+    s->fixed = 1;
+    return 0;
+}
 
-static int inflate_codes(
-struct huft *tl, struct huft *td,   /* literal/length and distance decoder tables */
-int bl, int bd             /* number of bits decoded by tl[] and td[] */)
-/* inflate (decompress) the codes in a deflated (compressed) block.
-   Return an error code or zero if it all goes ok. */
-{
-  register unsigned e;  /* table entry flag/number of extra bits */
-  unsigned n, d;        /* length and index for copy */
-  unsigned w;           /* current window position */
-  struct huft *t;       /* pointer to table entry */
-  unsigned ml, md;      /* masks for bl and bd bits */
-  register ulg b;       /* bit buffer */
-  register unsigned k;  /* number of bits in bit buffer */
-
-
-  /* make local copies of globals */
-  b = bb;                       /* initialize bit buffer */
-  k = bk;
-  w = wp;                       /* initialize window position */
-
-  /* inflate the coded data */
-  ml = mask_bits[bl];           /* precompute masks for speed */
-  md = mask_bits[bd];
-  for (;;)                      /* do until end of block */
-  {
-    NEEDBITS((unsigned)bl)
-    if ((e = (t = tl + ((unsigned)b & ml))->e) > 16)
-      do {
-        if (e == 99)
-          return 1;
-        DUMPBITS(t->b)
-        e -= 16;
-        NEEDBITS(e)
-      } while ((e = (t = t->v.t + ((unsigned)b & mask_bits[e]))->e) > 16);
-    DUMPBITS(t->b)
-    if (e == 16)                /* then it's a literal */
-    {
-      slide[w++] = (uch)t->v.n;
-      Tracevv((stderr, "%c", slide[w-1]));
-      if (w == WSIZE)
-      {
-//        flush_output(w);
-        w = 0;
-      }
+static int inf_dynamic(inf_state* s) {
+    INF_LOCALS;
+    uint8 lens[286 + 30];
+    int nlen, ndist, ncode, i, n;
+    uint32 e;
+
+    s->fixed = 0;
+    INF_LOAD(s);
+    INF_REFILL();
+    nlen = 257 + INF_BITS(5);
+    INF_DROP(5);
+    ndist = 1 + INF_BITS(5);
+    INF_DROP(5);
+    ncode = 4 + INF_BITS(4);
+    INF_DROP(4);
+    if (nlen > 286 || ndist > 30) return 1;
+
+    for (i = 0; i < 19; i++) lens[i] = 0;
+    for (i = 0; i < ncode; i++) {
+        INF_REFILL();
+        lens[inf_order[i]] = (uint8)INF_BITS(3);
+        INF_DROP(3);
     }
-    else                        /* it's an EOB or a length */
-    {
-      /* exit if end of block */
-      if (e == 15)
-        break;
-
-      /* get length of block to copy */
-      NEEDBITS(e)
-      n = t->v.n + ((unsigned)b & mask_bits[e]);
-      DUMPBITS(e);
-
-      /* decode distance of block to copy */
-      NEEDBITS((unsigned)bd)
-      if ((e = (t = td + ((unsigned)b & md))->e) > 16)
-        do {
-          if (e == 99)
-            return 1;
-          DUMPBITS(t->b)
-          e -= 16;
-          NEEDBITS(e)
-        } while ((e = (t = t->v.t + ((unsigned)b & mask_bits[e]))->e) > 16);
-      DUMPBITS(t->b)
-      NEEDBITS(e)
-      d = w - t->v.n - ((unsigned)b & mask_bits[e]);
-      DUMPBITS(e)
-      Tracevv((stderr,"\\[%d,%d]", w-d, n));
-
-      /* do the copy */
-      do {
-        n -= (e = (e = WSIZE - ((d &= WSIZE-1) > w ? d : w)) > n ? n : e);
-        if (w - d >= e)         /* (this test assumes unsigned comparison) */
-        {
-          memcpy2(slide + w, slide + d, e);
-          w += e;
-          d += e;
+    if (inf_build(s->ctab, INF_CSIZE, INF_CBITS, lens, 19, INF_CODES)) return 1;
+
+    n = nlen + ndist;
+    i = 0;
+    while (i < n) {
+        int sym, rep;
+        uint8 val;
+
+        INF_REFILL();
+        e = s->ctab[INF_BITS(INF_CBITS)];
+        if (INF_OP(e) != INF_OP_LIT) return 1;
+        INF_DROP(INF_LEN(e));
+        sym = INF_VAL(e);
+        if (sym < 16) {
+            lens[i++] = (uint8)sym;
+            continue;
         }
-        else                      /* do it slow to avoid memcpy() overlap */
-          do {
-            slide[w++] = slide[d++];
-          } while (--e);
-/*
-        if (w == WSIZE)
-        {
-//          flush_output(w);
-          w = 0;
+        if (sym == 16) {
+            if (i == 0) return 1;
+            val = lens[i - 1];
+            rep = 3 + INF_BITS(2);
+            INF_DROP(2);
+        } else if (sym == 17) {
+            val = 0;
+            rep = 3 + INF_BITS(3);
+            INF_DROP(3);
+        } else {
+            val = 0;
+            rep = 11 + INF_BITS(7);
+            INF_DROP(7);
         }
-*/
-      } while (n);
+        if (i + rep > n) return 1;
+        while (rep--) lens[i++] = val;
     }
-  }
-
-
-  /* restore the globals from the locals */
-  wp = w;                       /* restore global window pointer */
-  bb = b;                       /* restore global bit buffer */
-  bk = k;
+    if (INF_OVERRUN()) return 1;
+    if (lens[256] == 0) return 1; /* no end of block code */
+    INF_SAVE(s);
 
-  /* done */
-  return 0;
+    if (inf_build(s->ltab, INF_LSIZE, INF_LBITS, lens, nlen, INF_LITLEN)) return 1;
+    if (inf_build(s->dtab, INF_DSIZE, INF_DBITS, lens + nlen, ndist, INF_DIST)) return 1;
+    return 0;
 }
 
+/* decodes the data of a block with the codes in ltab/dtab */
+static int inf_codes(inf_state* s) {
+    INF_LOCALS;
+    const uint32* lt = s->ltab;
+    const uint32* dt = s->dtab;
+    uint8* out = s->out;
+    uint32 outpos = s->outpos;
+    uint32 outlen = s->outlen;
+    uint32 e, op, len, dist;
+
+    INF_LOAD(s);
+    for (;;) {
+        if (outpos >= s->outstop || inpos > s->instop) {
+            INF_SAVE(s);
+            s->outpos = outpos;
+            return INF_MORE;
+        }
+        INF_REFILL();
+        if (INF_OVERRUN()) return 1;
 
+        e = lt[INF_BITS(INF_LBITS)];
+        if (INF_OP(e) >= INF_OP_SUB) {
+            INF_DROP(INF_LBITS);
+            e = lt[INF_VAL(e) + INF_BITS(INF_OP(e) - INF_OP_SUB)];
+        }
+        INF_DROP(INF_LEN(e));
+        op = INF_OP(e);
 
-static int inflate_stored(void)
-/* "decompress" an inflated type 0 (stored) block. */
-{
-  unsigned n;           /* number of bytes in block */
-  unsigned w;           /* current window position */
-  register ulg b;       /* bit buffer */
-  register unsigned k;  /* number of bits in bit buffer */
+        if (op == INF_OP_LIT) {
+            if (outpos >= outlen) return 1;
+            out[outpos++] = (uint8)INF_VAL(e);
+            continue;
+        }
+        if (op == INF_OP_LIT2) {
+            if (outlen - outpos < 2) return 1;
+            out[outpos] = (uint8)INF_VAL(e);
+            out[outpos + 1] = (uint8)(INF_VAL(e) >> 8);
+            outpos += 2;
+            continue;
+        }
+        if (op == INF_OP_EOB) break;
+        if (op < INF_OP_BASE) return 1;
 
+        len = INF_VAL(e) + INF_BITS(op - INF_OP_BASE);
+        INF_DROP(op - INF_OP_BASE);
 
-  /* make local copies of globals */
-  b = bb;                       /* initialize bit buffer */
-  k = bk;
-  w = wp;                       /* initialize window position */
+        e = dt[INF_BITS(INF_DBITS)];
+        if (INF_OP(e) >= INF_OP_SUB) {
+            INF_DROP(INF_DBITS);
+            e = dt[INF_VAL(e) + INF_BITS(INF_OP(e) - INF_OP_SUB)];
+        }
+        INF_DROP(INF_LEN(e));
+        op = INF_OP(e);
+        if (op < INF_OP_BASE) return 1;
+        dist = INF_VAL(e) + INF_BITS(op - INF_OP_BASE);
+        INF_DROP(op - INF_OP_BASE);
 
+        if (dist > outpos || len > outlen - outpos) return 1;
+        {
+            uint8* dst = out + outpos;
+            const uint8* src = dst - dist;
+            outpos += len;
+            if (dist >= len && len >= 16) {
+                MEMCPY(dst, src, len);
+            } else if (dist == 1) {
+                MEMSET(dst, *src, len);
+            } else {
+                do {
+                    *dst++ = *src++;
+                } while (--len);
+            }
+        }
+    }
+    INF_SAVE(s);
+    s->outpos = outpos;
+    return 0;
+}
 
-  /* go to byte boundary */
-  n = k & 7;
-  DUMPBITS(n);
+/* reads the 3 bits of a block header, returns the block type */
+static int inf_blockHead(inf_state* s, int* last) {
+    int type;
 
+    if (s->bitcnt < 3) {
+        s->bitbuf |= (uint64)(s->inpos < s->inlen ? s->in[s->inpos] : 0) << s->bitcnt;
+        s->inpos++;
+        s->bitcnt += 8;
+    }
+    *last = (int)(s->bitbuf & 1);
+    type = (int)(s->bitbuf >> 1) & 3;
+    s->bitbuf >>= 3;
+    s->bitcnt -= 3;
+    return type;
+}
 
-  /* get the length and its complement */
-  NEEDBITS(16)
-  n = ((unsigned)b & 0xffff);
-  DUMPBITS(16)
-  NEEDBITS(16)
-  if (n != (unsigned)((~b) & 0xffff))
-    return 1;                   /* error in compressed data */
-  DUMPBITS(16)
+static void inf_init(inf_state* s, uint32* tabs) {
+    s->bitbuf = 0;
+    s->bitcnt = 0;
+    s->instop = 0xffffffff;
+    s->outstop = 0xffffffff;
+    s->ltab = tabs;
+    s->dtab = tabs + INF_LSIZE;
+    s->ctab = tabs + INF_LSIZE + INF_DSIZE;
+    s->fixed = 0;
+}
 
+int mr_inflate(void) {
+    inf_state st;
+    inf_state* s = &st;
+    uint32* tabs;
+    int last, type, ret;
 
-  /* read and output the compressed data */
-  while (n--)
-  {
-    NEEDBITS(8)
-    slide[w++] = (uch)b;
-/*
-    if (w == WSIZE)
-    {
-//      flush_output(w);
-      w = 0;
+    /* without the sizes from mr_get_method() the end of the input is unknown */
+    if (mr_gzInBuf != LG_gzsizebuf) {
+        return 1;
     }
-*/
-    DUMPBITS(8)
-  }
+    tabs = (uint32*)MR_MALLOC(INF_TABSIZE);
+    if (tabs == NULL) {
+        return 3;
+    }
+    inf_init(s, tabs);
+    s->in = mr_gzInBuf;
+    s->inpos = LG_gzinptr;
+    s->inlen = LG_gzinsize;
+    s->outlen = LG_gzoutsize < WSIZE ? LG_gzoutsize : WSIZE;
+    LG_gzsizebuf = NULL; /* the sizes are good for one call */
+    s->out = mr_gzOutBuf;
+    s->outpos = 0;
+
+    do {
+        type = inf_blockHead(s, &last);
+        if (type == 0) {
+            ret = inf_stored(s);
+        } else if (type == 1) {
+            ret = inf_fixed(s);
+            if (ret == 0) ret = inf_codes(s);
+        } else if (type == 2) {
+            ret = inf_dynamic(s);
+            if (ret == 0) ret = inf_codes(s);
+        } else {
+            ret = 2;
+        }
+    } while (ret == 0 && !last);
 
+    /* give back the bytes read ahead */
+    s->inpos -= s->bitcnt >> 3;
+    if (ret == 0 && s->inpos > s->inlen) ret = 1;
+    LG_gzinptr = s->inpos;
+    LG_gzoutcnt = s->outpos;
+    MR_FREE(tabs, INF_TABSIZE);
 
-  /* restore the globals from the locals */
-  wp = w;                       /* restore global window pointer */
-  bb = b;                       /* restore global bit buffer */
-  bk = k;
-  return 0;
+    if (ret == 0) mr_updcrc(mr_gzOutBuf, LG_gzoutcnt);
+    return ret;
 }
 
+/*
+ * Streaming inflate of a gzip member: mr_gzRead() hands out the data in
+ * pieces of any size, so the uncompressed data never has to be in memory
+ * as a whole.  It is inflated into a window of the last 32KB (which the
+ * matches may refer to) plus GZS_OUT bytes of new data; the compressed
+ * data is either all in memory or is read through a small buffer with the
+ * read callback.  The working memory is about 64KB.
+ *
+ * Blocks are decoded in steps that stop when the window or the buffered
+ * input runs low, at symbol boundaries.  The length in the trailer is
+ * checked; the CRC is not, as mr_updcrc() has a single register that
+ * other readers use between the steps.
+ */
 
+#define GZS_HIST 32768
+#define GZS_OUT 16384
+#define GZS_WIN (GZS_HIST + GZS_OUT)
+#define GZS_INBUF 4096
+#define GZS_NEED 1024 /* enough input for any block header */
+
+#define GZS_HEAD 0
+#define GZS_CODES 1
+#define GZS_STORED 2
+#define GZS_TRAILER 3
+#define GZS_DONE 4
+#define GZS_ERROR 5
+
+struct mr_gzstream {
+    inf_state s;
+    mr_gzread_t read;
+    void* ud;
+    uint8* inbuf;   /* NULL when the whole input is in memory */
+    int eof;        /* read() has nothing more */
+    int state;
+    int last;       /* the block being decoded is the last one */
+    uint32 stored;  /* bytes left in a stored block */
+    uint32 outdone; /* window bytes before this are handed out */
+    uint32 total;   /* bytes handed out */
+    uint32 size;    /* block size for MR_FREE */
+};
 
-static int inflate_fixed(void)
-/* decompress an inflated type 1 (fixed Huffman codes) block.  We should
-   either replace this with a custom decoder, or at least precompute the
-   Huffman tables. */
-{
-  int i;                /* temporary variable */
-  struct huft *tl;      /* literal/length code table */
-  struct huft *td;      /* distance code table */
-  int bl;               /* lookup bits for tl */
-  int bd;               /* lookup bits for td */
-  unsigned l[288];      /* length list for huft_build */
-
-
-  /* set up literal table */
-  for (i = 0; i < 144; i++)
-    l[i] = 8;
-  for (; i < 256; i++)
-    l[i] = 9;
-  for (; i < 280; i++)
-    l[i] = 7;
-  for (; i < 288; i++)          /* make a complete, but wrong code set */
-    l[i] = 8;
-  bl = 7;
-  if ((i = huft_build(l, 288, 257, (ush*)cplens, (ush*)cplext, &tl, &bl)) != 0)
-    return i;
-
-
-  /* set up distance table */
-  for (i = 0; i < 30; i++)      /* make an incomplete code set */
-    l[i] = 5;
-  bd = 5;
-  if ((i = huft_build(l, 30, 0, (ush*)cpdist, (ush*)cpdext, &td, &bd)) > 1)
-  {
-    huft_free(tl);
-    return i;
-  }
-
-
-  /* decompress until an end-of-block code */
-  if (inflate_codes(tl, td, bl, bd))
-    return 1;
-
-
-  /* free the decoding tables, return */
-  huft_free(tl);
-  huft_free(td);
-  return 0;
-}
+/* keeps GZS_NEED bytes of input buffered as long as there are */
+static void gzs_fill(mr_gzstream* z) {
+    inf_state* s = &z->s;
+    uint32 n, keep;
+    int32 r;
 
+    if (z->inbuf == NULL || z->eof || s->inlen - s->inpos >= GZS_NEED) {
+        return;
+    }
+    /* the bytes in the bit buffer may be given back, keep them too */
+    keep = s->bitcnt >> 3;
+    n = s->inlen - s->inpos + keep;
+    MEMMOVE(z->inbuf, z->inbuf + s->inpos - keep, n);
+    s->inpos = keep;
+    while (n < GZS_INBUF) {
+        r = z->read(z->ud, z->inbuf + n, GZS_INBUF - n);
+        if (r <= 0) {
+            z->eof = 1;
+            break;
+        }
+        n += r;
+    }
+    s->inlen = n;
+    /* the read-ahead of the bit buffer must stay in real data */
+    s->instop = z->eof ? 0xffffffff : n - 8;
+}
 
+/* skips the gzip header, returns 0 when it is a good one */
+static int gzs_header(mr_gzstream* z) {
+    inf_state* s = &z->s;
+    const uint8* p = s->in + s->inpos;
+    uint32 n = s->inlen - s->inpos, i = 10;
+    int flags;
 
-static int inflate_dynamic(void)
-/* decompress an inflated type 2 (dynamic Huffman codes) block. */
-{
-  int i;                /* temporary variables */
-  unsigned j;
-  unsigned l;           /* last length */
-  unsigned m;           /* mask for bit lengths table */
-  unsigned n;           /* number of lengths to get */
-  struct huft *tl;      /* literal/length code table */
-  struct huft *td;      /* distance code table */
-  int bl;               /* lookup bits for tl */
-  int bd;               /* lookup bits for td */
-  unsigned nb;          /* number of bit length codes */
-  unsigned nl;          /* number of literal/length codes */
-  unsigned nd;          /* number of distance codes */
-#ifdef PKZIP_BUG_WORKAROUND
-  unsigned ll[288+32];  /* literal/length and distance code lengths */
-#else
-  unsigned ll[286+30];  /* literal/length and distance code lengths */
-#endif
-  register ulg b;       /* bit buffer */
-  register unsigned k;  /* number of bits in bit buffer */
-
-
-  /* make local bit buffer */
-  b = bb;
-  k = bk;
-
-
-  /* read in table lengths */
-  NEEDBITS(5)
-  nl = 257 + ((unsigned)b & 0x1f);      /* number of literal/length codes */
-  DUMPBITS(5)
-  NEEDBITS(5)
-  nd = 1 + ((unsigned)b & 0x1f);        /* number of distance codes */
-  DUMPBITS(5)
-  NEEDBITS(4)
-  nb = 4 + ((unsigned)b & 0xf);         /* number of bit length codes */
-  DUMPBITS(4)
-#ifdef PKZIP_BUG_WORKAROUND
-  if (nl > 288 || nd > 32)
-#else
-  if (nl > 286 || nd > 30)
-#endif
-    return 1;                   /* bad lengths */
-
-
-  /* read in bit-length-code lengths */
-  for (j = 0; j < nb; j++)
-  {
-    NEEDBITS(3)
-    ll[border[j]] = (unsigned)b & 7;
-    DUMPBITS(3)
-  }
-  for (; j < 19; j++)
-    ll[border[j]] = 0;
-
-
-  /* build decoding table for trees--single level, 7 bit lookup */
-  bl = 7;
-  if ((i = huft_build(ll, 19, 19, (ush*)NULL, (ush*)NULL, &tl, &bl)) != 0)
-  {
-    if (i == 1)
-      huft_free(tl);
-    return i;                   /* incomplete code set */
-  }
-
-
-  /* read in literal and distance code lengths */
-  n = nl + nd;
-  m = mask_bits[bl];
-  i = l = 0;
-  while ((unsigned)i < n)
-  {
-    NEEDBITS((unsigned)bl)
-    j = (td = tl + ((unsigned)b & m))->b;
-    DUMPBITS(j)
-    j = td->v.n;
-    if (j < 16)                 /* length of code in bits (0..15) */
-      ll[i++] = l = j;          /* save last length in l */
-    else if (j == 16)           /* repeat last length 3 to 6 times */
-    {
-      NEEDBITS(2)
-      j = 3 + ((unsigned)b & 3);
-      DUMPBITS(2)
-      if ((unsigned)i + j > n)
+    if (n < 10 || p[0] != 0x1f || (p[1] != 0x8b && p[1] != 0x9e) || p[2] != DEFLATED) {
         return 1;
-      while (j--)
-        ll[i++] = l;
     }
-    else if (j == 17)           /* 3 to 10 zero length codes */
-    {
-      NEEDBITS(3)
-      j = 3 + ((unsigned)b & 7);
-      DUMPBITS(3)
-      if ((unsigned)i + j > n)
+    flags = p[3];
+    if (flags & (ENCRYPTED | CONTINUATION | RESERVED)) {
         return 1;
-      while (j--)
-        ll[i++] = 0;
-      l = 0;
     }
-    else                        /* j == 18: 11 to 138 zero length codes */
-    {
-      NEEDBITS(7)
-      j = 11 + ((unsigned)b & 0x7f);
-      DUMPBITS(7)
-      if ((unsigned)i + j > n)
+    if (flags & EXTRA_FIELD) {
+        if (i + 2 > n) return 1;
+        i += 2 + SH(p + i);
+    }
+    if (flags & ORIG_NAME) {
+        while (i < n && p[i] != 0) i++;
+        i++;
+    }
+    if (flags & COMMENT) {
+        while (i < n && p[i] != 0) i++;
+        i++;
+    }
+    if (i > n) {
         return 1;
-      while (j--)
-        ll[i++] = 0;
-      l = 0;
     }
-  }
-
-
-  /* free decoding table for trees */
-  huft_free(tl);
-
-
-  /* restore the global bit buffer */
-  bb = b;
-  bk = k;
+    s->inpos += i;
+    return 0;
+}
 
+/* decodes some more data into the window */
+static void gzs_step(mr_gzstream* z) {
+    inf_state* s = &z->s;
+    uint32 n;
+    int type, ret = 0;
 
-  /* build the decoding tables for literal/length and distance codes */
-  bl = lbits;
-  if ((i = huft_build(ll, nl, 257, (ush*)cplens, (ush*)cplext, &tl, &bl)) != 0)
-  {
-    if (i == 1) {
-      //ouli
-      //fprintf(stderr, " incomplete literal tree\n");
-      huft_free(tl);
+    if (s->outpos >= GZS_WIN - MAX_MATCH) {
+        /* everything is handed out, keep the last 32KB for the matches */
+        MEMMOVE(s->out, s->out + s->outpos - GZS_HIST, GZS_HIST);
+        s->outpos = z->outdone = GZS_HIST;
     }
-    return i;                   /* incomplete code set */
-  }
-  bd = dbits;
-  if ((i = huft_build(ll + nl, nd, 0, (ush*)cpdist, (ush*)cpdext, &td, &bd)) != 0)
-  {
-    if (i == 1) {
-      
-      //ouli
-      //fprintf(stderr, " incomplete distance tree\n");
-#ifdef PKZIP_BUG_WORKAROUND
-      i = 0;
+    gzs_fill(z);
+
+    switch (z->state) {
+        case GZS_HEAD:
+            if (z->last) {
+                z->state = GZS_TRAILER;
+                return;
+            }
+            type = inf_blockHead(s, &z->last);
+            if (type == 0) {
+                ret = inf_storedHead(s, &z->stored);
+                z->state = GZS_STORED;
+            } else if (type == 1) {
+                ret = inf_fixed(s);
+                z->state = GZS_CODES;
+            } else if (type == 2) {
+                ret = inf_dynamic(s);
+                z->state = GZS_CODES;
+            } else {
+                ret = 2;
+            }
+            break;
+        case GZS_CODES:
+            ret = inf_codes(s);
+            if (ret == 0) {
+                z->state = GZS_HEAD;
+            } else if (ret == INF_MORE) {
+                ret = 0;
+            }
+            break;
+        case GZS_STORED:
+            n = z->stored;
+            if (n > GZS_WIN - s->outpos) n = GZS_WIN - s->outpos;
+            if (n > s->inlen - s->inpos) n = s->inlen - s->inpos;
+            if (n == 0 && z->stored > 0) {
+                ret = 1; /* the input ended */
+                break;
+            }
+            MEMCPY(s->out + s->outpos, s->in + s->inpos, n);
+            s->inpos += n;
+            s->outpos += n;
+            z->stored -= n;
+            if (z->stored == 0) z->state = GZS_HEAD;
+            break;
+        case GZS_TRAILER:
+            /* give back the bytes read ahead, the length follows the CRC */
+            s->inpos -= s->bitcnt >> 3;
+            s->bitbuf = 0;
+            s->bitcnt = 0;
+            if (s->inpos > s->inlen || s->inlen - s->inpos < 8 || LG(s->in + s->inpos + 4) != z->total + (s->outpos - z->outdone)) {
+                ret = 1;
+                break;
+            }
+            s->inpos += 8;
+            z->state = GZS_DONE;
+            break;
     }
-#else
-      huft_free(td);
+    if (ret != 0) {
+        z->state = GZS_ERROR;
     }
-    huft_free(tl);
-    return i;                   /* incomplete code set */
-#endif
-  }
-
-
-  /* decompress until an end-of-block code */
-  if (inflate_codes(tl, td, bl, bd))
-    return 1;
-
-
-  /* free the decoding tables, return */
-  huft_free(tl);
-  huft_free(td);
-  return 0;
 }
 
+mr_gzstream* mr_gzOpen(const uint8* in, uint32 inlen, mr_gzread_t read, void* ud) {
+    mr_gzstream* z;
+    uint32 size = sizeof(mr_gzstream) + INF_TABSIZE + GZS_WIN + (in ? 0 : GZS_INBUF);
 
-
-static int inflate_block(
-int *e                 /* last block flag */)
-/* decompress an inflated block */
-{
-  unsigned t;           /* block type */
-  register ulg b;       /* bit buffer */
-  register unsigned k;  /* number of bits in bit buffer */
-
-
-  /* make local bit buffer */
-  b = bb;
-  k = bk;
-
-
-  /* read in last block bit */
-  NEEDBITS(1)
-  *e = (int)b & 1;
-  DUMPBITS(1)
-
-
-  /* read in block type */
-  NEEDBITS(2)
-  t = (unsigned)b & 3;
-  DUMPBITS(2)
-
-
-  /* restore the global bit buffer */
-  bb = b;
-  bk = k;
-
-
-  /* inflate that block type */
-  if (t == 2)
-    return inflate_dynamic();
-  if (t == 0)
-    return inflate_stored();
-  if (t == 1)
-    return inflate_fixed();
-
-
-  /* bad block type */
-  return 2;
+    z = (mr_gzstream*)MR_MALLOC(size);
+    if (z == NULL) {
+        return NULL;
+    }
+    inf_init(&z->s, (uint32*)(z + 1));
+    z->s.out = (uint8*)(z + 1) + INF_TABSIZE;
+    z->s.outpos = 0;
+    z->s.outlen = GZS_WIN;
+    z->s.outstop = GZS_WIN - MAX_MATCH;
+    z->read = read;
+    z->ud = ud;
+    if (in) {
+        z->inbuf = NULL;
+        z->eof = 1;
+        z->s.in = in;
+        z->s.inlen = inlen;
+    } else {
+        z->inbuf = z->s.out + GZS_WIN;
+        z->eof = 0;
+        z->s.in = z->inbuf;
+        z->s.inlen = 0;
+    }
+    z->s.inpos = 0;
+    z->state = GZS_HEAD;
+    z->last = 0;
+    z->stored = 0;
+    z->outdone = 0;
+    z->total = 0;
+    z->size = size;
+    gzs_fill(z);
+    if (gzs_header(z) != 0) {
+        MR_FREE(z, size);
+        return NULL;
+    }
+    return z;
 }
 
+int32 mr_gzRead(mr_gzstream* z, uint8* buf, uint32 len) {
+    uint32 got = 0, n;
+
+    while (got < len) {
+        n = z->s.outpos - z->outdone;
+        if (n > 0) {
+            if (n > len - got) n = len - got;
+            MEMCPY(buf + got, z->s.out + z->outdone, n);
+            z->outdone += n;
+            z->total += n;
+            got += n;
+            continue;
+        }
+        if (z->state == GZS_DONE) {
+            break;
+        }
+        if (z->state == GZS_ERROR) {
+            return MR_FAILED;
+        }
+        gzs_step(z);
+    }
+    return got;
+}
 
-
-int mr_inflate()
-/* decompress an inflated entry */
-{
-  int e;                /* last block flag */
-  int r;                /* result code */
-  unsigned h;           /* maximum struct huft's malloc'ed */
-
-
-  /* initialize window, bit buffer */
-  wp = 0;
-  bk = 0;
-  bb = 0;
-
-
-  /* decompress until the last block */
-  h = 0;
-  do {
-    hufts = 0;
-    if ((r = inflate_block(&e)) != 0)
-      return r;
-    if (hufts > h)
-      h = hufts;
-  } while (!e);
-
-  /* Undo too much lookahead. The next read will be byte aligned so we
-   * can discard unused bits in the last meaningful byte.
-   */
-  while (bk >= 8) {
-    bk -= 8;
-    LG_gzinptr--;
-  }
-
-  /* flush out slide */
-  mr_updcrc(mr_gzOutBuf, LG_gzoutcnt);
-  //flush_output(wp);
-
-
-  /* return success */
-  return 0;
+void mr_gzClose(mr_gzstream* z) {
+    MR_FREE(z, z->size);
 }
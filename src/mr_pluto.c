@@ -13,6 +13,8 @@
 #include "./src/h/mr_opcodes.h"
 #include "./src/h/mr_state.h"
 #include "./src/h/mr_string.h"
+#include "./src/h/mr_table.h"
+#include "./src/h/mr_undump.h"
 
 
 
@@ -24,7 +26,10 @@
 
 #define PLUTO_TPERMANENT 101
 
-#if 1
+/* initial number of slots of the persist reference map (a power of 2) */
+#define PLUTO_REFMAPSIZE 256
+
+#if 0
 #define verify(x) mrp_assert((int)((x)))
 #else
 #define verify(x) { \
@@ -36,9 +41,25 @@
    }
 #endif
 
+/* Objects already written, and their reference numbers. Open addressing
+ * with linear probing; the keys are not marked by the GC, like those of
+ * the weakly keyed table this replaces. */
+typedef struct RefSlot_t {
+   TObject key;
+   int ref;            /* 0 for a free slot */
+} RefSlot;
+
+typedef struct RefMap_t {
+   int size;
+   int n;
+   RefSlot slot[1];
+} RefMap;
+
 typedef struct PersistInfo_t {
    mrp_State *L;
    int counter;
+   RefMap *refs;       /* kept alive as reftbl[1] */
+   int nanchors;
    mrp_Chunkwriter writer;
    void *ud;
 #ifdef PLUTO_DEBUG
@@ -72,6 +93,92 @@ static StkId getobject(mrp_State *L, int stackpos)
    }
 }
 
+static lu_hash refhash(const TObject *o)
+{
+   lu_hash h;
+   switch(ttype(o)) {
+      case MRP_TNUMBER: {
+         mrp_Number n = nvalue(o);
+         const lu_byte *b = (const lu_byte *)&n;
+         size_t i;
+         h = 0;
+         for(i=0; i<sizeof(n); i++) {
+            h = h*31 + b[i];
+         }
+         break;
+      }
+      case MRP_TBOOLEAN:
+         h = bvalue(o);
+         break;
+      case MRP_TLIGHTUSERDATA:
+         h = IntPoint(pvalue(o));
+         break;
+      default:
+         h = IntPoint(gcvalue(o));
+         break;
+   }
+   h = (h ^ ttype(o)) * 2654435761U;
+   return h ^ (h >> 15);
+}
+
+static RefSlot *findref(RefMap *m, const TObject *o)
+{
+   int i = refhash(o) & (m->size - 1);
+   while(m->slot[i].ref != 0) {
+      if(ttype(&m->slot[i].key) == ttype(o) &&
+         mr_O_rawequalObj(&m->slot[i].key, o)) {
+         break;
+      }
+      i = (i + 1) & (m->size - 1);
+   }
+   return &m->slot[i];
+}
+
+/* Creates a map of the given size, moves the entries of the current one
+ * (if any) into it, and anchors it in place of the old one. */
+static void newrefmap(PersistInfo *pi, int size)
+{
+               /* perms reftbl ... */
+   RefMap *old = pi->refs;
+   RefMap *m = (RefMap *)mrp_newuserdata(pi->L,
+      sizeof(RefMap) + (size - 1) * sizeof(RefSlot));
+               /* perms reftbl ... map */
+   int i;
+   m->size = size;
+   m->n = 0;
+   for(i=0; i<size; i++) {
+      m->slot[i].ref = 0;
+   }
+   if(old != NULL) {
+      for(i=0; i<old->size; i++) {
+         if(old->slot[i].ref != 0) {
+            *findref(m, &old->slot[i].key) = old->slot[i];
+         }
+      }
+      m->n = old->n;
+   }
+   pi->refs = m;
+   mrp_rawseti(pi->L, 2, 1);
+               /* perms reftbl ... */
+}
+
+static int getref(PersistInfo *pi, int stackpos)
+{
+   return findref(pi->refs, getobject(pi->L, stackpos))->ref;
+}
+
+static void addref(PersistInfo *pi, int stackpos, int ref)
+{
+   RefSlot *s;
+   if((pi->refs->n + 1) * 4 > pi->refs->size * 3) {
+      newrefmap(pi, pi->refs->size * 2);
+   }
+   s = findref(pi->refs, getobject(pi->L, stackpos));
+   s->key = *getobject(pi->L, stackpos);
+   s->ref = ref;
+   pi->refs->n++;
+}
+
 /* Choose whether to do a regular or special persistence based on an object's
  * metatable. "default" is whether the object, if it doesn't have a __persist
  * entry, is literally persistable or not.
@@ -159,7 +266,11 @@ static int persistspecialobject(PersistInfo *pi, int defaction)
    }
    persist(pi);
                /* perms reftbl ... obj mt func */
-   mrp_pop(pi->L, 2);
+   /* The function is not reachable from the root: keep it alive, so that
+    * no later object can reuse its address in the reference map */
+   mrp_rawseti(pi->L, 2, ++(pi->nanchors));
+               /* perms reftbl ... obj mt */
+   mrp_pop(pi->L, 1);
                /* perms reftbl ... obj */
    return 1;
 }
@@ -358,6 +469,7 @@ static void persistproto(PersistInfo *pi)
                /* perms reftbl ... proto */
    Proto *p = toproto(pi->L, -1);
 
+   mr_U_checklazy(pi->L, p);
    /* Persist constant refs */
    {
       int i;
@@ -519,27 +631,19 @@ static void persist(PersistInfo *pi)
 {
                /* perms reftbl ... obj */
    /* If the object has already been written, write a reference to it */
-   mrp_pushvalue(pi->L, -1);
-               /* perms reftbl ... obj obj */
-   mrp_rawget(pi->L, 2);
-               /* perms reftbl ... obj ref? */
-   if(!mrp_isnil(pi->L, -1)) {
-               /* perms reftbl ... obj ref */
-      int zero = 0;
-      int ref = (int)mrp_touserdata(pi->L, -1);
-      pi->writer(pi->L, &zero, sizeof(int), pi->ud);
-      pi->writer(pi->L, &ref, sizeof(int), pi->ud);
-      mrp_pop(pi->L, 1);
-               /* perms reftbl ... obj ref */
+   {
+      int ref = getref(pi, -1);
+      if(ref != 0) {
+         int zero = 0;
+         pi->writer(pi->L, &zero, sizeof(int), pi->ud);
+         pi->writer(pi->L, &ref, sizeof(int), pi->ud);
 #ifdef PLUTO_DEBUG
-      printindent(pi->level);
-      printf("0 %d\n", ref);
+         printindent(pi->level);
+         printf("0 %d\n", ref);
 #endif
-      return;
+         return;
+      }
    }
-               /* perms reftbl ... obj nil */
-   mrp_pop(pi->L, 1);
-               /* perms reftbl ... obj */
    /* If the object is nil, write the pseudoreference 0 */
    if(mrp_isnil(pi->L, -1)) {
       int zero = 0;
@@ -558,12 +662,7 @@ static void persist(PersistInfo *pi)
       int one = 1;
       pi->writer(pi->L, &one, sizeof(int), pi->ud);
    }
-   mrp_pushvalue(pi->L, -1);
-               /* perms reftbl ... obj obj */
-   mrp_pushlightuserdata(pi->L, (void*)(++(pi->counter)));
-               /* perms reftbl ... obj obj ref */
-   mrp_rawset(pi->L, 2);
-               /* perms reftbl ... obj */
+   addref(pi, -1, ++(pi->counter));
 
    pi->writer(pi->L, &pi->counter, sizeof(int), pi->ud);
 
@@ -647,54 +746,56 @@ static void persist(PersistInfo *pi)
 #endif
 }
 
-void mr_store_persist(mrp_State *L, mrp_Chunkwriter writer, void *ud)
+/* Returns the number of objects written; the stream header has 0 in its
+ * place (see MR_STORE_COUNTPOS). */
+int mr_store_persist(mrp_State *L, mrp_Chunkwriter writer, void *ud)
 {
    PersistInfo pi;
+   int head[2];
    
    pi.counter = 0;
    pi.L = L;
    pi.writer = writer;
    pi.ud = ud;
+   pi.refs = NULL;
+   pi.nanchors = 1;
 #ifdef PLUTO_DEBUG
    pi.level = 0;
 #endif
 
                /* perms rootobj */
+   /* The reference table only anchors the reference map (at [1]) and the
+    * objects made by __persist functions (from [2] on). */
    mrp_newtable(L);
                /* perms rootobj reftbl */
-
-   /* Now we're going to make the table weakly keyed. This prevents the
-    * GC from visiting it and trying to mark things it doesn't want to
-    * mark in tables, e.g. upvalues. All objects in the table are
-    * a priori reachable, so it doesn't matter that we do this. */
-   mrp_newtable(L);
-               /* perms rootobj reftbl mt */
-   mrp_pushstring(L, "__mode");
-               /* perms rootobj reftbl mt "__mode" */
-   mrp_pushstring(L, "k");
-               /* perms rootobj reftbl mt "__mode" "k" */
-   mrp_settable(L, 4);
-               /* perms rootobj reftbl mt */
-   mrp_setmetatable(L, 3);
-               /* perms rootobj reftbl */
    mrp_insert(L, 2);
                /* perms reftbl rootobj */
+   newrefmap(&pi, PLUTO_REFMAPSIZE);
+
+   head[0] = MR_STORE_MAGIC;
+   head[1] = 0;
+   writer(L, head, sizeof(head), ud);
    persist(&pi);
                /* perms reftbl rootobj */
    mrp_remove(L, 2);
                /* perms rootobj */
+   return pi.counter;
 }
 
 int mr_str_bufwriter (mrp_State *L, const void* p, size_t sz, void* ud) {
    WriterInfo *wi = (WriterInfo *)ud;
 
-   mr_M_reallocvector(L, wi->buf, wi->buflen, wi->buflen+sz, char);
-   while(sz)
-   {
-      wi->buf[wi->buflen++] = *((const char*)p);
-      p = (const char*)p + 1;
-      sz--;
+   if(wi->buflen + sz > wi->bufsize) {
+      /* grow geometrically: the writes are a few bytes each */
+      size_t size = (wi->bufsize > 0) ? wi->bufsize : 256;
+      while(size < wi->buflen + sz) {
+         size *= 2;
+      }
+      mr_M_reallocvector(L, wi->buf, wi->bufsize, size, char);
+      wi->bufsize = size;
    }
+   MEMCPY(wi->buf + wi->buflen, p, sz);
+   wi->buflen += sz;
    return 0;
 }
 
@@ -702,9 +803,11 @@ int persist_l(mrp_State *L)
 {
                /* perms? rootobj? ...? */
    WriterInfo wi;
+   int count;
 
    wi.buf = NULL;
    wi.buflen = 0;
+   wi.bufsize = 0;
 
    mrp_settop(L, 2);
                /* perms? rootobj? */
@@ -713,19 +816,21 @@ int persist_l(mrp_State *L)
    mr_L_checktype(L, 2, MRP_TTABLE);
                /* perms rootobj */
    
-   mr_store_persist(L, mr_str_bufwriter, &wi);
+   count = mr_store_persist(L, mr_str_bufwriter, &wi);
+   MEMCPY(wi.buf + MR_STORE_COUNTPOS, &count, sizeof(int));
 
    mrp_settop(L, 0);
                /* (empty) */
    mrp_pushlstring(L, wi.buf, wi.buflen);
                /* str */
-   mr_M_freearray(L, wi.buf, wi.buflen, char);
+   mr_M_freearray(L, wi.buf, wi.bufsize, char);
    return 1;
 }
 
 typedef struct UnpersistInfo_t {
    mrp_State *L;
    ZIO zio;
+   Table *refs;        /* reftbl: objects by reference number */
 #ifdef PLUTO_DEBUG
    int level;
 #endif
@@ -739,11 +844,7 @@ static void unpersist(UnpersistInfo *upi);
 static void registerobject(int ref, UnpersistInfo *upi)
 {
                /* perms reftbl ... obj */
-   mrp_pushlightuserdata(upi->L, (void*)ref);
-               /* perms reftbl ... obj ref */
-   mrp_pushvalue(upi->L, -2);
-               /* perms reftbl ... obj ref obj */
-   mrp_settable(upi->L, 2);
+   setobj2t(mr_H_setnum(upi->L, upi->refs, ref), getobject(upi->L, -1));
                /* perms reftbl ... obj */
 }
 
@@ -1259,32 +1360,22 @@ static void unpersistpermanent(int ref, UnpersistInfo *upi)
 }
 
 /* For debugging only; not called when mrp_assert is empty */
-int inreftable(mrp_State *L, int ref)
+int inreftable(UnpersistInfo *upi, int ref)
 {
-   int res;
-               /* perms reftbl ... */
-   mrp_pushlightuserdata(L, (void*)ref);
-               /* perms reftbl ... ref */
-   mrp_gettable(L, 2);
-               /* perms reftbl ... obj? */
-   res = !mrp_isnil(L, -1);
-   mrp_pop(L, 1);
-               /* perms reftbl ... */
-   return res;
+   return !ttisnil(mr_H_getnum(upi->refs, ref));
 }
 
-static void unpersist(UnpersistInfo *upi)
+/* firstTime has already been read */
+static void unpersistobject(UnpersistInfo *upi, int firstTime)
 {
                /* perms reftbl ... */
-   int firstTime=0;
    int stacksize = mrp_gettop(upi->L); /* DEBUG */
-   verify(mr_Z_read(&upi->zio, &firstTime, sizeof(int)) == 0);
-   
+
    if(firstTime) {
       int ref=0;
       int type=0;
       verify(mr_Z_read(&upi->zio, &ref, sizeof(int)) == 0);
-      mrp_assert(!inreftable(upi->L, ref));
+      mrp_assert(!inreftable(upi, ref));
       verify(mr_Z_read(&upi->zio, &type, sizeof(int)) == 0);
 #ifdef PLUTO_DEBUG
       printindent(upi->level);
@@ -1353,11 +1444,10 @@ static void unpersist(UnpersistInfo *upi)
          mrp_pushnil(upi->L);
                /* perms reftbl ... nil */
       } else {
-         mrp_pushlightuserdata(upi->L, (void*)ref);
-               /* perms reftbl ... ref */
-         mrp_gettable(upi->L, 2);
-               /* perms reftbl ... obj? */
-         mrp_assert(!mrp_isnil(upi->L, -1));
+         const TObject *o = mr_H_getnum(upi->refs, ref);
+         verify(!ttisnil(o));
+         mr_A_pushobject(upi->L, o);
+               /* perms reftbl ... obj */
       }
                /* perms reftbl ... obj/nil */
    }
@@ -1368,6 +1458,36 @@ static void unpersist(UnpersistInfo *upi)
    firstTime = stacksize; // 抑制gcc编译时的set but not used警告
 }
 
+static void unpersist(UnpersistInfo *upi)
+{
+               /* perms reftbl ... */
+   int firstTime=0;
+   verify(mr_Z_read(&upi->zio, &firstTime, sizeof(int)) == 0);
+   unpersistobject(upi, firstTime);
+}
+
+/* Reads the stream header and returns the object count it gives, or 0.
+ * Streams written before the header start directly with the root, whose
+ * firstTime is left in *head. */
+static int unpersisthead(UnpersistInfo *upi, int *head)
+{
+   int count=0;
+   *head=0;
+   verify(mr_Z_read(&upi->zio, head, sizeof(int)) == 0);
+   if(*head == MR_STORE_MAGIC) {
+      verify(mr_Z_read(&upi->zio, &count, sizeof(int)) == 0);
+      /* The header is not trusted: every object starts with at least
+       * three ints (firstTime, ref, type), so presize no more than the
+       * data left can hold and let the table grow past that */
+      if(count < 0) {
+         count = 0;
+      } else if((size_t)count > upi->zio.n / (3 * sizeof(int))) {
+         count = (int)(upi->zio.n / (3 * sizeof(int)));
+      }
+   }
+   return count;
+}
+
 void mr_store_unpersist(mrp_State *L, mrp_Chunkreader reader, void *ud)
 {
    /* We use the graciously provided ZIO (what the heck does the Z stand
@@ -1376,6 +1496,8 @@ void mr_store_unpersist(mrp_State *L, mrp_Chunkreader reader, void *ud)
     * very unpleasant.
     */
    UnpersistInfo upi;
+   TObject o;
+   int head, count;
    upi.L = L;
 #ifdef PLUTO_DEBUG
    upi.level = 0;
@@ -1383,10 +1505,17 @@ void mr_store_unpersist(mrp_State *L, mrp_Chunkreader reader, void *ud)
 
    mr_Z_init(&upi.zio, reader, ud, "");
 
+   count = unpersisthead(&upi, &head);
                /* perms */
-   mrp_newtable(L);
+   upi.refs = mr_H_new(L, count, 0);
+   sethvalue(&o, upi.refs);
+   mr_A_pushobject(L, &o);
                /* perms reftbl */
-   unpersist(&upi);
+   if(head == MR_STORE_MAGIC) {
+      unpersist(&upi);
+   } else {
+      unpersistobject(&upi, head);
+   }
                /* perms reftbl rootobj */
    mrp_replace(L, 2);
                /* perms rootobj  */
@@ -1403,6 +1532,18 @@ const char *mr_str_bufreader(mrp_State *L, void *ud, size_t *sz) {
    return li->buf;
 }
 
+/* The reader points into the string, which must stay on the stack: it may
+ * have no other reference, and unpersist allocates (and collects) a lot */
+static int unpersist_str(mrp_State *L)
+{
+   LoadInfo *li = (LoadInfo *)mrp_touserdata(L, 2);
+   mrp_settop(L, 1);
+               /* perms */
+   mr_store_unpersist(L, mr_str_bufreader, li);
+               /* perms rootobj */
+   return 1;
+}
+
 int unpersist_l(mrp_State *L)
 {
    LoadInfo li;
@@ -1410,18 +1551,13 @@ int unpersist_l(mrp_State *L)
    mrp_settop(L, 2);
                /* perms? str? */
    li.buf = mr_L_checklstring(L, 2, &li.size);
-               /* perms? str */
-   mrp_pop(L, 1);
-   /* It is conceivable that the buffer might now be collectable,
-    * which would cause problems in the reader. I can't think of
-    * any situation where there would be no other reference to the
-    * buffer, so for now I'll leave it alone, but this is a potential
-    * bug. */
-               /* perms? */
    mr_L_checktype(L, 1, MRP_TTABLE);
-               /* perms */
-   mr_store_unpersist(L, mr_str_bufreader, &li);
-               /* perms rootobj */
+               /* perms str */
+   mrp_pushcfunction(L, unpersist_str);
+   mrp_pushvalue(L, 1);
+   mrp_pushlightuserdata(L, &li);
+   mrp_call(L, 2, 1);
+               /* perms str rootobj */
    return 1;
 }
 
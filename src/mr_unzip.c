@@ -11,6 +11,11 @@
 //char *key;          /* not used--needed to link crypt.c */
 //int pkzip = 0;      /* set for a pkzip file */
 
+/* sizes of the data in LG_gzsizebuf, found by mr_get_method() for mr_inflate() */
+uch *LG_gzsizebuf;
+unsigned LG_gzinsize;
+unsigned LG_gzoutsize;
+
 /* ===========================================================================
  * Unzip in to out.  This routine works on both gzip and pkzip files.
  *
@@ -122,6 +127,13 @@ int mr_get_method(int32 buf_len) {
 	MRDBGPRINTF("check:%d,%d,%d,%d",mr_gzInBuf[0],mr_gzInBuf[1],mr_gzInBuf[2],LG_gzinptr);
 #endif
 
+    /* a gzip member is at least the 10 byte header and the 8 byte trailer;
+       shorter data cannot be inflated without reading past the buffer */
+    if (buf_len < 18) {
+        MRDBGPRINTF("too short for gzip");
+        return -1;
+    }
+
     magic[0] = (char)get_byte();
     magic[1] = (char)get_byte();
     method = -1; /* unknown yet */
@@ -163,7 +175,7 @@ int mr_get_method(int32 buf_len) {
         if ((flags & EXTRA_FIELD) != 0) {
             unsigned len = (unsigned)get_byte();
             len |= ((unsigned)get_byte()) << 8;
-            while (len--) (void)get_byte();
+            while (len-- && LG_gzinptr < (unsigned)buf_len) (void)get_byte();
         }
 
         /* Get original file name if it was truncated */
@@ -172,12 +184,12 @@ int mr_get_method(int32 buf_len) {
             char c; /* dummy used for NeXTstep 3.0 cc optimizer bug */
             do {
                 c = get_byte();
-            } while (c != 0);
+            } while (c != 0 && LG_gzinptr < (unsigned)buf_len);
         } /* ORIG_NAME */
 
         /* Discard file comment if any */
         if ((flags & COMMENT) != 0) {
-            while (get_byte() != 0) /* null */
+            while (LG_gzinptr < (unsigned)buf_len && get_byte() != 0) /* null */
                 ;
         }
 
@@ -195,7 +207,21 @@ int mr_get_method(int32 buf_len) {
     }
 #endif
 
-    if (method >= 0) return method;
+    if (method >= 0) {
+        /* sizes for mr_inflate(): the output size is in the trailer (or in
+           the zip local header), the trailer follows the compressed data */
+        if (LG_gzinptr > (unsigned)buf_len - 8) {  /* the fields ran into the trailer */
+            MRDBGPRINTF("header too long");
+            return -1;
+        }
+        LG_gzsizebuf = mr_gzInBuf;
+        LG_gzinsize = buf_len - 8;
+        LG_gzoutsize = LG(mr_gzInBuf + buf_len - 4);
+#ifdef MR_PKZIP_MAGIC
+        if (mr_zipType == PACKED) LG_gzoutsize = LG(mr_gzInBuf + LOCLEN);
+#endif
+        return method;
+    }
 
     MRDBGPRINTF("nozip");
     return -1;
@@ -7,6 +7,7 @@
 #include "./include/mr.h"
 #include "./include/mr_auxlib.h"
 #include "./include/mr_base64.h"
+#include "./include/mr_context.h"
 #include "./include/mr_graphics.h"
 #include "./include/mr_gzip.h"
 #include "./include/mr_helper.h"
@@ -58,6 +59,25 @@ int32 mr_screen_h;
 static int32 mr_screen_bit;
 static void* mr_timer_p;
 static int32 mr_timer_state = MR_TIMER_STATE_IDLE;
+
+static mr_handlerRef mr_dealevent_h = {MRP_NOREF, NULL, NULL};
+static mr_handlerRef mr_timer_h = {MRP_NOREF, NULL, NULL};
+#ifdef MR_TRACE
+static mr_handlerRef mr_trace_h = {MRP_NOREF, NULL, NULL};
+#endif
+
+/* calls into the VM through _mr_pcall, see _mr_TestCom 415 */
+static uint32 mr_vmcall_count;
+static uint32 mr_vmcall_errors;
+static uint32 mr_vmcall_mark;
+static int32 mr_vmcall_marktime;
+static int mr_vmcall_depth;
+
+/* instructions a callback may run, see _mr_TestCom 416/417 */
+static int32 mr_budget_limit;
+static int32 mr_budget_last;
+static int32 mr_budget_max;
+static uint32 mr_budget_over;
 int32 mr_timer_run_without_pause = FALSE;
 
 static char* mr_exception_str = NULL;
@@ -1093,7 +1113,7 @@ static int MRF_BmGetScr(mrp_State* L) {
         return 0;
     }
     if (mr_bitmap[i].p) {
-        MR_FREE(mr_bitmap[i].p, mr_bitmap[i].buflen);
+        _mr_readFileRelease(mr_bitmap[i].p, mr_bitmap[i].buflen);
         mr_bitmap[i].p = NULL;
     }
 
@@ -1203,289 +1223,1139 @@ static void _mr_readFileShowInfo(const char* filename, int32 code) {
     MRDBGPRINTF("read file  \"%s\" err, code=%d", filename, code);
 }
 
-void* _mr_readFile(const char* filename, int* filelen, int lookfor) {
-    // int ret;
-    int method;
-    uint32 reallen, found = 0;
-    int32 oldlen, nTmp;
+#ifdef MR_PCACHE
+/*
+脚本缓存：mrp中的脚本每次启动都要 inflate 后再 undump，
+这里把解压并校验过的字节码存到 pcache 目录，
+以 mrp路径+文件名 做文件名，以 gzip 尾部的 CRC 和长度做键，
+mrp 更新后 CRC 不一致缓存自动失效。
+*/
+#define MR_PCACHE_DIR "pcache"
+#define MR_PCACHE_MAGIC 0x4350524D /* "MRPC" */
+
+typedef struct {
+    uint32 magic;
+    uint32 crc;
     uint32 len;
-    void* filebuf;
-    int32 f;
-    char TempName[MR_MAX_FILENAME_SIZE];
-    char* mr_m0_file;
-    int is_rom_file = FALSE;
+    uint32 keylen;
+} mr_pcacheHead;
 
-    if ((pack_filename[0] == '*') || (pack_filename[0] == '$')) { /*m0 file or ram file?*/
-        uint32 pos = 0;
-        uint32 m0file_len;
+static int32 mr_pcache_on = TRUE;
+static int32 mr_pcache_hit, mr_pcache_miss;
 
-        if (pack_filename[0] == '*') {                                 /*m0 file?*/
-            mr_m0_file = (char*)mr_m0_files[pack_filename[1] - 0x41];  //这里定义文件名为*A即是第一个m0文件 *B是第二个.........
-        } else {
-            mr_m0_file = mr_ram_file;
-        }
+static int32 _mr_pcacheKey(char* key, const char* filename) {
+    SPRINTF(key, "%s|%s", pack_filename, filename);
+    return STRLEN(key);
+}
 
-        if (mr_m0_file == NULL) {
-            //MRDBGPRINTF( "_mr_readFile:mr_m0_file nil at \"%s\"!",filename);
-            _mr_readFileShowInfo(filename, 1001);
-            return 0;
+static void _mr_pcacheName(char* name, const char* key, int32 keylen, const char* ext) {
+    mr_updcrc(NULL, 0);
+    SPRINTF(name, "%s/%08x.%s", MR_PCACHE_DIR, mr_updcrc((uint8*)key, keylen), ext);
+}
+
+static void* _mr_pcacheLoad(const char* filename, uint32 crc, uint32 len) {
+    char key[MR_MAX_FILENAME_SIZE * 2 + 2];
+    char TempName[MR_MAX_FILENAME_SIZE * 2 + 2];
+    char name[MR_MAX_FILENAME_SIZE];
+    mr_pcacheHead head;
+    int32 f, keylen, oldlen, nTmp;
+    uint8* buf;
+
+    keylen = _mr_pcacheKey(key, filename);
+    _mr_pcacheName(name, key, keylen, "mrc");
+    f = mr_open(name, MR_FILE_RDONLY);
+    if (f == 0) {
+        mr_pcache_miss++;
+        return NULL;
+    }
+    nTmp = mr_read(f, &head, sizeof(head));
+    if ((nTmp != sizeof(head)) || (head.magic != MR_PCACHE_MAGIC) || (head.crc != crc) || (head.len != len) || (head.keylen != (uint32)keylen) || (mr_read(f, TempName, keylen) != keylen) || (MEMCMP(TempName, key, keylen) != 0)) {
+        mr_close(f);
+        mr_pcache_miss++;
+        return NULL;
+    }
+    buf = MR_MALLOC(len);
+    if (buf == NULL) {
+        mr_close(f);
+        return NULL;
+    }
+    oldlen = 0;
+    while (oldlen < (int32)len) {
+        nTmp = mr_read(f, buf + oldlen, len - oldlen);
+        if (nTmp <= 0) {
+            break;
         }
-        pos = pos + 4;
-        MEMCPY(&len, &mr_m0_file[pos], 4);
-        pos = pos + 4;
+        oldlen = oldlen + nTmp;
+    }
+    mr_close(f);
+    mr_updcrc(NULL, 0);
+    if ((oldlen != (int32)len) || (mr_updcrc(buf, len) != crc)) {
+        MRDBGPRINTF("pcache \"%s\" broken", name);
+        MR_FREE(buf, len);
+        mr_remove(name);
+        mr_pcache_miss++;
+        return NULL;
+    }
+    mr_pcache_hit++;
+    return buf;
+}
 
-        if ((pack_filename[0] == '$')) {
-            m0file_len = mr_ram_file_len;
+static void _mr_pcacheStore(const char* filename, uint32 crc, void* buf, uint32 len) {
+    char key[MR_MAX_FILENAME_SIZE * 2 + 2];
+    char name[MR_MAX_FILENAME_SIZE];
+    char tmpname[MR_MAX_FILENAME_SIZE];
+    mr_pcacheHead head;
+    int32 f, keylen, ret;
 
-#ifdef MR_AUTHORIZATION
-            if (bi & MR_FLAGS_AI) {
-                if (_mr_isMr(&mr_m0_file[52]) != MR_SUCCESS) {
-                    _mr_readFileShowInfo("unauthorized", 3);
-                    return 0;
-                }
-            } else {
-            }
-#endif
-        } else {
-            MEMCPY(&m0file_len, &mr_m0_file[pos], 4);
+    if (mr_info(MR_PCACHE_DIR) != MR_IS_DIR) {
+        mr_mkDir(MR_PCACHE_DIR);
+    }
+    keylen = _mr_pcacheKey(key, filename);
+    _mr_pcacheName(name, key, keylen, "mrc");
+    _mr_pcacheName(tmpname, key, keylen, "tmp");
+
+    mr_remove(tmpname);
+    f = mr_open(tmpname, MR_FILE_WRONLY | MR_FILE_CREATE);
+    if (f == 0) {
+        return;
+    }
+    head.magic = MR_PCACHE_MAGIC;
+    head.crc = crc;
+    head.len = len;
+    head.keylen = keylen;
+    ret = (mr_write(f, &head, sizeof(head)) == sizeof(head)) && (mr_write(f, key, keylen) == keylen) && (mr_write(f, buf, len) == (int32)len);
+    mr_close(f);
+    if (ret) {
+        mr_remove(name);
+        if (mr_rename(tmpname, name) == MR_SUCCESS) {
+            return;
         }
+    }
+    mr_remove(tmpname);
+}
+#endif
 
-        //MRDBGPRINTF("readFile 11 len = %d", len);
-        //MRDBGPRINTF("readFile 21 len = %d", m0file_len);
-        pos = pos + len;
-        while (!found) {
-            if (((pos + 4) >= m0file_len) || (len < 1) || (len >= MR_MAX_FILE_SIZE)) {
-                _mr_readFileShowInfo(filename, 1004);
-                return 0;
-            }
-            MEMCPY(&len, &mr_m0_file[pos], 4);
+#ifdef MR_ACACHE
+/*
+解压缓存：切换场景时应用常常重复加载同样的压缩位图和脚本，
+这里把解压过的数据留一份在内存池里，以 mrp路径+文件名 和 gzip 尾部的 CRC、长度做键，
+再读到时直接复制，不用再 inflate。按最近使用的顺序淘汰，总大小不超过 mr_acache_budget；
+mr_malloc 内存不够时先淘汰缓存再重试。
+*/
+typedef struct mr_acache {
+    struct mr_acache* prev; /* 更近用过的 */
+    struct mr_acache* next; /* 更久没用的 */
+    uint32 crc;
+    uint32 len;
+    uint32 keylen;
+} mr_acache; /* 后面跟着 len 字节的数据和 keylen 字节的键 */
+
+#define ACACHE_DATA(e) ((uint8*)((e) + 1))
+#define ACACHE_KEY(e) ((char*)ACACHE_DATA(e) + (e)->len)
+#define ACACHE_BLOCK(e) (sizeof(mr_acache) + (e)->len + (e)->keylen)
+
+static mr_acache* mr_acache_head; /* 最近用过的 */
+static mr_acache* mr_acache_tail;
+static uint32 mr_acache_used; /* 数据的总字节数 */
+static uint32 mr_acache_budget = MR_ACACHE_SIZE;
+static uint32 mr_acache_hit, mr_acache_miss, mr_acache_saved;
+
+static void _mr_acacheUnlink(mr_acache* e) {
+    if (e->prev) {
+        e->prev->next = e->next;
+    } else {
+        mr_acache_head = e->next;
+    }
+    if (e->next) {
+        e->next->prev = e->prev;
+    } else {
+        mr_acache_tail = e->prev;
+    }
+}
 
-            pos = pos + 4;
-            if (((len + pos) >= m0file_len) || (len < 1) || (len >= MR_MAX_FILENAME_SIZE)) {
-                _mr_readFileShowInfo(filename, 1002);
-                return 0;
-            }
-            MEMSET(TempName, 0, sizeof(TempName));
-            MEMCPY(TempName, &mr_m0_file[pos], len);
-            pos = pos + len;
-            if (STRCMP(filename, TempName) == 0) {
-                if (lookfor == 1) {
-                    return (void*)1;
-                }
-                found = 1;
-                MEMCPY(&len, &mr_m0_file[pos], 4);
+static void _mr_acacheLink(mr_acache* e) {
+    e->prev = NULL;
+    e->next = mr_acache_head;
+    if (mr_acache_head) {
+        mr_acache_head->prev = e;
+    } else {
+        mr_acache_tail = e;
+    }
+    mr_acache_head = e;
+}
 
-                pos = pos + 4;
-                if (((len + pos) > m0file_len) || (len < 1) || (len >= MR_MAX_FILE_SIZE)) {
-                    _mr_readFileShowInfo(filename, 1003);
-                    return 0;
-                }
-            } else {
-                MEMCPY(&len, &mr_m0_file[pos], 4);
+static uint32 _mr_acacheDropLast(void) {
+    mr_acache* e = mr_acache_tail;
+    uint32 n = ACACHE_BLOCK(e);
+    _mr_acacheUnlink(e);
+    mr_acache_used -= e->len;
+    MR_FREE(e, n);
+    return n;
+}
 
-                pos = pos + 4 + len;
-            } /*if (STRCMP(filename, TempName)==0)*/
-        }
+/*淘汰到数据总量不超过 budget*/
+static void _mr_acacheTrim(uint32 budget) {
+    while (mr_acache_tail && (mr_acache_used > budget)) {
+        _mr_acacheDropLast();
+    }
+}
 
-        *filelen = len;
-        if (*filelen <= 0) {
-            _mr_readFileShowInfo(filename, 1005);
-            return 0;
-        }
+/*LG_mem_reclaim：mr_malloc 申请 len 字节失败时调用*/
+static int32 _mr_acacheReclaim(uint32 len) {
+    uint32 freed = 0;
+    if (mr_acache_tail == NULL) {
+        return FALSE;
+    }
+    while (mr_acache_tail && (freed < len)) {
+        freed += _mr_acacheDropLast();
+    }
+    return TRUE;
+}
 
-        if (lookfor == 2) {
-            return (void*)&mr_m0_file[pos];
-        }
-        filebuf = &mr_m0_file[pos];
-        is_rom_file = TRUE;
-    } else { /*read file from efs , EFS 中的文件*/
-        f = mr_open(pack_filename, MR_FILE_RDONLY);
-        if (f == 0) {
-            _mr_readFileShowInfo(filename, 2002);
-            return 0;
-        }
+/*内存池被重建时调用*/
+static void _mr_acacheReset(void) {
+    mr_acache_head = NULL;
+    mr_acache_tail = NULL;
+    mr_acache_used = 0;
+}
 
-        // 从这里开始是新版的mrp处理
-        {
-            uint32 headbuf[4];
-            nTmp = mr_read(f, &headbuf, sizeof(headbuf));
-            if ((nTmp != 16) || (headbuf[0] != 1196446285)) {
-                mr_close(f);
-                _mr_readFileShowInfo(filename, 3001);
-                return 0;
+static int32 _mr_acacheKey(char* key, const char* filename) {
+    SPRINTF(key, "%s|%s", pack_filename, filename);
+    return STRLEN(key);
+}
+
+/*命中时返回数据的副本*/
+static void* _mr_acacheGet(const char* filename, uint32 crc, uint32 len) {
+    char key[MR_MAX_FILENAME_SIZE * 2 + 2];
+    int32 keylen;
+    mr_acache* e;
+    void* buf;
+
+    if (mr_acache_budget == 0) {
+        return NULL;
+    }
+    keylen = _mr_acacheKey(key, filename);
+    for (e = mr_acache_head; e; e = e->next) {
+        if ((e->crc == crc) && (e->len == len) && (e->keylen == (uint32)keylen) && (MEMCMP(ACACHE_KEY(e), key, keylen) == 0)) {
+            _mr_acacheUnlink(e); /* 下面申请内存时不能把它淘汰掉 */
+            buf = MR_MALLOC(len);
+            _mr_acacheLink(e);
+            if (buf == NULL) {
+                return NULL;
             }
-            if (headbuf[1] > 232) {  //新版mrp
-                uint32 indexlen = headbuf[1] + 8 - headbuf[3];
-                uint8* indexbuf = MR_MALLOC(indexlen);
-                uint32 pos = 0;
-                uint32 file_pos, file_len;
-                if (!indexbuf) {
-                    mr_close(f);
-                    _mr_readFileShowInfo(filename, 3003);
-                    return 0;
-                }
-                nTmp = mr_seek(f, headbuf[3] - 16, MR_SEEK_CUR);
-                if (nTmp < 0) {
-                    mr_close(f);
-                    MR_FREE(indexbuf, indexlen);
-                    _mr_readFileShowInfo(filename, 3002);
-                    return 0;
-                }
+            MEMCPY(buf, ACACHE_DATA(e), len);
+            mr_acache_hit++;
+            mr_acache_saved += len;
+            return buf;
+        }
+    }
+    mr_acache_miss++;
+    return NULL;
+}
 
-                nTmp = mr_read(f, indexbuf, indexlen);
+static void _mr_acachePut(const char* filename, uint32 crc, const void* buf, uint32 len) {
+    char key[MR_MAX_FILENAME_SIZE * 2 + 2];
+    int32 keylen;
+    mr_acache* e;
+    LG_mem_reclaim_t reclaim = LG_mem_reclaim;
 
-                if ((nTmp != (int32)indexlen)) {
-                    mr_close(f);
-                    MR_FREE(indexbuf, indexlen);
-                    _mr_readFileShowInfo(filename, 3003);
-                    return 0;
-                }
+    if (len > mr_acache_budget / 2) { /* 太大的不缓存，免得把别的都挤掉 */
+        return;
+    }
+    keylen = _mr_acacheKey(key, filename);
+    _mr_acacheTrim(mr_acache_budget - len);
+    LG_mem_reclaim = NULL; /* 内存不够就不缓存，不为它淘汰别的 */
+    e = MR_MALLOC(sizeof(mr_acache) + len + keylen);
+    LG_mem_reclaim = reclaim;
+    if (e == NULL) {
+        return;
+    }
+    e->crc = crc;
+    e->len = len;
+    e->keylen = keylen;
+    MEMCPY(ACACHE_DATA(e), buf, len);
+    MEMCPY(ACACHE_KEY(e), key, keylen);
+    _mr_acacheLink(e);
+    mr_acache_used += len;
+}
+#endif
 
-                while (!found) {
-                    MEMCPY(&len, &indexbuf[pos], 4);
-                    pos = pos + 4;
-                    if (((len + pos) > indexlen) || (len < 1) || (len >= MR_MAX_FILENAME_SIZE)) {
-                        mr_close(f);
-                        MR_FREE(indexbuf, indexlen);
-                        _mr_readFileShowInfo(filename, 3004);
-                        return 0;
-                    }
-                    MEMSET(TempName, 0, sizeof(TempName));
-                    MEMCPY(TempName, &indexbuf[pos], len);
-                    pos = pos + len;
-                    if (STRCMP(filename, TempName) == 0) {
-                        if (lookfor == 1) {
-                            mr_close(f);
-                            MR_FREE(indexbuf, indexlen);
-                            return (void*)1;
-                        }
-                        found = 1;
-                        MEMCPY(&file_pos, &indexbuf[pos], 4);
-                        pos = pos + 4;
-                        MEMCPY(&file_len, &indexbuf[pos], 4);
-                        pos = pos + 4;
-                        if ((file_pos + file_len) > headbuf[2]) {
-                            mr_close(f);
-                            MR_FREE(indexbuf, indexlen);
-                            _mr_readFileShowInfo(filename, 3005);
-                            return 0;
-                        }
-                    } else {
-                        pos = pos + 12;
-                        if (pos >= indexlen) {
-                            mr_close(f);
-                            MR_FREE(indexbuf, indexlen);
-                            _mr_readFileShowInfo(filename, 3006);
-                            return 0;
-                        }
-                    } /*if (STRCMP(filename, TempName)==0)*/
-                }
+#ifdef MR_PREFETCH
+/*
+启动预读：应用启动后 MR_PREFETCH_TIME 毫秒内解压过的文件按顺序记下来，存到
+prefetch 目录(以 mrp 路径的 CRC 做文件名)。下次启动同一个 mrp 时读出这份记录，
+平台空闲时调用 mr_idle，每次解压一个还没读过的文件放进解压缓存，脚本真正要读
+时直接从缓存复制。虚拟机不能在别的线程里运行，所以"后台"是在回调之间的空闲
+时间做的。记录里有 mrp 文件头，mrp 变了记录就作废；只支持文件里的 mrp。
+*/
+#define MR_PREFETCH_DIR "prefetch"
+#define MR_PREFETCH_MAGIC 0x4650524D /* "MRPF" */
+#define MR_PREFETCH_BUF 1024         /* 文件名的总长度 */
+
+typedef struct {
+    uint32 magic;
+    uint32 head[3]; /* mrp 文件头 */
+    uint32 n;
+    uint32 len; /* 文件名的总长度，每个以 0 结尾 */
+} mr_prefetchHead;
+
+typedef struct mr_prefetch {
+    char pack[MR_MAX_FILENAME_SIZE];
+    mr_prefetchHead head;  /* 这次的记录 */
+    char names[MR_PREFETCH_BUF];
+    uint32 start;          /* 启动的时间 */
+    int32 recording;       /* 还在记录 */
+    int32 busy;            /* 正在预读，不记录 */
+    uint32 bytes;          /* 已经预读的字节数 */
+    uint32 n;              /* 上次的记录 */
+    uint32 len;
+    uint32 next;           /* 下一个要预读的位置 */
+    uint8 done[MR_PREFETCH_MAX]; /* 已经读过的不用预读 */
+    char old[MR_PREFETCH_BUF];
+} mr_prefetchSt;
 
-                MR_FREE(indexbuf, indexlen);
+static mr_prefetchSt* mr_prefetch;
+static int32 mr_prefetch_on = TRUE;
+static uint32 mr_prefetch_count, mr_prefetch_bytes; /* 预读的文件个数、字节数 */
 
-                *filelen = file_len;
+static void _mr_prefetchName(char* name) {
+    mr_updcrc(NULL, 0);
+    SPRINTF(name, "%s/%08x.mrf", MR_PREFETCH_DIR, mr_updcrc((uint8*)pack_filename, STRLEN(pack_filename)));
+}
 
-                filebuf = MR_MALLOC((uint32)*filelen);
-                if (filebuf == NULL) {
-                    mr_close(f);
-                    _mr_readFileShowInfo(filename, 3007);
-                    return 0;
-                }
+/*应用启动时(内存池建好后)调用，读出上次的记录并开始记录*/
+static void _mr_prefetchStart(void) {
+    char name[MR_MAX_FILENAME_SIZE];
+    mr_prefetchHead old;
+    uint32 headbuf[4];
+    mr_prefetchSt* p;
+    int32 f, nTmp;
 
-                nTmp = mr_seek(f, file_pos, MR_SEEK_SET);
-                if (nTmp < 0) {
-                    MR_FREE(filebuf, *filelen);
-                    mr_close(f);
-                    _mr_readFileShowInfo(filename, 3008);
-                    return 0;
-                }
+    mr_prefetch = NULL;  // 上次的随内存池一起没了
+    if (!mr_prefetch_on || (pack_filename[0] == '*') || (pack_filename[0] == '$') || (pack_filename[0] == 0)) {
+        return;
+    }
+    f = mr_open(pack_filename, MR_FILE_RDONLY);
+    if (f == 0) {
+        return;
+    }
+    nTmp = mr_read(f, headbuf, sizeof(headbuf));
+    mr_close(f);
+    if ((nTmp != sizeof(headbuf)) || (headbuf[0] != 1196446285)) {
+        return;
+    }
+    p = MR_MALLOC(sizeof(mr_prefetchSt));
+    if (p == NULL) {
+        return;
+    }
+    MEMSET(p, 0, sizeof(mr_prefetchSt));
+    STRNCPY(p->pack, pack_filename, sizeof(p->pack) - 1);
+    p->head.magic = MR_PREFETCH_MAGIC;
+    MEMCPY(p->head.head, &headbuf[1], sizeof(p->head.head));
+    p->start = mr_getTime();
+    p->recording = TRUE;
+
+    _mr_prefetchName(name);
+    f = mr_open(name, MR_FILE_RDONLY);
+    if (f) {
+        nTmp = mr_read(f, &old, sizeof(old));
+        if ((nTmp == sizeof(old)) && (old.magic == MR_PREFETCH_MAGIC) && (MEMCMP(old.head, p->head.head, sizeof(old.head)) == 0) &&
+            (old.n <= MR_PREFETCH_MAX) && (old.len <= MR_PREFETCH_BUF) && (mr_read(f, p->old, old.len) == (int32)old.len) &&
+            ((old.len == 0) || (p->old[old.len - 1] == 0))) {
+            p->n = old.n;
+            p->len = old.len;
+        }
+        mr_close(f);
+    }
+    mr_prefetch = p;
+}
 
-                oldlen = 0;
-                while (oldlen < *filelen) {
-                    nTmp = mr_read(f, (char*)filebuf + oldlen, *filelen - oldlen);
-                    if (nTmp <= 0) {
-                        MR_FREE(filebuf, *filelen);
-                        mr_close(f);
-                        _mr_readFileShowInfo(filename, 3009);
-                        return 0;
-                    }
-                    oldlen = oldlen + nTmp;
-                }
+/*记录和上次不同时写下来，停止记录*/
+static void _mr_prefetchSave(mr_prefetchSt* p) {
+    char name[MR_MAX_FILENAME_SIZE];
+    char tmpname[MR_MAX_FILENAME_SIZE];
+    int32 f, ret;
 
-                /*
+    p->recording = FALSE;
+    // 什么都没记下(例如马上就退出了)时留着上次的
+    if ((p->head.n == 0) || ((p->head.n == p->n) && (p->head.len == p->len) && (MEMCMP(p->names, p->old, p->len) == 0))) {
+        return;
+    }
+    if (mr_info(MR_PREFETCH_DIR) != MR_IS_DIR) {
+        mr_mkDir(MR_PREFETCH_DIR);
+    }
+    _mr_prefetchName(name);
+    STRCPY(tmpname, name);
+    STRCPY(tmpname + STRLEN(tmpname) - 3, "tmp");
 
-                  oldlen = mr_read(f, filebuf, *filelen);
-                  if (oldlen <= 0)
-                  {
-                      MR_FREE(filebuf, *filelen);
-                      mr_close(f);
-                      _mr_readFileShowInfo(pack_filename, 2014);
-                      return 0;
-                  }
-                */
+    mr_remove(tmpname);
+    f = mr_open(tmpname, MR_FILE_WRONLY | MR_FILE_CREATE);
+    if (f == 0) {
+        return;
+    }
+    ret = (mr_write(f, &p->head, sizeof(p->head)) == sizeof(p->head)) && (mr_write(f, p->names, p->head.len) == (int32)p->head.len);
+    mr_close(f);
+    if (ret) {
+        mr_remove(name);
+        if (mr_rename(tmpname, name) == MR_SUCCESS) {
+            return;
+        }
+    }
+    mr_remove(tmpname);
+}
 
-                //mr_read1(filename, filebuf, *filelen);
-                mr_close(f);
+/*记录时间到了就写下来，返回是否还在记录*/
+static int32 _mr_prefetchRecording(mr_prefetchSt* p) {
+    if (p->recording && (mr_getTime() - p->start > MR_PREFETCH_TIME)) {
+        _mr_prefetchSave(p);
+    }
+    return p->recording;
+}
 
-            } else {  //旧版mrp
-                nTmp = mr_seek(f, headbuf[1] - 8, 1);
-                if (nTmp < 0) {
-                    mr_close(f);
-                    _mr_readFileShowInfo(filename, 3002);
-                    return 0;
-                }
+/*记录和预读都结束了就释放，返回是否已释放*/
+static int32 _mr_prefetchDone(mr_prefetchSt* p) {
+    if (p->recording || ((p->next < p->n) && (p->bytes < mr_acache_budget))) {
+        return FALSE;
+    }
+    MR_FREE(p, sizeof(mr_prefetchSt));
+    mr_prefetch = NULL;
+    return TRUE;
+}
 
-                while (!found) {
-                    nTmp = mr_read(f, &len, 4);
+/*_mr_readFile 要解压 filename 时调用：记下来，以后不用预读它*/
+static void _mr_prefetchNote(const char* filename, uint32 len) {
+    mr_prefetchSt* p = mr_prefetch;
+    uint32 i, pos, namelen;
 
-                    if ((nTmp != 4) || (len < 1) || (len >= MR_MAX_FILENAME_SIZE)) {
-                        mr_close(f);
-                        _mr_readFileShowInfo(filename, 2007);
-                        return 0;
-                    }
-                    MEMSET(TempName, 0, sizeof(TempName));
-                    nTmp = mr_read(f, TempName, len);
-                    if (nTmp != (int32)len) {
-                        mr_close(f);
-                        _mr_readFileShowInfo(filename, 2008);
-                        return 0;
-                    }
-                    if (STRCMP(filename, TempName) == 0) {
-                        if (lookfor == 1) {
-                            mr_close(f);
-                            return (void*)1;
-                        }
-                        found = 1;
-                        nTmp = mr_read(f, &len, 4);
+    if ((p == NULL) || p->busy || (STRCMP(p->pack, pack_filename) != 0)) {
+        return;
+    }
+    for (i = 0, pos = 0; i < p->n; i++) {
+        if (STRCMP(&p->old[pos], filename) == 0) {
+            p->done[i] = TRUE;
+            break;
+        }
+        pos += STRLEN(&p->old[pos]) + 1;
+    }
+    if (!_mr_prefetchRecording(p)) {
+        _mr_prefetchDone(p);
+        return;
+    }
+    // 放不进解压缓存的不记
+    if ((len > mr_acache_budget / 2) || (p->head.n >= MR_PREFETCH_MAX)) {
+        return;
+    }
+    namelen = STRLEN(filename) + 1;
+    for (pos = 0; pos < p->head.len; pos += STRLEN(&p->names[pos]) + 1) {
+        if (STRCMP(&p->names[pos], filename) == 0) {
+            return;
+        }
+    }
+    if (p->head.len + namelen > MR_PREFETCH_BUF) {
+        return;
+    }
+    MEMCPY(&p->names[p->head.len], filename, namelen);
+    p->head.len += namelen;
+    p->head.n++;
+}
 
-                        if ((nTmp != 4) || (len < 1) || (len > MR_MAX_FILE_SIZE)) {
-                            _mr_readFileShowInfo(filename, 2009);
-                            mr_close(f);
-                            return 0;
-                        }
-                    } else {
-                        nTmp = mr_read(f, &len, 4);
+/*预读一个文件，还有要做的返回 MR_SUCCESS*/
+static int32 _mr_prefetchStep(void) {
+    mr_prefetchSt* p = mr_prefetch;
+    uint32 i, pos;
+    int32 len;
+    void* buf;
 
-                        if ((nTmp != 4) || (len < 1) || (len > MR_MAX_FILE_SIZE)) {
-                            _mr_readFileShowInfo(filename, 2010);
-                            mr_close(f);
-                            return 0;
-                        }
-                        nTmp = mr_seek(f, len, 1);
-                        if (nTmp < 0) {
-                            _mr_readFileShowInfo(filename, 2011);
-                            mr_close(f);
-                            return 0;
-                        }
-                    }
-                }
+    if (p == NULL) {
+        return MR_IGNORE;
+    }
+    _mr_prefetchRecording(p);
+    if (_mr_prefetchDone(p)) {
+        return MR_IGNORE;
+    }
+    // 别的 mrp 在用时不预读，等切回来
+    if ((p->next >= p->n) || (p->bytes >= mr_acache_budget) || (STRCMP(p->pack, pack_filename) != 0)) {
+        return MR_IGNORE;
+    }
+    for (i = 0, pos = 0; i < p->n; i++) {
+        if ((i >= p->next) && !p->done[i]) {
+            break;
+        }
+        pos += STRLEN(&p->old[pos]) + 1;
+    }
+    p->next = i + 1;
+    if (i < p->n) {
+        p->done[i] = TRUE;
+        p->busy = TRUE;
+        buf = _mr_readFile(&p->old[pos], &len, 0);
+        p->busy = FALSE;
+        if (buf) {
+            p->bytes += len;
+            mr_prefetch_count++;
+            mr_prefetch_bytes += len;
+            MR_FREE(buf, len);
+        }
+    }
+    return ((p->next < p->n) && (p->bytes < mr_acache_budget)) ? MR_SUCCESS : MR_IGNORE;
+}
 
-                *filelen = len;
-                if (*filelen <= 0) {
+/*应用退出时(内存池释放前)调用，启动后很快就退出的也记下来*/
+static void _mr_prefetchClose(void) {
+    if (mr_prefetch) {
+        if (mr_prefetch->recording) {
+            _mr_prefetchSave(mr_prefetch);
+        }
+        MR_FREE(mr_prefetch, sizeof(mr_prefetchSt));
+    }
+    mr_prefetch = NULL;
+}
+#endif
+
+/*
+mrp 目录缓存：新版 mrp 的索引第一次读进来时建一个开放寻址的哈希表（文件名 → 位置、长度），
+以后在同一个 mrp 里找文件不用再逐个比较文件名。平台取不到文件修改时间，
+每次用文件头里的索引位置、索引结束位置、数据长度和文件长度判断 mrp 是否变了；
+这些都不变的改写(例如应用自己更新了 mrp)要靠索引的 CRC 发现，每次都读索引就失去了
+缓存的意义，所以离上次校验超过 MR_PDIR_CHECK_TIME 毫秒才重新读索引算一次。
+最多缓存 MR_PDIR_MAX 个 mrp，内存在虚拟机内存池中，应用退出时失效；
+内存不够时退回到逐个比较。
+*/
+typedef struct mr_pdir {
+    char pack[MR_MAX_FILENAME_SIZE];
+    uint32 head[3];
+    int32 packlen;
+    uint32 crc;     /* 索引的 CRC */
+    uint32 checked; /* 上次校验 CRC 的时间 */
+    uint8* index;
+    uint32 indexlen;
+    uint32* slots; /* 文件名在索引中的位置 + 1，0 表示空槽 */
+    uint32 mask;   /* 槽数 - 1 */
+} mr_pdir;
+
+static mr_pdir* mr_pdir_cache[MR_PDIR_MAX];
+static int32 mr_pdir_next;
+
+static uint32 _mr_pdirHash(const uint8* name, uint32 len) {
+    uint32 h = 2166136261U;
+    while (len--) {
+        h = (h ^ *name++) * 16777619U;
+    }
+    return h;
+}
+
+static void _mr_pdirFree(mr_pdir* d) {
+    MR_FREE(d->slots, (d->mask + 1) * sizeof(uint32));
+    MR_FREE(d->index, d->indexlen);
+    MR_FREE(d, sizeof(mr_pdir));
+}
+
+/*内存池被释放或重建时调用，缓存的内存随内存池一起没了*/
+static void _mr_pdirReset(void) {
+    MEMSET(mr_pdir_cache, 0, sizeof(mr_pdir_cache));
+    mr_pdir_next = 0;
+}
+
+/*读索引，失败返回 _mr_readFileShowInfo 用的错误码*/
+static int32 _mr_pdirReadIndex(int32 f, uint32* headbuf, uint8** index, uint32* indexlen) {
+    *indexlen = headbuf[1] + 8 - headbuf[3];
+    *index = MR_MALLOC(*indexlen);
+    if (!*index) {
+        return 3003;
+    }
+    if (mr_seek(f, headbuf[3], MR_SEEK_SET) < 0) {
+        MR_FREE(*index, *indexlen);
+        return 3002;
+    }
+    if (mr_read(f, *index, *indexlen) != (int32)*indexlen) {
+        MR_FREE(*index, *indexlen);
+        return 3003;
+    }
+    return 0;
+}
+
+/*给读好的索引建表，索引有错或内存不够返回 NULL*/
+static mr_pdir* _mr_pdirBuild(uint32* headbuf, uint8* index, uint32 indexlen) {
+    mr_pdir* d;
+    uint32 pos, len, n, size;
+
+    n = 0;
+    pos = 0;
+    while (pos + 4 <= indexlen) {
+        MEMCPY(&len, &index[pos], 4);
+        if ((len < 1) || (len >= MR_MAX_FILENAME_SIZE) || (pos + 4 + len + 12 > indexlen)) {
+            return NULL;
+        }
+        pos += 4 + len + 12;
+        n++;
+    }
+    for (size = 16; size < n + n / 4; size <<= 1) {
+    }
+
+    d = MR_MALLOC(sizeof(mr_pdir));
+    if (d == NULL) {
+        return NULL;
+    }
+    d->slots = MR_MALLOC(size * sizeof(uint32));
+    if (d->slots == NULL) {
+        MR_FREE(d, sizeof(mr_pdir));
+        return NULL;
+    }
+    MEMSET(d->slots, 0, size * sizeof(uint32));
+    STRNCPY(d->pack, pack_filename, sizeof(d->pack) - 1);
+    d->pack[sizeof(d->pack) - 1] = 0;
+    MEMCPY(d->head, &headbuf[1], sizeof(d->head));
+    mr_updcrc(NULL, 0);
+    d->crc = mr_updcrc(index, indexlen);
+    d->index = index;
+    d->indexlen = indexlen;
+    d->mask = size - 1;
+
+    pos = 0;
+    while (n--) {
+        uint32 i;
+        MEMCPY(&len, &index[pos], 4);
+        i = _mr_pdirHash(&index[pos + 4], len) & d->mask;
+        while (d->slots[i] != 0) {
+            i = (i + 1) & d->mask;
+        }
+        /* 同名时前面的先被找到，和逐个比较的结果一样 */
+        d->slots[i] = pos + 1;
+        pos += 4 + len + 12;
+    }
+    return d;
+}
+
+/*缓存的目录是否还和文件里的一样：文件长度不变、索引的 CRC 不变*/
+static int32 _mr_pdirValid(int32 f, mr_pdir* d, int32 packlen) {
+    uint8 small[256];
+    uint8* buf;
+    uint32 pos, n, size, now;
+
+    if (packlen != d->packlen) {
+        return FALSE;
+    }
+    now = mr_getTime();
+    if (now - d->checked < MR_PDIR_CHECK_TIME) {
+        return TRUE;
+    }
+    if (mr_seek(f, d->head[2], MR_SEEK_SET) < 0) {
+        return FALSE;
+    }
+    // 尽量一次读完，内存不够时分小块读
+    size = d->indexlen;
+    buf = MR_MALLOC(size);
+    if (buf == NULL) {
+        size = sizeof(small);
+        buf = small;
+    }
+    mr_updcrc(NULL, 0);
+    for (pos = 0; pos < d->indexlen; pos += n) {
+        n = ((d->indexlen - pos) < size) ? (d->indexlen - pos) : size;
+        if (mr_read(f, buf, n) != (int32)n) {
+            break;
+        }
+        mr_updcrc(buf, n);
+    }
+    if (buf != small) {
+        MR_FREE(buf, size);
+    }
+    if ((pos < d->indexlen) || (mr_updcrc(small, 0) != d->crc)) {
+        return FALSE;
+    }
+    d->checked = now;
+    return TRUE;
+}
+
+static mr_pdir* _mr_pdirGet(int32 f, uint32* headbuf, int32* err) {
+    mr_pdir* d;
+    uint8* index;
+    uint32 indexlen;
+    int32 i, packlen;
+
+    packlen = mr_getLen(pack_filename);
+    for (i = 0; i < MR_PDIR_MAX; i++) {
+        d = mr_pdir_cache[i];
+        if (d && (STRCMP(d->pack, pack_filename) == 0)) {
+            if ((MEMCMP(d->head, &headbuf[1], sizeof(d->head)) == 0) && _mr_pdirValid(f, d, packlen)) {
+                return d;
+            }
+            _mr_pdirFree(d); /* mrp 变了 */
+            mr_pdir_cache[i] = NULL;
+        }
+    }
+
+    *err = _mr_pdirReadIndex(f, headbuf, &index, &indexlen);
+    if (*err) {
+        return NULL;
+    }
+    d = _mr_pdirBuild(headbuf, index, indexlen);
+    if (d == NULL) {
+        MR_FREE(index, indexlen);
+        return NULL;
+    }
+    d->packlen = packlen;
+    d->checked = mr_getTime();
+    if (mr_pdir_cache[mr_pdir_next]) {
+        _mr_pdirFree(mr_pdir_cache[mr_pdir_next]);
+    }
+    mr_pdir_cache[mr_pdir_next] = d;
+    mr_pdir_next = (mr_pdir_next + 1) % MR_PDIR_MAX;
+    return d;
+}
+
+/*在 m0 文件或内存文件中找 filename，返回文件数据，失败时显示错误并返回 NULL*/
+static char* _mr_m0Find(const char* filename, uint32* file_len) {
+    uint32 pos = 0, found = 0;
+    uint32 len;
+    uint32 m0file_len;
+    char TempName[MR_MAX_FILENAME_SIZE];
+    char* mr_m0_file;
+
+    if (pack_filename[0] == '*') {                                 /*m0 file?*/
+        mr_m0_file = (char*)mr_m0_files[pack_filename[1] - 0x41];  //这里定义文件名为*A即是第一个m0文件 *B是第二个.........
+    } else {
+        mr_m0_file = mr_ram_file;
+    }
+
+    if (mr_m0_file == NULL) {
+        _mr_readFileShowInfo(filename, 1001);
+        return NULL;
+    }
+    pos = pos + 4;
+    MEMCPY(&len, &mr_m0_file[pos], 4);
+    pos = pos + 4;
+
+    if ((pack_filename[0] == '$')) {
+        m0file_len = mr_ram_file_len;
+
+#ifdef MR_AUTHORIZATION
+        if (bi & MR_FLAGS_AI) {
+            if (_mr_isMr(&mr_m0_file[52]) != MR_SUCCESS) {
+                _mr_readFileShowInfo("unauthorized", 3);
+                return NULL;
+            }
+        }
+#endif
+    } else {
+        MEMCPY(&m0file_len, &mr_m0_file[pos], 4);
+    }
+
+    pos = pos + len;
+    while (!found) {
+        if (((pos + 4) >= m0file_len) || (len < 1) || (len >= MR_MAX_FILE_SIZE)) {
+            _mr_readFileShowInfo(filename, 1004);
+            return NULL;
+        }
+        MEMCPY(&len, &mr_m0_file[pos], 4);
+
+        pos = pos + 4;
+        if (((len + pos) >= m0file_len) || (len < 1) || (len >= MR_MAX_FILENAME_SIZE)) {
+            _mr_readFileShowInfo(filename, 1002);
+            return NULL;
+        }
+        MEMSET(TempName, 0, sizeof(TempName));
+        MEMCPY(TempName, &mr_m0_file[pos], len);
+        pos = pos + len;
+        if (STRCMP(filename, TempName) == 0) {
+            found = 1;
+            MEMCPY(&len, &mr_m0_file[pos], 4);
+
+            pos = pos + 4;
+            if (((len + pos) > m0file_len) || (len < 1) || (len >= MR_MAX_FILE_SIZE)) {
+                _mr_readFileShowInfo(filename, 1003);
+                return NULL;
+            }
+        } else {
+            MEMCPY(&len, &mr_m0_file[pos], 4);
+
+            pos = pos + 4 + len;
+        }
+    }
+
+    *file_len = len;
+    return &mr_m0_file[pos];
+}
+
+/*
+在旧版 mrp 中找 filename，f 读过了 16 字节的文件头。成功返回 0，f 停在
+文件数据处；否则返回 _mr_readFileShowInfo 用的错误码
+*/
+static int32 _mr_oldFind(int32 f, uint32* headbuf, const char* filename, uint32* file_pos, uint32* file_len) {
+    int32 nTmp;
+    uint32 len, pos;
+    char TempName[MR_MAX_FILENAME_SIZE];
+
+    nTmp = mr_seek(f, headbuf[1] - 8, 1);
+    if (nTmp < 0) {
+        return 3002;
+    }
+    pos = headbuf[1] + 8;
+
+    for (;;) {
+        nTmp = mr_read(f, &len, 4);
+
+        if ((nTmp != 4) || (len < 1) || (len >= MR_MAX_FILENAME_SIZE)) {
+            return 2007;
+        }
+        MEMSET(TempName, 0, sizeof(TempName));
+        nTmp = mr_read(f, TempName, len);
+        if (nTmp != (int32)len) {
+            return 2008;
+        }
+        pos = pos + 4 + len;
+        if (STRCMP(filename, TempName) == 0) {
+            nTmp = mr_read(f, &len, 4);
+
+            if ((nTmp != 4) || (len < 1) || (len > MR_MAX_FILE_SIZE)) {
+                return 2009;
+            }
+            *file_pos = pos + 4;
+            *file_len = len;
+            return 0;
+        }
+        nTmp = mr_read(f, &len, 4);
+
+        if ((nTmp != 4) || (len < 1) || (len > MR_MAX_FILE_SIZE)) {
+            return 2010;
+        }
+        nTmp = mr_seek(f, len, 1);
+        if (nTmp < 0) {
+            return 2011;
+        }
+        pos = pos + 4 + len;
+    }
+}
+
+/*
+在新版 mrp 中找 filename，成功返回 0，
+否则返回 _mr_readFileShowInfo 用的错误码
+*/
+static int32 _mr_pdirFind(int32 f, uint32* headbuf, const char* filename, uint32* file_pos, uint32* file_len) {
+    mr_pdir* d;
+    uint8* index;
+    uint32 indexlen, pos, len, namelen;
+    int32 err = 0;
+
+    namelen = STRLEN(filename);
+    d = _mr_pdirGet(f, headbuf, &err);
+    if (err) {
+        return err;
+    }
+    if (d) {
+        uint32 i = _mr_pdirHash((const uint8*)filename, namelen) & d->mask;
+        while (d->slots[i] != 0) {
+            pos = d->slots[i] - 1;
+            MEMCPY(&len, &d->index[pos], 4);
+            if ((len == namelen) && (MEMCMP(&d->index[pos + 4], filename, len) == 0)) {
+                MEMCPY(file_pos, &d->index[pos + 4 + len], 4);
+                MEMCPY(file_len, &d->index[pos + 4 + len + 4], 4);
+                return 0;
+            }
+            i = (i + 1) & d->mask;
+        }
+        return 3006;
+    }
+
+    /* 索引有错或内存不够，逐个比较 */
+    err = _mr_pdirReadIndex(f, headbuf, &index, &indexlen);
+    if (err) {
+        return err;
+    }
+    pos = 0;
+    for (;;) {
+        MEMCPY(&len, &index[pos], 4);
+        pos = pos + 4;
+        if (((len + pos) > indexlen) || (len < 1) || (len >= MR_MAX_FILENAME_SIZE)) {
+            err = 3004;
+            break;
+        }
+        if ((len == namelen) && (MEMCMP(&index[pos], filename, len) == 0)) {
+            MEMCPY(file_pos, &index[pos + len], 4);
+            MEMCPY(file_len, &index[pos + len + 4], 4);
+            break;
+        }
+        pos = pos + len + 12;
+        if (pos >= indexlen) {
+            err = 3006;
+            break;
+        }
+    }
+    MR_FREE(index, indexlen);
+    return err;
+}
+
+/*
+mrp 映射：平台支持 mapFile 时把整个新版 mrp 映射到内存。lookfor 为 3 时未压缩的文件
+直接返回映射里的指针，位图、声音和 .mr 不用再读一遍、也不占内存池；压缩的文件
+从映射里直接解压，不用先把压缩数据读进内存池。映射有引用计数，lookfor 为 3 时
+返回的内存要用 _mr_readFileRelease 释放。没人用的映射留着，mrp 变了、要腾位置
+或应用退出时才解除。
+*/
+typedef struct mr_fmap {
+    char pack[MR_MAX_FILENAME_SIZE]; /* 空串表示 mrp 变了，没人用时解除 */
+    uint32 head[3];
+    uint8* base;
+    uint32 len;
+    int32 refs;
+} mr_fmap;
+
+static mr_fmap* mr_fmap_tab[MR_FMAP_MAX];
+
+static void _mr_fmapFree(int32 i) {
+    mr_fmap* m = mr_fmap_tab[i];
+    mr_unmapFile(m->base, m->len);
+    MR_FREE(m, sizeof(mr_fmap));
+    mr_fmap_tab[i] = NULL;
+}
+
+/*应用退出时调用，映射里的位图、声音随应用一起失效。
+上个应用没有 freemem 就退出时映射还在，启动时在重建内存池之前也要调用*/
+static void _mr_fmapClose(void) {
+    int32 i;
+    for (i = 0; i < MR_FMAP_MAX; i++) {
+        if (mr_fmap_tab[i]) {
+            _mr_fmapFree(i);
+        }
+    }
+}
+
+/*取当前 mrp 的映射，平台不支持、内存不够或映射都在用时返回 NULL*/
+static mr_fmap* _mr_fmapGet(uint32* headbuf) {
+    mr_fmap* m;
+    uint8* base;
+    uint32 len;
+    int32 i, slot = -1, idle = -1;
+
+    for (i = 0; i < MR_FMAP_MAX; i++) {
+        m = mr_fmap_tab[i];
+        if (m == NULL) {
+            if (slot < 0) {
+                slot = i;
+            }
+            continue;
+        }
+        if (STRCMP(m->pack, pack_filename) == 0) {
+            if (MEMCMP(m->head, &headbuf[1], sizeof(m->head)) == 0) {
+                return m;
+            }
+            m->pack[0] = 0;
+        }
+        if (m->refs == 0) {
+            if (m->pack[0] == 0) {
+                _mr_fmapFree(i);
+                if (slot < 0) {
+                    slot = i;
+                }
+            } else {
+                idle = i;
+            }
+        }
+    }
+    if ((slot < 0) && (idle < 0)) {
+        return NULL;
+    }
+
+    base = mr_mapFile(pack_filename, &len);
+    if (base == NULL) {
+        return NULL;
+    }
+    m = MR_MALLOC(sizeof(mr_fmap));
+    if (m == NULL) {
+        mr_unmapFile(base, len);
+        return NULL;
+    }
+    if (slot < 0) {
+        _mr_fmapFree(idle);
+        slot = idle;
+    }
+    STRNCPY(m->pack, pack_filename, sizeof(m->pack) - 1);
+    m->pack[sizeof(m->pack) - 1] = 0;
+    MEMCPY(m->head, &headbuf[1], sizeof(m->head));
+    m->base = base;
+    m->len = len;
+    m->refs = 0;
+    mr_fmap_tab[slot] = m;
+    return m;
+}
+
+/*p 在映射里时减引用并返回 TRUE*/
+static int _mr_fmapRelease(const void* p) {
+    mr_fmap* m;
+    int32 i;
+
+    for (i = 0; i < MR_FMAP_MAX; i++) {
+        m = mr_fmap_tab[i];
+        if (m && ((const uint8*)p >= m->base) && ((const uint8*)p < m->base + m->len)) {
+            m->refs--;
+            if ((m->refs == 0) && (m->pack[0] == 0)) {
+                _mr_fmapFree(i);
+            }
+            return TRUE;
+        }
+    }
+    return FALSE;
+}
+
+/*
+释放 _mr_readFile 返回的内存：映射里的减引用，内存池里的 MR_FREE，
+m0 文件里的不用管
+*/
+void _mr_readFileRelease(void* p, int filelen) {
+    if (_mr_fmapRelease(p)) {
+        return;
+    }
+    if (((char*)p >= LG_mem_base) && ((char*)p < LG_mem_end)) {
+        MR_FREE(p, filelen);
+    }
+}
+
+void* _mr_readFile(const char* filename, int* filelen, int lookfor) {
+    // int ret;
+    int method;
+    uint32 reallen;
+    int32 oldlen, nTmp;
+    uint32 len;
+    void* filebuf;
+    int32 f;
+    int is_rom_file = FALSE;
+    mr_fmap* fmap = NULL;
+#ifdef MR_ACACHE
+    uint32 crc;
+#endif
+#ifdef MR_PCACHE
+    uint32 pcache_tail[2];
+    int pcache_key = FALSE;
+#endif
+
+    if ((pack_filename[0] == '*') || (pack_filename[0] == '$')) { /*m0 file or ram file?*/
+        filebuf = _mr_m0Find(filename, &len);
+        if (filebuf == NULL) {
+            return 0;
+        }
+        if (lookfor == 1) {
+            return (void*)1;
+        }
+        *filelen = len;
+        if (lookfor == 2) {
+            return filebuf;
+        }
+        is_rom_file = TRUE;
+    } else { /*read file from efs , EFS 中的文件*/
+        f = mr_open(pack_filename, MR_FILE_RDONLY);
+        if (f == 0) {
+            _mr_readFileShowInfo(filename, 2002);
+            return 0;
+        }
+
+        // 从这里开始是新版的mrp处理
+        {
+            uint32 headbuf[4];
+            nTmp = mr_read(f, &headbuf, sizeof(headbuf));
+            if ((nTmp != 16) || (headbuf[0] != 1196446285)) {
+                mr_close(f);
+                _mr_readFileShowInfo(filename, 3001);
+                return 0;
+            }
+            if (headbuf[1] > 232) {  //新版mrp
+                uint32 file_pos, file_len;
+                nTmp = _mr_pdirFind(f, headbuf, filename, &file_pos, &file_len);
+                if (nTmp == 0 && lookfor == 1) {
+                    mr_close(f);
+                    return (void*)1;
+                }
+                if (nTmp == 0 && (file_pos + file_len) > headbuf[2]) {
+                    nTmp = 3005;
+                }
+                if (nTmp != 0) {
+                    mr_close(f);
+                    _mr_readFileShowInfo(filename, nTmp);
+                    return 0;
+                }
+
+#ifdef MR_PCACHE
+                // 只有脚本(lookfor 4)才可能命中，gzip 尾部8字节为 CRC 和原始长度
+                if (mr_pcache_on && (lookfor == 4) && (file_len >= 18)) {
+                    uint8 magic[2];
+                    if ((mr_seek(f, file_pos, MR_SEEK_SET) >= 0) && (mr_read(f, magic, 2) == 2) && (magic[0] == 0x1f) && (magic[1] == 0x8b) &&
+                        (mr_seek(f, file_pos + file_len - sizeof(pcache_tail), MR_SEEK_SET) >= 0) && (mr_read(f, pcache_tail, sizeof(pcache_tail)) == sizeof(pcache_tail))) {
+                        pcache_key = TRUE;
+                        filebuf = _mr_pcacheLoad(filename, pcache_tail[0], pcache_tail[1]);
+                        if (filebuf) {
+                            mr_close(f);
+                            *filelen = pcache_tail[1];
+                            return filebuf;
+                        }
+                    }
+                }
+#endif
+
+                *filelen = file_len;
+
+                fmap = _mr_fmapGet(headbuf);
+                if (fmap && ((file_pos + file_len) > fmap->len)) {
+                    fmap = NULL;
+                }
+                if (fmap) {
+                    mr_close(f);
+                    filebuf = fmap->base + file_pos;
+                    is_rom_file = TRUE;
+                } else {
+                    filebuf = MR_MALLOC((uint32)*filelen);
+                    if (filebuf == NULL) {
+                        mr_close(f);
+                        _mr_readFileShowInfo(filename, 3007);
+                        return 0;
+                    }
+
+                    nTmp = mr_seek(f, file_pos, MR_SEEK_SET);
+                    if (nTmp < 0) {
+                        MR_FREE(filebuf, *filelen);
+                        mr_close(f);
+                        _mr_readFileShowInfo(filename, 3008);
+                        return 0;
+                    }
+
+                    oldlen = 0;
+                    while (oldlen < *filelen) {
+                        nTmp = mr_read(f, (char*)filebuf + oldlen, *filelen - oldlen);
+                        if (nTmp <= 0) {
+                            MR_FREE(filebuf, *filelen);
+                            mr_close(f);
+                            _mr_readFileShowInfo(filename, 3009);
+                            return 0;
+                        }
+                        oldlen = oldlen + nTmp;
+                    }
+
+                    /*
+
+                      oldlen = mr_read(f, filebuf, *filelen);
+                      if (oldlen <= 0)
+                      {
+                          MR_FREE(filebuf, *filelen);
+                          mr_close(f);
+                          _mr_readFileShowInfo(pack_filename, 2014);
+                          return 0;
+                      }
+                    */
+
+                    //mr_read1(filename, filebuf, *filelen);
+                    mr_close(f);
+                }
+
+            } else {  //旧版mrp
+                uint32 file_pos;
+                nTmp = _mr_oldFind(f, headbuf, filename, &file_pos, &len);
+                if (nTmp == 0 && lookfor == 1) {
                     mr_close(f);
-                    _mr_readFileShowInfo(filename, 2012);
+                    return (void*)1;
+                }
+                if (nTmp != 0) {
+                    mr_close(f);
+                    _mr_readFileShowInfo(filename, nTmp);
                     return 0;
                 }
+                *filelen = len;
 
                 filebuf = MR_MALLOC((uint32)*filelen);
                 if (filebuf == NULL) {
@@ -1517,10 +2387,37 @@ void* _mr_readFile(const char* filename, int* filelen, int lookfor) {
 
     method = mr_get_method(*filelen);
     if (method < 0) {
+        if (fmap) {
+            // 4字节对齐的才直接给出去，位图和字节码都要对齐
+            if ((lookfor >= 3) && ((((uint8*)filebuf - fmap->base) & 3) == 0)) {
+                fmap->refs++;
+                return filebuf;
+            }
+            mr_gzInBuf = MR_MALLOC((uint32)*filelen);
+            if (mr_gzInBuf == NULL) {
+                _mr_readFileShowInfo(filename, 3007);
+                return 0;
+            }
+            MEMCPY(mr_gzInBuf, filebuf, *filelen);
+            return mr_gzInBuf;
+        }
         return filebuf;
     }
 
     reallen = *(uint32*)((uint8*)filebuf + *filelen - sizeof(uint32));
+#ifdef MR_PREFETCH
+    _mr_prefetchNote(filename, reallen);
+#endif
+#ifdef MR_ACACHE
+    MEMCPY(&crc, (uint8*)filebuf + *filelen - 2 * sizeof(uint32), sizeof(uint32));
+    mr_gzOutBuf = _mr_acacheGet(filename, crc, reallen);
+    if (mr_gzOutBuf) {
+        if (!is_rom_file)
+            MR_FREE(mr_gzInBuf, *filelen);
+        *filelen = reallen;
+        return mr_gzOutBuf;
+    }
+#endif
 
     //MRDBGPRINTF("Debug:_mr_readFile:filelen = %d",reallen);
     //MRDBGPRINTF("Debug:_mr_readFile:mem left = %d",LG_mem_left);
@@ -1548,6 +2445,18 @@ void* _mr_readFile(const char* filename, int* filelen, int lookfor) {
         return 0;
     }
 
+#ifdef MR_PCACHE
+    // 只缓存 CRC 校验通过的字节码("\033MRP"开头)
+    if (pcache_key && (reallen == pcache_tail[1]) && (LG_gzoutcnt == reallen) && (reallen > 4) && (mr_updcrc(mr_gzOutBuf, 0) == pcache_tail[0]) && (MEMCMP(mr_gzOutBuf, "\033MRP", 4) == 0)) {
+        _mr_pcacheStore(filename, pcache_tail[0], mr_gzOutBuf, reallen);
+    }
+#endif
+#ifdef MR_ACACHE
+    if (mr_acache_budget > 0) {
+        _mr_acachePut(filename, crc, mr_gzOutBuf, reallen);
+    }
+#endif
+
     //MRDBGPRINTF("4base=%d,end=%d",  (int32)LG_mem_base, (int32)LG_mem_end);
     //MRDBGPRINTF("is_rom_file = %d",is_rom_file);
     if (!is_rom_file)
@@ -1558,21 +2467,253 @@ void* _mr_readFile(const char* filename, int* filelen, int lookfor) {
     return mr_gzOutBuf;
 }
 
-#define CHECK_MRP_BUF_SIZE 10240
+/*
+按块读 mrp 里的文件：数据在 m0 文件、内存文件或映射里时直接从内存读，否则
+从文件里读；gzip 压缩的用 mr_gzRead 边读边解压，只占约 64KB 内存。用来读
+解压后很大的文件，不用把压缩数据和解压结果同时放进内存池。流的 CRC 不校验
+(mr_updcrc 只有一个寄存器，两次读之间别人会用)，长度要和 gzip 尾部的一致。
+*/
+struct mr_stream {
+    int32 f;          /* 0 表示数据在内存里 */
+    const uint8* mem; /* 内存里的文件数据 */
+    int held;         /* mem 在映射里，占着一个引用 */
+    uint32 left;      /* 还没读的(压缩)数据 */
+    uint32 len;       /* 解压后的长度 */
+    uint32 crc;       /* gzip 尾部的 CRC */
+    mr_gzstream* z;   /* 没压缩时为 NULL */
+};
+
+static int32 _mr_streamFill(void* ud, uint8* buf, uint32 len) {
+    mr_stream* st = (mr_stream*)ud;
+    int32 n;
+
+    if (len > st->left) {
+        len = st->left;
+    }
+    if (len == 0) {
+        return 0;
+    }
+    if (st->f == 0) {
+        MEMCPY(buf, st->mem, len);
+        st->mem += len;
+        n = len;
+    } else {
+        n = mr_read(st->f, buf, len);
+        if (n <= 0) {
+            return 0;
+        }
+    }
+    st->left -= n;
+    return n;
+}
+
+/*
+找不到文件或数据有错时显示错误并返回 NULL。PKZIP 压缩的流不支持，pkzip 为 TRUE
+时当没压缩的打开(给 _mr_readFileBig 判断用)，否则返回 NULL
+*/
+static mr_stream* _mr_streamOpenEx(const char* filename, int pkzip) {
+    mr_stream* st;
+    uint32 file_pos, file_len, tail[2];
+    int32 nTmp = 0;
+    uint8 magic[4];
+
+    st = MR_MALLOC(sizeof(mr_stream));
+    if (st == NULL) {
+        _mr_readFileShowInfo(filename, 3007);
+        return NULL;
+    }
+    MEMSET(st, 0, sizeof(mr_stream));
+
+    if ((pack_filename[0] == '*') || (pack_filename[0] == '$')) { /*m0 file or ram file?*/
+        st->mem = (const uint8*)_mr_m0Find(filename, &file_len);
+        if (st->mem == NULL) {
+            MR_FREE(st, sizeof(mr_stream));
+            return NULL;
+        }
+    } else {
+        uint32 headbuf[4];
+        mr_fmap* fmap;
+
+        st->f = mr_open(pack_filename, MR_FILE_RDONLY);
+        if (st->f == 0) {
+            MR_FREE(st, sizeof(mr_stream));
+            _mr_readFileShowInfo(filename, 2002);
+            return NULL;
+        }
+        if ((mr_read(st->f, &headbuf, sizeof(headbuf)) != 16) || (headbuf[0] != 1196446285)) {
+            nTmp = 3001;
+        } else if (headbuf[1] > 232) {  //新版mrp
+            nTmp = _mr_pdirFind(st->f, headbuf, filename, &file_pos, &file_len);
+            if (nTmp == 0 && (file_pos + file_len) > headbuf[2]) {
+                nTmp = 3005;
+            }
+            if (nTmp == 0) {
+                fmap = _mr_fmapGet(headbuf);
+                if (fmap && ((file_pos + file_len) <= fmap->len)) {
+                    fmap->refs++;
+                    st->held = TRUE;
+                    st->mem = fmap->base + file_pos;
+                    mr_close(st->f);
+                    st->f = 0;
+                }
+            }
+        } else {  //旧版mrp
+            nTmp = _mr_oldFind(st->f, headbuf, filename, &file_pos, &file_len);
+        }
+        // 文件头和尾部先读出来，再回到数据开头
+        if ((nTmp == 0) && (st->f != 0)) {
+            if ((mr_seek(st->f, file_pos + file_len - sizeof(tail), MR_SEEK_SET) < 0) || (mr_read(st->f, tail, sizeof(tail)) != sizeof(tail)) ||
+                (mr_seek(st->f, file_pos, MR_SEEK_SET) < 0) || (mr_read(st->f, magic, sizeof(magic)) != sizeof(magic)) ||
+                (mr_seek(st->f, file_pos, MR_SEEK_SET) < 0)) {
+                nTmp = 3009;
+            }
+        }
+        if (nTmp != 0) {
+            _mr_streamClose(st);
+            _mr_readFileShowInfo(filename, nTmp);
+            return NULL;
+        }
+    }
+    if (st->f == 0) {
+        if (file_len < sizeof(tail) + sizeof(magic)) {
+            MEMSET(magic, 0, sizeof(magic));
+        } else {
+            MEMCPY(magic, st->mem, sizeof(magic));
+            MEMCPY(tail, st->mem + file_len - sizeof(tail), sizeof(tail));
+        }
+    }
+    st->left = file_len;
+    st->len = file_len;
+
+    if ((file_len >= 18) && (magic[0] == 0x1f) && ((magic[1] == 0x8b) || (magic[1] == 0x9e))) {
+        st->crc = tail[0];
+        st->len = tail[1];
+        if (st->f == 0) {
+            st->z = mr_gzOpen(st->mem, file_len, NULL, NULL);
+        } else {
+            st->z = mr_gzOpen(NULL, 0, _mr_streamFill, st);
+        }
+        if (st->z == NULL) {
+            _mr_streamClose(st);
+            _mr_readFileShowInfo(filename, 3007);
+            return NULL;
+        }
+    } else if (!pkzip && (file_len >= 4) && (magic[0] == 'P') && (magic[1] == 'K') && (magic[2] == 3) && (magic[3] == 4)) {
+        _mr_streamClose(st);
+        _mr_readFileShowInfo(filename, 3010);
+        return NULL;
+    }
+    return st;
+}
+
+mr_stream* _mr_streamOpen(const char* filename) {
+    return _mr_streamOpenEx(filename, FALSE);
+}
+
+/*返回读到的字节数，读完时比 len 少，数据有错时返回 MR_FAILED*/
+int32 _mr_streamRead(mr_stream* st, void* buf, uint32 len) {
+    int32 n, got = 0;
+
+    if (st->z) {
+        return mr_gzRead(st->z, buf, len);
+    }
+    while ((uint32)got < len) {
+        n = _mr_streamFill(st, (uint8*)buf + got, len - got);
+        if (n <= 0) {
+            if (st->left > 0) {
+                return MR_FAILED;
+            }
+            break;
+        }
+        got += n;
+    }
+    return got;
+}
+
+/*解压后的长度*/
+uint32 _mr_streamSize(mr_stream* st) {
+    return st->len;
+}
+
+void _mr_streamClose(mr_stream* st) {
+    if (st->z) {
+        mr_gzClose(st->z);
+    }
+    if (st->f) {
+        mr_close(st->f);
+    }
+    if (st->held) {
+        _mr_fmapRelease(st->mem);
+    }
+    MR_FREE(st, sizeof(mr_stream));
+}
+
+/*
+读压缩后也很大的文件。要从文件里读、压缩过的，用流直接解压到结果里，峰值
+内存少了整个压缩数据；其它的和 _mr_readFile 一样。返回的内存用
+_mr_readFileRelease 释放。
+*/
+#define MR_READ_BIG (64 * 1024)
+void* _mr_readFileBig(const char* filename, int* filelen, int lookfor) {
+    mr_stream* st;
+    uint8* buf;
+    uint8 extra;
+    int32 n;
+
+    if ((pack_filename[0] == '*') || (pack_filename[0] == '$')) {
+        return _mr_readFile(filename, filelen, lookfor);
+    }
+    st = _mr_streamOpenEx(filename, TRUE);
+    if (st == NULL) {
+        return NULL;
+    }
+    if ((st->f == 0) || (st->z == NULL) || (st->left < MR_READ_BIG) || (st->len == 0) || (st->len >= MR_MAX_FILE_SIZE)) {
+        _mr_streamClose(st);
+        return _mr_readFile(filename, filelen, lookfor);
+    }
+
+    buf = MR_MALLOC(st->len);
+    if (buf == NULL) {
+        _mr_streamClose(st);
+        _mr_readFileShowInfo(filename, 3007);
+        return NULL;
+    }
+    // 一次读完，中间没人用 mr_updcrc，CRC 可以校验；多读一个字节，检查流的尾部
+    mr_updcrc(NULL, 0);
+    n = _mr_streamRead(st, buf, st->len);
+    if ((n != (int32)st->len) || (mr_updcrc(buf, n) != st->crc) || (_mr_streamRead(st, &extra, 1) != 0)) {
+        MR_FREE(buf, st->len);
+        _mr_streamClose(st);
+        MRDBGPRINTF("_mr_readFile: \"%s\" Unzip err!", filename);
+        return NULL;
+    }
+    *filelen = st->len;
+    _mr_streamClose(st);
+    return buf;
+}
+
+// 大块读文件，系统调用少；内存不够时退回到小块
+#define CHECK_MRP_BUF_SIZE (64 * 1024)
+#define CHECK_MRP_BUF_MIN 10240
 int32 mr_checkMrp(char* mrp_name) {
     int32 f;
     uint32 headbuf[4];
     int32 nTmp, crc32;
     uint8* tempbuf;
+    uint32 bufsize = CHECK_MRP_BUF_SIZE;
 
-    tempbuf = MR_MALLOC(CHECK_MRP_BUF_SIZE);
+    tempbuf = MR_MALLOC(bufsize);
+    if (tempbuf == NULL) {
+        bufsize = CHECK_MRP_BUF_MIN;
+        tempbuf = MR_MALLOC(bufsize);
+    }
     if (tempbuf == NULL) {
         MRDBGPRINTF("mrc_checkMrp err %d", 0);
         return MR_FAILED - 1;
     }
     f = mr_open(mrp_name, MR_FILE_RDONLY);
     if (f == 0) {
-        MR_FREE(tempbuf, CHECK_MRP_BUF_SIZE);
+        MR_FREE(tempbuf, bufsize);
         MRDBGPRINTF("mrc_checkMrp err %d", 1);
         return MR_FAILED - 2;
     }
@@ -1583,7 +2724,7 @@ int32 mr_checkMrp(char* mrp_name) {
     mr_updcrc((uint8*)&headbuf, sizeof(headbuf));
     if ((nTmp != 16) || (headbuf[0] != 1196446285 /*1196446285*/) || (headbuf[1] <= 232)) {
         mr_close(f);
-        MR_FREE(tempbuf, CHECK_MRP_BUF_SIZE);
+        MR_FREE(tempbuf, bufsize);
         //MRDBGPRINTF("%d", headbuf[0]);
         //MRDBGPRINTF("%d", headbuf[1]);
         //MRDBGPRINTF("%d", nTmp);
@@ -1594,7 +2735,7 @@ int32 mr_checkMrp(char* mrp_name) {
     nTmp = mr_read(f, tempbuf, 224);
     if (nTmp != 224) {
         mr_close(f);
-        MR_FREE(tempbuf, CHECK_MRP_BUF_SIZE);
+        MR_FREE(tempbuf, bufsize);
         MRDBGPRINTF("mrc_checkMrp err %d", 3);
         return MR_FAILED - 4;
     }
@@ -1603,7 +2744,7 @@ int32 mr_checkMrp(char* mrp_name) {
     // if (tempbuf[192] != 2) // 展迅
     if (tempbuf[192] != 1) {
         mr_close(f);
-        MR_FREE(tempbuf, CHECK_MRP_BUF_SIZE);
+        MR_FREE(tempbuf, bufsize);
         MRDBGPRINTF("mrc_checkMrp err %d", 31);
         return MR_FAILED - 5;
     }
@@ -1614,7 +2755,7 @@ int32 mr_checkMrp(char* mrp_name) {
     mr_updcrc(tempbuf, 224);
 
     while (nTmp > 0) {
-        nTmp = mr_read(f, tempbuf, 10240);
+        nTmp = mr_read(f, tempbuf, bufsize);
         if (nTmp > 0) {
             mr_updcrc(tempbuf, nTmp);
         }
@@ -1628,7 +2769,7 @@ int32 mr_checkMrp(char* mrp_name) {
         nTmp = MR_FAILED - 6;
     }
     mr_close(f);
-    MR_FREE(tempbuf, CHECK_MRP_BUF_SIZE);
+    MR_FREE(tempbuf, bufsize);
     return nTmp;
 }
 
@@ -1913,7 +3054,7 @@ static int MRF_BitmapLoad(mrp_State* L) {
         return 0;
     }
     if (mr_bitmap[i].p) {
-        MR_FREE(mr_bitmap[i].p, mr_bitmap[i].buflen);
+        _mr_readFileRelease(mr_bitmap[i].p, mr_bitmap[i].buflen);
         mr_bitmap[i].p = NULL;
     }
 
@@ -1921,7 +3062,7 @@ static int MRF_BitmapLoad(mrp_State* L) {
         return 0;
     }
     //MRDBGPRINTF("BitmapLoad:1 %s", filename);
-    filebuf = _mr_readFile(filename, &filelen, 0);
+    filebuf = _mr_readFile(filename, &filelen, 3);
     if (!filebuf) {
         mrp_pushfstring(L, "BitmapLoad %d:cannot read \"%s\"!", i, filename);
         mrp_error(L);
@@ -1938,7 +3079,7 @@ static int MRF_BitmapLoad(mrp_State* L) {
     } else if (w * h * MR_SCREEN_DEEP < filelen) {
         mr_bitmap[i].p = MR_MALLOC(w * h * MR_SCREEN_DEEP);
         if (!mr_bitmap[i].p) {
-            MR_FREE(filebuf, filelen);
+            _mr_readFileRelease(filebuf, filelen);
             mrp_pushfstring(L, "BitmapLoad %d \"%s\":No memory!", i, filename);
             mrp_error(L);
             return 0;
@@ -1953,11 +3094,11 @@ static int MRF_BitmapLoad(mrp_State* L) {
                 srcp++;
             }
         }
-        MR_FREE(filebuf, filelen);
+        _mr_readFileRelease(filebuf, filelen);
         //MRDBGPRINTF("BitmapLoad:4 %s", filename);
     } else {
         //MRDBGPRINTF("BitmapLoad:5 %s", filename);
-        MR_FREE(filebuf, filelen);
+        _mr_readFileRelease(filebuf, filelen);
         mrp_pushfstring(L, "BitmapLoad %d \"%s\":len err!", i, filename);
         mrp_error(L);
         return 0;
@@ -1997,7 +3138,7 @@ static int MRF_BitmapShow(mrp_State* L) {
 }
 
 static int MRF_BitmapShowEx(mrp_State* L) {
-    uint16* p = ((uint16*)mrp_tonumber(L, 1));
+    uint16* p;
     int16 x = ((int16)mrp_tonumber(L, 2));
     int16 y = ((int16)mrp_tonumber(L, 3));
     int16 mw = ((int16)mrp_tonumber(L, 4));
@@ -2007,6 +3148,17 @@ static int MRF_BitmapShowEx(mrp_State* L) {
     int16 sx = ((int16)mr_L_optint(L, 8, 0));
     int16 sy = ((int16)mr_L_optint(L, 9, 0));
 
+    if (mrp_isuserdata(L, 1)) {  //uint16 数组，直接画它的元素
+        int n;
+        p = mr_L_toarray(L, 1, MRP_ARRAY_UINT16, &n);
+        if ((p == NULL) || (n == 0) || (sx < 0) || (sy < 0) || (w > mw - sx) || ((sy + h) * mw > n)) {
+            mrp_pushfstring(L, "BitmapShowEx:bad array!");
+            mrp_error(L);
+            return 0;
+        }
+    } else {
+        p = ((uint16*)mrp_tonumber(L, 1));
+    }
     _DrawBitmap(p, x, y, w, h, rop, *p, sx, sy, mw);
     return 0;
 }
@@ -2022,7 +3174,7 @@ static int MRF_BitmapNew(mrp_State* L) {
     }
     if (mr_bitmap[i].buflen != w * h * 2) {
         if (mr_bitmap[i].p) {
-            MR_FREE(mr_bitmap[i].p, mr_bitmap[i].buflen);
+            _mr_readFileRelease(mr_bitmap[i].p, mr_bitmap[i].buflen);
             mr_bitmap[i].p = NULL;
         }
         mr_bitmap[i].p = MR_MALLOC(w * h * 2);
@@ -2036,9 +3188,33 @@ static int MRF_BitmapNew(mrp_State* L) {
     mr_bitmap[i].buflen = w * h * 2;
     mr_bitmap[i].w = w;
     mr_bitmap[i].h = h;
+    if (mrp_isuserdata(L, 4)) {  //用 uint16 数组的内容初始化
+        int n;
+        uint16* src = mr_L_toarray(L, 4, MRP_ARRAY_UINT16, &n);
+        if (src == NULL) {
+            mrp_pushfstring(L, "BitmapNew %d :not an uint16 array!", i);
+            mrp_error(L);
+            return 0;
+        }
+        MEMCPY(mr_bitmap[i].p, src, MIN((uint32)n * 2, mr_bitmap[i].buflen));
+    }
     return 0;
 }
 
+/*把位图 i 的像素复制到一个新的 uint16 数组中*/
+static int MRF_BitmapArray(mrp_State* L) {
+    uint16 i = ((uint16)to_mr_tonumber(L, 1, 0));
+    uint16* p;
+    if ((i > BITMAPMAX) || (!mr_bitmap[i].p)) {
+        mrp_pushfstring(L, "BitmapArray:index %d invalid!", i);
+        mrp_error(L);
+        return 0;
+    }
+    p = mr_L_newarray(L, MRP_ARRAY_UINT16, mr_bitmap[i].buflen / 2);
+    MEMCPY(p, mr_bitmap[i].p, mr_bitmap[i].buflen & ~1);
+    return 1;
+}
+
 static int MRF_BitmapDraw(mrp_State* L) {
     uint16 di = ((uint16)to_mr_tonumber(L, 1, 0));
     int16 dx = ((int16)to_mr_tonumber(L, 2, 0));
@@ -2064,47 +3240,406 @@ static int MRF_BitmapDraw(mrp_State* L) {
         return 0;
     }
 
-    if ((!mr_bitmap[si].p) || (!mr_bitmap[di].p)) {
-        mrp_pushfstring(L, "BitmapDraw:index %d or %d invalid!", di, si);
-        mrp_error(L);
+    if ((!mr_bitmap[si].p) || (!mr_bitmap[di].p)) {
+        mrp_pushfstring(L, "BitmapDraw:index %d or %d invalid!", di, si);
+        mrp_error(L);
+        return 0;
+    }
+
+    Trans.A = A;
+    Trans.B = B;
+    Trans.C = C;
+    Trans.D = D;
+    Trans.rop = rop;
+
+    dstbmp.w = mr_bitmap[di].w;
+    dstbmp.h = mr_bitmap[di].h;
+    dstbmp.x = dx;
+    dstbmp.y = dy;
+    dstbmp.p = mr_bitmap[di].p;
+
+    srcbmp.w = mr_bitmap[si].w;
+    srcbmp.h = mr_bitmap[si].h;
+    srcbmp.x = sx;
+    srcbmp.y = sy;
+    srcbmp.p = mr_bitmap[si].p;
+
+    _DrawBitmapEx(&srcbmp, &dstbmp, w, h, &Trans, *(mr_bitmap[si].p));
+    return 0;
+}
+
+static int MRF_BitmapInfo(mrp_State* L) {
+    uint16 i = ((uint16)to_mr_tonumber(L, 1, 0));
+    if (i > BITMAPMAX) {
+        mrp_pushfstring(L, "MRF_BitmapInfo:index %d invalid!", i);
+        mrp_error(L);
+        return 0;
+    }
+    mrp_pushnumber(L, (mrp_Number)mr_bitmap[i].p);
+    mrp_pushnumber(L, mr_bitmap[i].buflen);
+    mrp_pushnumber(L, mr_bitmap[i].w);
+    mrp_pushnumber(L, mr_bitmap[i].h);
+    mrp_pushnumber(L, mr_bitmap[i].type);
+    return 5;
+}
+
+/*
+位图缓冲对象：_bmpBuf(i) 返回位图 i（默认 BITMAPMAX，即屏幕缓冲）的缓冲对象，
+脚本通过它的方法成块地读写像素，不用每个像素调用一次 _drawPoint。
+对象里只记下标，每次调用都重新取缓冲地址和大小，位图被重建或释放后也不会越界。
+颜色都是 RGB565。
+*/
+#define MR_BMPBUF "bmpbuf"
+
+typedef struct {
+    int32 index;
+} mr_bmpBufSt;
+
+typedef struct {
+    uint16* p;
+    int32 w;
+    int32 h;
+    int32 stride;
+} mr_bmpBufInfo;
+
+static void _mr_bmpBufCheck(mrp_State* L, mr_bmpBufInfo* b) {
+    mr_bmpBufSt* ud = (mr_bmpBufSt*)mr_L_checkudata(L, 1, MR_BMPBUF);
+    if (ud == NULL) {
+        mr_L_typerror(L, 1, MR_BMPBUF);
+    }
+    if (ud->index == BITMAPMAX) {
+        b->p = mr_screenBuf;
+        b->w = MR_SCREEN_W;
+        b->h = MR_SCREEN_H;
+        b->stride = MR_SCREEN_MAX_W;
+    } else {
+        b->p = mr_bitmap[ud->index].p;
+        b->w = mr_bitmap[ud->index].w;
+        b->h = mr_bitmap[ud->index].h;
+        b->stride = b->w;
+        if ((uint32)(b->w * b->h * 2) > mr_bitmap[ud->index].buflen) {
+            b->p = NULL;
+        }
+    }
+    if (b->p == NULL) {
+        mrp_pushfstring(L, "bmpbuf:bitmap %d is nil!", ud->index);
+        mrp_error(L);
+    }
+}
+
+/*参数 narg 起的 x, y, w, h 裁剪到缓冲内，缺省为整个缓冲；*sx, *sy 是被裁掉的左边和上边*/
+static int _mr_bmpBufRect(mrp_State* L, int narg, mr_bmpBufInfo* b, int32* x, int32* y, int32* w, int32* h, int32* sx, int32* sy) {
+    *x = mr_L_optint(L, narg, 0);
+    *y = mr_L_optint(L, narg + 1, 0);
+    *w = mr_L_optint(L, narg + 2, b->w - *x);
+    *h = mr_L_optint(L, narg + 3, b->h - *y);
+    *sx = (*x < 0) ? -*x : 0;
+    *sy = (*y < 0) ? -*y : 0;
+    *x += *sx;
+    *y += *sy;
+    *w = MIN(*w - *sx, b->w - *x);
+    *h = MIN(*h - *sy, b->h - *y);
+    return (*w > 0) && (*h > 0);
+}
+
+static int MRF_BmpBuf(mrp_State* L) {
+    int32 i = mr_L_optint(L, 1, BITMAPMAX);
+    mr_bmpBufSt* ud;
+    if ((i < 0) || (i > BITMAPMAX)) {
+        mrp_pushfstring(L, "BmpBuf:index %d invalid!", i);
+        mrp_error(L);
+        return 0;
+    }
+    ud = (mr_bmpBufSt*)mrp_newuserdata(L, sizeof(mr_bmpBufSt));
+    ud->index = i;
+    mr_L_getmetatable(L, MR_BMPBUF);
+    mrp_setmetatable(L, -2);
+    return 1;
+}
+
+/*b:size() -> w, h*/
+static int MRF_BmpBufSize(mrp_State* L) {
+    mr_bmpBufInfo b;
+    _mr_bmpBufCheck(L, &b);
+    mrp_pushnumber(L, b.w);
+    mrp_pushnumber(L, b.h);
+    return 2;
+}
+
+/*b:get(x, y) -> 颜色，超出范围返回 nil*/
+static int MRF_BmpBufGet(mrp_State* L) {
+    mr_bmpBufInfo b;
+    int32 x = mr_L_checkint(L, 2);
+    int32 y = mr_L_checkint(L, 3);
+    _mr_bmpBufCheck(L, &b);
+    if ((uint32)x >= (uint32)b.w || (uint32)y >= (uint32)b.h) {
+        return 0;
+    }
+    mrp_pushnumber(L, b.p[y * b.stride + x]);
+    return 1;
+}
+
+/*b:set(x, y, c)，超出范围的点被忽略*/
+static int MRF_BmpBufSet(mrp_State* L) {
+    mr_bmpBufInfo b;
+    int32 x = mr_L_checkint(L, 2);
+    int32 y = mr_L_checkint(L, 3);
+    uint16 c = (uint16)mr_L_checkint(L, 4);
+    _mr_bmpBufCheck(L, &b);
+    if ((uint32)x < (uint32)b.w && (uint32)y < (uint32)b.h) {
+        b.p[y * b.stride + x] = c;
+    }
+    return 0;
+}
+
+/*b:read([x, y, w, h]) -> uint16 数组, w, h（裁剪后的大小）*/
+static int MRF_BmpBufRead(mrp_State* L) {
+    mr_bmpBufInfo b;
+    int32 x, y, w, h, sx, sy, dy;
+    uint16* dstp;
+    _mr_bmpBufCheck(L, &b);
+    if (!_mr_bmpBufRect(L, 2, &b, &x, &y, &w, &h, &sx, &sy)) {
+        w = h = 0;
+    }
+    dstp = mr_L_newarray(L, MRP_ARRAY_UINT16, w * h);
+    for (dy = 0; dy < h; dy++) {
+        MEMCPY(dstp + dy * w, b.p + (y + dy) * b.stride + x, w * 2);
+    }
+    mrp_pushnumber(L, w);
+    mrp_pushnumber(L, h);
+    return 3;
+}
+
+/*b:write(arr, x, y, w [, h [, trans]])：arr 是 w 宽的 uint16 数组，等于 trans 的点不画*/
+static int MRF_BmpBufWrite(mrp_State* L) {
+    mr_bmpBufInfo b;
+    int32 n, x, y, w, h, sx, sy, aw, dx, dy;
+    int trans = !mrp_isnoneornil(L, 7);
+    uint16 transcolor = (uint16)mr_L_optint(L, 7, 0);
+    uint16* srcp = mr_L_toarray(L, 2, MRP_ARRAY_UINT16, &n);
+    _mr_bmpBufCheck(L, &b);
+    if (srcp == NULL) {
+        mr_L_typerror(L, 2, "uint16 array");
+    }
+    aw = mr_L_checkint(L, 5);
+    mr_L_argcheck(L, aw > 0, 5, "width must be positive");
+    if (mrp_isnoneornil(L, 6)) { /* 缺省为数组的行数 */
+        if (mrp_gettop(L) < 6) {
+            mrp_settop(L, 6);
+        }
+        mrp_pushnumber(L, n / aw);
+        mrp_replace(L, 6);
+    }
+    mr_L_argcheck(L, mr_L_checkint(L, 6) <= n / aw, 6, "array too small");
+    if (!_mr_bmpBufRect(L, 3, &b, &x, &y, &w, &h, &sx, &sy)) {
+        return 0;
+    }
+    srcp += sy * aw + sx;
+    for (dy = 0; dy < h; dy++) {
+        uint16* dstp = b.p + (y + dy) * b.stride + x;
+        if (!trans) {
+            MEMCPY(dstp, srcp, w * 2);
+        } else {
+            for (dx = 0; dx < w; dx++) {
+                if (srcp[dx] != transcolor) {
+                    dstp[dx] = srcp[dx];
+                }
+            }
+        }
+        srcp += aw;
+    }
+    return 0;
+}
+
+/*b:fill(c [, x, y, w, h])*/
+static int MRF_BmpBufFill(mrp_State* L) {
+    mr_bmpBufInfo b;
+    int32 x, y, w, h, sx, sy, dx, dy;
+    uint16 c = (uint16)mr_L_checkint(L, 2);
+    _mr_bmpBufCheck(L, &b);
+    if (!_mr_bmpBufRect(L, 3, &b, &x, &y, &w, &h, &sx, &sy)) {
+        return 0;
+    }
+    for (dy = 0; dy < h; dy++) {
+        uint16* dstp = b.p + (y + dy) * b.stride + x;
+        for (dx = 0; dx < w; dx++) {
+            dstp[dx] = c;
+        }
+    }
+    return 0;
+}
+
+/*b:blend(c, alpha [, x, y, w, h])：每个点向 c 混合 alpha/256，用于淡入淡出*/
+static int MRF_BmpBufBlend(mrp_State* L) {
+    mr_bmpBufInfo b;
+    int32 x, y, w, h, sx, sy, dx, dy;
+    uint32 c = (uint16)mr_L_checkint(L, 2);
+    uint32 a = (uint32)MIN(MAX(mr_L_checkint(L, 3), 0), 256) >> 3; /* 0..32 */
+    uint32 cs;
+    _mr_bmpBufCheck(L, &b);
+    if (!_mr_bmpBufRect(L, 4, &b, &x, &y, &w, &h, &sx, &sy)) {
+        return 0;
+    }
+    /* 把 565 拆成 -G-R-B 放进 32 位，三个分量一次乘完 */
+    cs = ((c | (c << 16)) & 0x07e0f81f) * a;
+    a = 32 - a;
+    for (dy = 0; dy < h; dy++) {
+        uint16* dstp = b.p + (y + dy) * b.stride + x;
+        for (dx = 0; dx < w; dx++) {
+            uint32 d = dstp[dx];
+            d = (((d | (d << 16)) & 0x07e0f81f) * a + cs) >> 5;
+            d &= 0x07e0f81f;
+            dstp[dx] = (uint16)(d | (d >> 16));
+        }
+    }
+    return 0;
+}
+
+/*b:map(idx, pal, x, y, w [, h])：idx 是 w 宽的 uint8 数组，每个点画成 pal[idx+1]，
+pal 是 uint16 数组，超出 pal 的下标不画*/
+static int MRF_BmpBufMap(mrp_State* L) {
+    mr_bmpBufInfo b;
+    int32 n, npal, x, y, w, h, sx, sy, aw, dx, dy;
+    uint8* srcp = mr_L_toarray(L, 2, MRP_ARRAY_UINT8, &n);
+    uint16* pal = mr_L_toarray(L, 3, MRP_ARRAY_UINT16, &npal);
+    _mr_bmpBufCheck(L, &b);
+    if (srcp == NULL) {
+        mr_L_typerror(L, 2, "uint8 array");
+    }
+    if (pal == NULL) {
+        mr_L_typerror(L, 3, "uint16 array");
+    }
+    aw = mr_L_checkint(L, 6);
+    mr_L_argcheck(L, aw > 0, 6, "width must be positive");
+    if (mrp_isnoneornil(L, 7)) { /* 缺省为数组的行数 */
+        if (mrp_gettop(L) < 7) {
+            mrp_settop(L, 7);
+        }
+        mrp_pushnumber(L, n / aw);
+        mrp_replace(L, 7);
+    }
+    mr_L_argcheck(L, mr_L_checkint(L, 7) <= n / aw, 7, "array too small");
+    if (!_mr_bmpBufRect(L, 4, &b, &x, &y, &w, &h, &sx, &sy)) {
+        return 0;
+    }
+    srcp += sy * aw + sx;
+    for (dy = 0; dy < h; dy++) {
+        uint16* dstp = b.p + (y + dy) * b.stride + x;
+        for (dx = 0; dx < w; dx++) {
+            if (srcp[dx] < npal) {
+                dstp[dx] = pal[srcp[dx]];
+            }
+        }
+        srcp += aw;
+    }
+    return 0;
+}
+
+static mr_L_reg bmpbuflib[9];
+
+static void _mr_bmpBufOpen(mrp_State* L) {
+    mr_L_newmetatable(L, MR_BMPBUF);
+    mrp_pushliteral(L, "__index");
+    mrp_pushvalue(L, -2);
+    mrp_rawset(L, -3); /* metatable.__index = metatable */
+    mr_L_openlib(L, NULL, bmpbuflib, 0);
+    mrp_pop(L, 1);
+}
+
+/*
+文件流对象：_readStream(filename) 打开当前 mrp 里的文件，返回流对象，找不到时
+返回 nil。脚本用 s:read(n) 一块一块地读，压缩的文件边读边解压，大文件不用整个
+读进内存。对象被回收时自动关闭。
+*/
+#define MR_RSTREAM "readstream"
+
+typedef struct {
+    mr_stream* st; /* 关闭后为 NULL */
+} mr_rstreamSt;
+
+static mr_rstreamSt* _mr_rstreamCheck(mrp_State* L) {
+    mr_rstreamSt* ud = (mr_rstreamSt*)mr_L_checkudata(L, 1, MR_RSTREAM);
+    if (ud == NULL) {
+        mr_L_typerror(L, 1, MR_RSTREAM);
+    }
+    return ud;
+}
+
+static int MRF_ReadStream(mrp_State* L) {
+    const char* filename = mr_L_checkstring(L, 1);
+    mr_rstreamSt* ud;
+    /*先建好带 __gc 的对象再打开，分配出错时流不会漏掉*/
+    ud = (mr_rstreamSt*)mrp_newuserdata(L, sizeof(mr_rstreamSt));
+    ud->st = NULL;
+    mr_L_getmetatable(L, MR_RSTREAM);
+    mrp_setmetatable(L, -2);
+    ud->st = _mr_streamOpen(filename);
+    if (ud->st == NULL) {
+        return 0;
+    }
+    return 1;
+}
+
+/*s:read(n) -> 最多 n 字节的字符串，读完或已关闭返回 nil*/
+static int MRF_ReadStreamRead(mrp_State* L) {
+    mr_rstreamSt* ud = _mr_rstreamCheck(L);
+    int32 n = mr_L_checkint(L, 2);
+    int32 got = 0, want, r;
+    mr_L_Buffer b;
+    if ((ud->st == NULL) || (n <= 0)) {
         return 0;
     }
+    mr_L_buffinit(L, &b);
+    while (got < n) {
+        want = MIN(n - got, MRP_L_BUFFERSIZE);
+        r = _mr_streamRead(ud->st, mr_L_prepbuffer(&b), want);
+        if (r < 0) {
+            mrp_pushstring(L, "readstream:bad data!");
+            mrp_error(L);
+            return 0;
+        }
+        mr_L_addsize(&b, r);
+        got += r;
+        if (r < want) {
+            break;
+        }
+    }
+    if (got == 0) {
+        return 0;
+    }
+    mr_L_pushresult(&b);
+    return 1;
+}
 
-    Trans.A = A;
-    Trans.B = B;
-    Trans.C = C;
-    Trans.D = D;
-    Trans.rop = rop;
-
-    dstbmp.w = mr_bitmap[di].w;
-    dstbmp.h = mr_bitmap[di].h;
-    dstbmp.x = dx;
-    dstbmp.y = dy;
-    dstbmp.p = mr_bitmap[di].p;
-
-    srcbmp.w = mr_bitmap[si].w;
-    srcbmp.h = mr_bitmap[si].h;
-    srcbmp.x = sx;
-    srcbmp.y = sy;
-    srcbmp.p = mr_bitmap[si].p;
+/*s:size() -> 解压后的长度*/
+static int MRF_ReadStreamSize(mrp_State* L) {
+    mr_rstreamSt* ud = _mr_rstreamCheck(L);
+    if (ud->st == NULL) {
+        return 0;
+    }
+    mrp_pushnumber(L, _mr_streamSize(ud->st));
+    return 1;
+}
 
-    _DrawBitmapEx(&srcbmp, &dstbmp, w, h, &Trans, *(mr_bitmap[si].p));
+/*s:close()，也是 __gc*/
+static int MRF_ReadStreamClose(mrp_State* L) {
+    mr_rstreamSt* ud = _mr_rstreamCheck(L);
+    if (ud->st) {
+        _mr_streamClose(ud->st);
+        ud->st = NULL;
+    }
     return 0;
 }
 
-static int MRF_BitmapInfo(mrp_State* L) {
-    uint16 i = ((uint16)to_mr_tonumber(L, 1, 0));
-    if (i > BITMAPMAX) {
-        mrp_pushfstring(L, "MRF_BitmapInfo:index %d invalid!", i);
-        mrp_error(L);
-        return 0;
-    }
-    mrp_pushnumber(L, (mrp_Number)mr_bitmap[i].p);
-    mrp_pushnumber(L, mr_bitmap[i].buflen);
-    mrp_pushnumber(L, mr_bitmap[i].w);
-    mrp_pushnumber(L, mr_bitmap[i].h);
-    mrp_pushnumber(L, mr_bitmap[i].type);
-    return 5;
+static mr_L_reg rstreamlib[5];
+
+static void _mr_rstreamOpen(mrp_State* L) {
+    mr_L_newmetatable(L, MR_RSTREAM);
+    mrp_pushliteral(L, "__index");
+    mrp_pushvalue(L, -2);
+    mrp_rawset(L, -3); /* metatable.__index = metatable */
+    mr_L_openlib(L, NULL, rstreamlib, 0);
+    mrp_pop(L, 1);
 }
 
 static int MRF_SpriteSet(mrp_State* L) {
@@ -2359,7 +3894,7 @@ static int MRF_TileLoad(mrp_State* L) {
         mr_map[i] = NULL;
     }
 
-    mr_map[i] = _mr_readFile(filename, &filelen, 0);
+    mr_map[i] = _mr_readFileBig(filename, &filelen, 0);
 
 #ifdef MYTHROAD_DEBUG
     if (!mr_map[i]) {
@@ -2524,7 +4059,7 @@ static void SoundSet(mrp_State* L, uint16 i, char* filename, int32 type) {
     }
 
     if (mr_sound[i].p) {
-        MR_FREE(mr_sound[i].p, mr_sound[i].buflen);
+        _mr_readFileRelease(mr_sound[i].p, mr_sound[i].buflen);
         mr_sound[i].p = NULL;
     }
 
@@ -2532,7 +4067,7 @@ static void SoundSet(mrp_State* L, uint16 i, char* filename, int32 type) {
         return;
     }
     //MRDBGPRINTF("SoundSet:1 %s", filename);
-    filebuf = _mr_readFile(filename, &filelen, 0);
+    filebuf = _mr_readFileBig(filename, &filelen, 3);
     if (!filebuf) {
         mrp_pushfstring(L, "SoundSet %d:cannot read \"%s\"!", i, filename);
         mrp_error(L);
@@ -2634,39 +4169,225 @@ static int MRF_Exit(mrp_State* L) {
     return 0;
 }
 
+/*
+ * Saved tables.
+ * SaveTable writes "<name>.tmp" and renames it over <name> only when it
+ * is complete, so a crash while saving leaves the previous save intact.
+ * The file starts with a mr_saveHead, rewritten at the end with the
+ * length and Adler-32 of the payload (the sum is kept in SaveF rather
+ * than in the shared mr_updcrc register, because persisting may run Lua
+ * code).  With MR_SAVE_DEFLATE the payload is a gzip member.
+ * LoadTable falls back to the .tmp file when <name> is missing or
+ * broken, and still reads files without the header (older saves).
+ */
+
+static uint32 _mr_adler32(uint32 adler, const uint8* p, uint32 n) {
+    uint32 a = adler & 0xffff, b = adler >> 16;
+    while (n > 0) {
+        uint32 k = (n < 5552) ? n : 5552; /* largest run without overflow */
+        n -= k;
+        while (k--) {
+            a += *p++;
+            b += a;
+        }
+        a %= 65521;
+        b %= 65521;
+    }
+    return (b << 16) | a;
+}
+
+/* the sum of len bytes after n of them at off changed from 0 to v[] */
+static uint32 _mr_adler32patch(uint32 adler, uint32 len, uint32 off, const uint8* v, uint32 n) {
+    uint32 a = adler & 0xffff, b = adler >> 16;
+    uint32 i;
+    for (i = 0; i < n; i++) { /* byte k adds to a once and to b len-k times */
+        a = (a + v[i]) % 65521;
+        b = (b + v[i] * ((len - off - i) % 65521)) % 65521;
+    }
+    return (b << 16) | a;
+}
+
+static void _mr_saveFlush(SaveF* wi) {
+    if (wi->n > 0) {
+        if (mr_write(wi->f, wi->buff, wi->n) != (int32)wi->n) {
+            wi->err = 1;
+        }
+        wi->n = 0;
+    }
+}
+
+/* appends payload bytes through the write buffer */
+static void _mr_saveData(SaveF* wi, const void* p, uint32 sz) {
+    wi->sum = _mr_adler32(wi->sum, (const uint8*)p, sz);
+    wi->len += sz;
+    if (wi->n + sz > MR_SAVE_BUFSIZE) {
+        _mr_saveFlush(wi);
+    }
+    if (sz >= MR_SAVE_BUFSIZE) {
+        if (mr_write(wi->f, (void*)p, sz) != (int32)sz) {
+            wi->err = 1;
+        }
+    } else {
+        MEMCPY(wi->buff + wi->n, p, sz);
+        wi->n += sz;
+    }
+}
+
 static int bufwriter(mrp_State* L, const void* p, size_t sz, void* ud) {
     SaveF* wi = (SaveF*)ud;
 
-    if (mr_write(wi->f, (void*)p, (uint32)sz) < 0) {
+    if (wi->flags & MR_SAVE_DEFLATE) { /* keep everything for the compressor */
+        if (wi->memlen + sz > wi->memsize) {
+            uint32 size = (wi->memsize > 0) ? wi->memsize : MR_SAVE_BUFSIZE;
+            uint8* mem;
+            while (size < wi->memlen + sz) size *= 2;
+            mem = MR_MALLOC(size);
+            if (mem == NULL) { /* no room to compress: write it as it is */
+                wi->flags &= ~MR_SAVE_DEFLATE;
+            } else if (wi->mem != NULL) {
+                MEMCPY(mem, wi->mem, wi->memlen);
+            }
+            if (wi->mem != NULL) {
+                if (mem == NULL) {
+                    _mr_saveData(wi, wi->mem, wi->memlen);
+                }
+                MR_FREE(wi->mem, wi->memsize);
+            }
+            wi->mem = mem;
+            wi->memsize = (mem != NULL) ? size : 0;
+            wi->memlen = (mem != NULL) ? wi->memlen : 0;
+        }
+        if (wi->mem != NULL) {
+            MEMCPY(wi->mem + wi->memlen, p, sz);
+            wi->memlen += (uint32)sz;
+            return 0;
+        }
+    }
+    _mr_saveData(wi, p, (uint32)sz);
+    if (wi->err) {
         mrp_pushstring(L, "SaveTable:mr_write failed");
-        mr_close(wi->f);
         mrp_error(L);
-        return 0;
     }
     return 0;
 }
 
+/* protected part of SaveTable: perms rootobj SaveF */
+static int _mr_savePersist(mrp_State* L) {
+    SaveF* wi = (SaveF*)mrp_touserdata(L, 3);
+    mrp_settop(L, 2);
+    wi->count = mr_store_persist(L, bufwriter, wi);
+    return 0;
+}
+
+/* writes the collected stream compressed, or as it is if that does not pay */
+static void _mr_saveDeflate(SaveF* wi) {
+    uint32 size = wi->memlen + wi->memlen / 8 + 64;
+    uint8* out = NULL;
+    int32 n = -1;
+
+    if (wi->memlen < WSIZE) { /* mr_inflate output limit */
+        out = MR_MALLOC(size);
+    }
+    if (out != NULL) {
+        n = mr_deflate(out, size, wi->mem, wi->memlen);
+    }
+    if (n > 0 && (uint32)n < wi->memlen) {
+        _mr_saveData(wi, out, n);
+    } else {
+        wi->flags &= ~MR_SAVE_DEFLATE;
+        _mr_saveData(wi, wi->mem, wi->memlen);
+    }
+    if (out != NULL) {
+        MR_FREE(out, size);
+    }
+}
+
+static int _mr_saveNames(const char* filename, char* name, char* tmpname) {
+    if (filename == NULL || STRLEN(filename) + 5 > MR_MAX_FILENAME_SIZE) {
+        return 0;
+    }
+    SPRINTF(name, "%s", filename);
+    SPRINTF(tmpname, "%s.tmp", filename);
+    return 1;
+}
+
 static int SaveTable(mrp_State* L) {
     SaveF wi;
-    char* filename = ((char*)to_mr_tostring(L, 3, 0));
+    mr_saveHead head;
+    char name[MR_MAX_FILENAME_SIZE];
+    char tmpname[MR_MAX_FILENAME_SIZE];
+    int status;
 
+    if (!_mr_saveNames(to_mr_tostring(L, 3, 0), name, tmpname)) {
+        MRDBGPRINTF("SaveTable: bad file name");
+        return 0;
+    }
+    wi.flags = mrp_toboolean(L, 4) ? MR_SAVE_DEFLATE : 0;
     mrp_settop(L, 2);
     /* perms? rootobj? */
     mr_L_checktype(L, 1, MRP_TTABLE);
-    /* perms rootobj? */
-    //mr_L_checktype(L, 1, MRP_TTABLE);
     /* perms rootobj */
 
-    wi.f = mr_open(filename, MR_FILE_WRONLY | MR_FILE_CREATE);
+    mr_remove(tmpname);
+    wi.f = mr_open(tmpname, MR_FILE_WRONLY | MR_FILE_CREATE);
     if (wi.f == 0) {
-        //mrp_pushfstring(L, "SaveTable:mr_open \"%s\" failed",filename);
-        //mrp_error(L);
-        MRDBGPRINTF("SaveTable:mr_open \"%s\" failed", filename);
+        MRDBGPRINTF("SaveTable:mr_open \"%s\" failed", tmpname);
         return 0;
     }
-    mr_store_persist(L, bufwriter, &wi);
-    mrp_settop(L, 0);
+    wi.err = 0;
+    wi.len = 0;
+    wi.sum = 1;
+    wi.mem = NULL;
+    wi.memlen = wi.memsize = 0;
+    wi.n = 0;
+    head.magic = MR_SAVE_MAGIC;
+    head.flags = head.len = head.sum = 0; /* filled in at the end */
+    if (mr_write(wi.f, &head, sizeof(head)) != sizeof(head)) {
+        wi.err = 1;
+    }
+
+    mrp_pushcfunction(L, _mr_savePersist);
+    mrp_insert(L, 1);
+    mrp_pushlightuserdata(L, &wi);
+    status = mrp_pcall(L, 3, 0, 0);
+    if (status == 0) {
+        /* store the object count in the stream header (see mr_store.h) */
+        if (wi.flags & MR_SAVE_DEFLATE) {
+            MEMCPY(wi.mem + MR_STORE_COUNTPOS, &wi.count, sizeof(int32));
+            _mr_saveDeflate(&wi);
+            _mr_saveFlush(&wi);
+        } else {
+            _mr_saveFlush(&wi);
+            if (mr_seek(wi.f, sizeof(head) + MR_STORE_COUNTPOS, MR_SEEK_SET) != MR_SUCCESS || mr_write(wi.f, &wi.count, sizeof(int32)) != sizeof(int32)) {
+                wi.err = 1;
+            }
+            wi.sum = _mr_adler32patch(wi.sum, wi.len, MR_STORE_COUNTPOS, (uint8*)&wi.count, sizeof(int32));
+        }
+        head.flags = wi.flags;
+        head.len = wi.len;
+        head.sum = wi.sum;
+        if (mr_seek(wi.f, 0, MR_SEEK_SET) != MR_SUCCESS || mr_write(wi.f, &head, sizeof(head)) != sizeof(head)) {
+            wi.err = 1;
+        }
+    }
     mr_close(wi.f);
+    if (wi.mem != NULL) {
+        MR_FREE(wi.mem, wi.memsize);
+    }
+    if (status != 0 || wi.err) {
+        mr_remove(tmpname);
+        if (status == 0) {
+            mrp_pushstring(L, "SaveTable:mr_write failed");
+        }
+        mrp_error(L);
+        return 0;
+    }
+    mr_remove(name);
+    if (mr_rename(tmpname, name) != MR_SUCCESS) {
+        MRDBGPRINTF("SaveTable:mr_rename \"%s\" failed", tmpname);
+        return 0;
+    }
+    mrp_settop(L, 0);
     mrp_pushnumber(L, MR_SUCCESS);
     return 1;
 }
@@ -2674,31 +4395,112 @@ static int SaveTable(mrp_State* L) {
 static const char* bufreader(mrp_State* L, void* ud, size_t* sz) {
     LoadF* lf = (LoadF*)ud;
     (void)L;
-    *sz = mr_read(lf->f, lf->buff, MRP_L_BUFFERSIZE);
-    return (*sz > 0) ? lf->buff : NULL;
+    if (lf->size == 0) {
+        return NULL;
+    }
+    *sz = lf->size;
+    lf->size = 0;
+    return lf->p;
+}
+
+/* protected part of LoadTable: perms LoadF */
+static int _mr_loadUnpersist(mrp_State* L) {
+    LoadF* lf = (LoadF*)mrp_touserdata(L, 2);
+    mrp_settop(L, 1);
+    mr_store_unpersist(L, bufreader, lf);
+    return 1;
+}
+
+static int _mr_loadInflate(mrp_State* L, LoadF* lf) {
+    uint32 reallen;
+
+    mr_gzInBuf = (uint8*)lf->p;
+    LG_gzinptr = 0;
+    LG_gzoutcnt = 0;
+    if (lf->size < 18 || mr_get_method(lf->size) < 0) {
+        return 0;
+    }
+    reallen = LG(lf->p + lf->size - 4);
+    mr_gzOutBuf = mrp_newuserdata(L, reallen); /* collected with the file */
+    if (mr_unzip() != 0 || LG_gzoutcnt != reallen) {
+        return 0;
+    }
+    lf->p = (const char*)mr_gzOutBuf;
+    lf->size = reallen;
+    return 1;
+}
+
+/*
+ * reads and checks a saved file and pushes its data, kept as userdata so
+ * that the GC frees it even if unpersisting fails; returns 0 if the file
+ * is missing or broken
+ */
+static int _mr_loadFile(mrp_State* L, const char* name, LoadF* lf) {
+    int top = mrp_gettop(L);
+    int32 len = mr_getLen(name), got, nTmp;
+    mr_saveHead head;
+    char* buf;
+    int32 f;
+
+    if (len <= 0 || (f = mr_open(name, MR_FILE_RDONLY)) == 0) {
+        return 0;
+    }
+    buf = mrp_newuserdata(L, len);
+    got = 0;
+    while (got < len) {
+        nTmp = mr_read(f, buf + got, len - got);
+        if (nTmp <= 0) {
+            break;
+        }
+        got += nTmp;
+    }
+    mr_close(f);
+    lf->p = buf;
+    lf->size = len;
+    if (got == len && (uint32)len >= sizeof(head)) {
+        MEMCPY(&head, buf, sizeof(head));
+        if (head.magic == MR_SAVE_MAGIC) {
+            lf->p = buf + sizeof(head);
+            lf->size = len - sizeof(head);
+            if (head.len != lf->size || _mr_adler32(1, (const uint8*)lf->p, lf->size) != head.sum || ((head.flags & MR_SAVE_DEFLATE) && !_mr_loadInflate(L, lf))) {
+                MRDBGPRINTF("LoadTable: \"%s\" is broken", name);
+                mrp_settop(L, top);
+                return 0;
+            }
+        }
+    } else if (got != len) {
+        mrp_settop(L, top);
+        return 0;
+    }
+    return 1;
 }
 
 static int LoadTable(mrp_State* L) {
     LoadF lf;
-    char* filename = ((char*)to_mr_tostring(L, 2, 0));
+    char name[MR_MAX_FILENAME_SIZE];
+    char tmpname[MR_MAX_FILENAME_SIZE];
+    int ok;
 
+    ok = _mr_saveNames(to_mr_tostring(L, 2, 0), name, tmpname);
     mrp_settop(L, 2);
     mrp_pop(L, 1);
-    //mr_L_checktype(L, 1, MRP_TTABLE);
-    /* perms rootobj */
+    /* perms */
     mr_L_checktype(L, 1, MRP_TTABLE);
 
-    lf.f = mr_open(filename, MR_FILE_RDONLY);
-    if (lf.f == 0) {
-        MRDBGPRINTF("LoadTable:mr_open \"%s\" err", filename);
+    if (!ok || (!_mr_loadFile(L, name, &lf) && !_mr_loadFile(L, tmpname, &lf))) {
+        MRDBGPRINTF("LoadTable:mr_open \"%s\" err", name);
         mrp_settop(L, 0);
         mrp_settop(L, 1);
         return 1;
     }
-
-    mr_store_unpersist(L, bufreader, &lf);
-
-    mr_close(lf.f);
+    /* perms data... */
+    mrp_pushcfunction(L, _mr_loadUnpersist);
+    mrp_pushvalue(L, 1);
+    mrp_pushlightuserdata(L, &lf);
+    if (mrp_pcall(L, 2, 1, 0) != 0) {
+        mrp_error(L);
+    }
+    /* perms data... rootobj */
     return 1;
 }
 
@@ -3176,6 +4978,87 @@ int _mr_TestCom(mrp_State* L, int input0, int input1) {
         case 504:
             ret = _mr_save_sms_cfg(input1);
             break;
+#ifdef MR_PCACHE
+        case 409:
+            ret = mr_pcache_on;
+            mr_pcache_on = input1;
+            break;
+        case 410:
+            ret = input1 ? mr_pcache_miss : mr_pcache_hit;
+            break;
+#endif
+        case 411:
+            ret = mrp_setloadmode(L ? L : vm_state, input1);
+            break;
+        case 412:
+            ret = mrp_getstripped(L ? L : vm_state);
+            break;
+        case 413:  // 开始采样, input1为采样间隔(指令数), 必须>0: 平台没有能打断脚本的定时器来调用mrp_profsignal
+            if (input1 <= 0) {
+                ret = MR_FAILED;
+                break;
+            }
+            ret = mrp_profstart(L ? L : vm_state, input1, 0, MRP_PROF_OPS);
+            break;
+        case 414:
+            mrp_profstop(L ? L : vm_state);
+            break;
+        case 415:  // 进入VM的次数: input1为0时返回上次查询以来的每秒次数, 1为总次数, 2为出错次数
+            if (input1 == 1) {
+                ret = mr_vmcall_count;
+            } else if (input1 == 2) {
+                ret = mr_vmcall_errors;
+            } else {
+                int32 now = mr_getTime();
+                int32 dt = now - mr_vmcall_marktime;
+                ret = (dt > 0) ? (int)((uint64)(mr_vmcall_count - mr_vmcall_mark) * 1000 / dt) : 0;
+                mr_vmcall_mark = mr_vmcall_count;
+                mr_vmcall_marktime = now;
+            }
+            break;
+        case 416:  // 每次回调最多执行input1条指令, 超出时回调出错; <=0时不限制
+            ret = mr_budget_limit;
+            mr_budget_limit = (input1 > 0) ? input1 : 0;
+            if (mr_budget_limit == 0 && vm_state) {
+                mrp_setbudget(vm_state, 0);
+            }
+            break;
+        case 417:  // input1为0时返回上次回调执行的指令数, 1为最大值, 2为超出次数
+            if (input1 == 1) {
+                ret = mr_budget_max;
+            } else if (input1 == 2) {
+                ret = mr_budget_over;
+            } else {
+                ret = mr_budget_last;
+            }
+            break;
+#ifdef MR_ACACHE
+        case 418:  // 解压缓存的大小(字节)设为input1, 返回原来的大小; input1为0时不缓存
+            ret = mr_acache_budget;
+            mr_acache_budget = (input1 > 0) ? input1 : 0;
+            _mr_acacheTrim(mr_acache_budget);
+            break;
+        case 419:  // input1为0时返回命中次数, 1为未命中次数, 2为省去解压的字节数, 3为缓存占用的字节数
+            if (input1 == 1) {
+                ret = mr_acache_miss;
+            } else if (input1 == 2) {
+                ret = mr_acache_saved;
+            } else if (input1 == 3) {
+                ret = mr_acache_used;
+            } else {
+                ret = mr_acache_hit;
+            }
+            break;
+#endif
+#ifdef MR_PREFETCH
+        case 420:  // 启动预读: input1为0时关闭, 1时打开(下次启动生效), 返回原来的设置
+            ret = mr_prefetch_on;
+            mr_prefetch_on = input1;
+            break;
+        case 421:  // input1为0时返回预读的文件个数, 1为预读的字节数
+            ret = input1 ? mr_prefetch_bytes : mr_prefetch_count;
+            break;
+#endif
         case 3629:
             if (input1 == 2913)
                 bi = bi | MR_FLAGS_BI;
@@ -3204,12 +5087,96 @@ static int MRF_TestCom(mrp_State* L) {
     return _mr_TestCom(L, input0, input1);
 }
 
+/*
+ * Pushes the global function called name, like mrp_getglobal. The name
+ * is interned once per VM and the node of the globals that holds it is
+ * kept, so a callback reads the function without hashing the name.
+ * name is only used the first time: see _mr_renameHandler.
+ */
+static void _mr_pushHandler(mr_handlerRef* h, const char* name) {
+    if (h->ref == MRP_NOREF) {
+        if (name == NULL) {
+            mrp_pushnil(vm_state);
+            return;
+        }
+        mrp_pushstring(vm_state, name);
+        h->name = mrp_tostring(vm_state, -1);
+        h->ref = mr_L_ref(vm_state, MRP_REGISTRYINDEX);
+        h->slot = NULL;
+    }
+    mrp_getglobalref(vm_state, h->ref, &h->slot);
+}
+
+/* the timer function may change between ticks; a script passing the same
+   name again passes the same interned string, so no STRCMP then */
+static void _mr_renameHandler(mr_handlerRef* h, const char* name) {
+    if (h->ref != MRP_NOREF && name != h->name && (name == NULL || STRCMP(h->name, name) != 0)) {
+        mrp_unref(vm_state, h->ref);
+        h->ref = MRP_NOREF;
+    }
+}
+
+/* called with each new VM: the references belong to the previous one */
+static void _mr_resetHandlers(void) {
+    mr_dealevent_h.ref = MRP_NOREF;
+    mr_timer_h.ref = MRP_NOREF;
+#ifdef MR_TRACE
+    mr_trace_h.ref = MRP_NOREF;
+#endif
+    mr_vmcall_count = mr_vmcall_errors = mr_vmcall_mark = 0;
+    mr_vmcall_marktime = mr_getTime();
+    mr_vmcall_depth = 0;
+    mr_budget_last = mr_budget_max = 0;
+    mr_budget_over = 0;
+}
+
+/* an outermost call gets a fresh instruction budget */
+static void _mr_beginCall(void) {
+    if (mr_vmcall_depth++ == 0 && mr_budget_limit > 0) {
+        mrp_setbudget(vm_state, mr_budget_limit);
+    }
+}
+
+static void _mr_endCall(int status) {
+    mr_vmcall_count++;
+    if (status != 0) {
+        mr_vmcall_errors++;
+    }
+    if (mr_vmcall_depth > 0 && --mr_vmcall_depth == 0 && mr_budget_limit > 0) {
+        mr_budget_last = mrp_budgetused(vm_state);
+        if (mr_budget_last > mr_budget_max) {
+            mr_budget_max = mr_budget_last;
+        }
+        if (mr_budget_last > mr_budget_limit) {
+            mr_budget_over++;
+        }
+    }
+}
+
+/* mrp_pcall/mrp_cpcall for native plugins (_mr_c_internal_table): they enter
+   the VM from their own callbacks too, so they get a fresh budget like _mr_pcall */
+int _mr_plugin_pcall(mrp_State* L, int nargs, int nresults, int errfunc) {
+    int status;
+    _mr_beginCall();
+    status = mrp_pcall(L, nargs, nresults, errfunc);
+    _mr_endCall(status);
+    return status;
+}
+
+int _mr_plugin_cpcall(mrp_State* L, mrp_CFunction func, void* ud) {
+    int status;
+    _mr_beginCall();
+    status = mrp_cpcall(L, func, ud);
+    _mr_endCall(status);
+    return status;
+}
+
 int _mr_pcall(int nargs, int nresults) {
     int status;
 
 #ifdef MR_TRACE
     int errfunc = 0;
-    mrp_getglobal(vm_state, "_trace");
+    _mr_pushHandler(&mr_trace_h, "_trace");
     if (mrp_isfunction(vm_state, -1)) {
         mrp_insert(vm_state, -5);
         errfunc = -5;
@@ -3217,7 +5184,9 @@ int _mr_pcall(int nargs, int nresults) {
         mrp_pop(vm_state, 1); /* remove _trace */
         errfunc = 0;
     }
+    _mr_beginCall();
     status = mrp_pcall(vm_state, nargs, nresults, errfunc); /* call main */
+    _mr_endCall(status);
     if (errfunc) {
         if (status != 0) {
             mr_state = MR_STATE_ERROR;
@@ -3232,7 +5201,9 @@ int _mr_pcall(int nargs, int nresults) {
     }
 #else
 
+    _mr_beginCall();
     status = mrp_pcall(vm_state, nargs, nresults, 0); /* call main */
+    _mr_endCall(status);
     //MRDBGPRINTF("mr_read_asyn_cb 4");
     if (status != 0) {
 #ifndef MR_APP_IGNORE_EXCEPTION
@@ -3494,10 +5465,10 @@ int _mr_TestCom1(mrp_State* L, int input0, char* input1, int32 len) {
         } break;
 
         case 601: {
-            char* filebuf = _mr_readFile((const char*)input1, &ret, 0);
+            char* filebuf = _mr_readFile((const char*)input1, &ret, 3);
             if (filebuf) {
                 mrp_pushlstring(L, filebuf, ret);
-                MR_FREE(filebuf, ret);
+                _mr_readFileRelease(filebuf, ret);
             } else {
                 mrp_pushnil(L);
             }
@@ -3582,6 +5553,29 @@ int _mr_TestCom1(mrp_State* L, int input0, char* input1, int32 len) {
         case 900:
             ret = mr_platEx(200001, (uint8*)_mr_c_port_table, sizeof(_mr_c_port_table), NULL, NULL, NULL);
             break;
+        case 413: {  // 把采样结果以folded stack格式写入文件input1
+            mrp_State* S = L ? L : vm_state;  // 本地代码调用时L为NULL
+            int32 f;
+            size_t outlen;
+            const char* out;
+            if ((S == NULL) || (input1 == NULL)) {
+                ret = MR_FAILED;
+                break;
+            }
+            mrp_profdump(S);
+            out = mrp_tostring(S, -1);
+            outlen = mrp_strlen(S, -1);
+            mr_remove(input1);
+            f = mr_open(input1, MR_FILE_WRONLY | MR_FILE_CREATE);
+            if (f == 0) {
+                ret = MR_FAILED;
+            } else {
+                ret = (mr_write(f, (void*)out, outlen) == (int32)outlen) ? MR_SUCCESS : MR_FAILED;
+                mr_close(f);
+            }
+            mrp_pop(S, 1);
+            break;
+        }
     }
 
     if (L) {
@@ -3604,9 +5598,18 @@ static mr_L_reg phonelib[5];
 static int32 _mr_intra_start(char* appExName, const char* entry) {
     int i, ret;
 
+    _mr_fmapClose();
     if (_mr_mem_init() != MR_SUCCESS) {
         return MR_FAILED;
     }
+    _mr_pdirReset();
+#ifdef MR_ACACHE
+    _mr_acacheReset();
+    LG_mem_reclaim = _mr_acacheReclaim;
+#endif
+#ifdef MR_PREFETCH
+    _mr_prefetchStart();
+#endif
     MRDBGPRINTF("Total memory:%d", LG_mem_len);
     dsm_prepare();
 
@@ -3673,10 +5676,13 @@ static int32 _mr_intra_start(char* appExName, const char* entry) {
     if (!vm_state) {
         return MR_FAILED;
     }
+    _mr_resetHandlers();
     LUADBGPRINTF("mr init ok");
+    mrp_setloadmode(vm_state, MRP_LOAD_LAZY | MRP_LOAD_ALIAS);
     mrp_open_base(vm_state);
     mrp_open_string(vm_state);
     mrp_open_table(vm_state);
+    mrp_open_array(vm_state);
     mrp_open_file(vm_state);
 
 #ifdef COMPATIBILITY01
@@ -3746,6 +5752,8 @@ static int32 _mr_intra_start(char* appExName, const char* entry) {
 
     LUADBGPRINTF("register");
     mr_L_openlib(vm_state, MRP_PHONELIBNAME, phonelib, 0);
+    _mr_bmpBufOpen(vm_state);
+    _mr_rstreamOpen(vm_state);
     LUADBGPRINTF("lib loaded");
 
     mrp_register(vm_state, "_loadPack", LoadPack);
@@ -3776,6 +5784,9 @@ static int32 _mr_intra_start(char* appExName, const char* entry) {
     mrp_register(vm_state, "_bmpDraw", MRF_BitmapDraw);
     mrp_register(vm_state, "_bmpGetScr", MRF_BmGetScr);
     mrp_register(vm_state, "_bmpInfo", MRF_BitmapInfo);
+    mrp_register(vm_state, "_bmpArray", MRF_BitmapArray);
+    mrp_register(vm_state, "_bmpBuf", MRF_BmpBuf);
+    mrp_register(vm_state, "_readStream", MRF_ReadStream);
 
     mrp_register(vm_state, "_exit", MRF_Exit);
     mrp_register(vm_state, "_effSetCon", MRF_EffSetCon);
@@ -3848,6 +5859,147 @@ static int32 _mr_intra_start(char* appExName, const char* entry) {
     return MR_SUCCESS;
 }
 
+/*
+多实例：当前实例的状态放在全局变量里，其他实例的放在各自的 mr_context 中，
+见 mr_context.h。
+*/
+static mr_context mr_context_default;
+static mr_context* mr_context_cur = &mr_context_default;
+
+static void _mr_context(mr_context* ctx, int save) {
+    MR_CONTEXT_MOVE(ctx, save, vm_state);
+    MR_CONTEXT_MOVE(ctx, save, mr_state);
+    MR_CONTEXT_MOVE(ctx, save, mr_screenBuf);
+    MR_CONTEXT_MOVE(ctx, save, mr_screen_w);
+    MR_CONTEXT_MOVE(ctx, save, mr_screen_h);
+    MR_CONTEXT_MOVE(ctx, save, mr_screen_bit);
+    MR_CONTEXT_MOVE(ctx, save, mr_bitmap);
+    MR_CONTEXT_MOVE(ctx, save, mr_tile);
+    MR_CONTEXT_MOVE(ctx, save, mr_map);
+    MR_CONTEXT_MOVE(ctx, save, mr_sound);
+    MR_CONTEXT_MOVE(ctx, save, mr_sprite);
+    MR_CONTEXT_MOVE(ctx, save, bi);
+    MR_CONTEXT_MOVE(ctx, save, pack_filename);
+    MR_CONTEXT_MOVE(ctx, save, start_filename);
+    MR_CONTEXT_MOVE(ctx, save, start_fileparameter);
+    MR_CONTEXT_MOVE(ctx, save, old_pack_filename);
+    MR_CONTEXT_MOVE(ctx, save, old_start_filename);
+    MR_CONTEXT_MOVE(ctx, save, mr_entry);
+#ifdef MR_CFG_USE_A_DISK
+    MR_CONTEXT_MOVE(ctx, save, temp_current_path);
+#endif
+    MR_CONTEXT_MOVE(ctx, save, mr_timer_p);
+    MR_CONTEXT_MOVE(ctx, save, mr_timer_state);
+    MR_CONTEXT_MOVE(ctx, save, mr_timer_run_without_pause);
+    MR_CONTEXT_MOVE(ctx, save, mr_dealevent_h);
+    MR_CONTEXT_MOVE(ctx, save, mr_timer_h);
+#ifdef MR_TRACE
+    MR_CONTEXT_MOVE(ctx, save, mr_trace_h);
+#endif
+    MR_CONTEXT_MOVE(ctx, save, mr_vmcall_count);
+    MR_CONTEXT_MOVE(ctx, save, mr_vmcall_errors);
+    MR_CONTEXT_MOVE(ctx, save, mr_vmcall_mark);
+    MR_CONTEXT_MOVE(ctx, save, mr_vmcall_marktime);
+    MR_CONTEXT_MOVE(ctx, save, mr_budget_limit);
+    MR_CONTEXT_MOVE(ctx, save, mr_budget_last);
+    MR_CONTEXT_MOVE(ctx, save, mr_budget_max);
+    MR_CONTEXT_MOVE(ctx, save, mr_budget_over);
+    MR_CONTEXT_MOVE(ctx, save, mr_exception_str);
+    MR_CONTEXT_MOVE(ctx, save, mr_ram_file);
+    MR_CONTEXT_MOVE(ctx, save, mr_ram_file_len);
+    MR_CONTEXT_MOVE(ctx, save, mr_soundOn);
+    MR_CONTEXT_MOVE(ctx, save, mr_shakeOn);
+#ifdef MR_PKZIP_MAGIC
+    MR_CONTEXT_MOVE(ctx, save, mr_zipType);
+#endif
+    MR_CONTEXT_MOVE(ctx, save, mr_load_c_function);
+    MR_CONTEXT_MOVE(ctx, save, mr_c_function);
+    MR_CONTEXT_MOVE(ctx, save, mr_c_function_P);
+    MR_CONTEXT_MOVE(ctx, save, mr_c_function_P_len);
+    MR_CONTEXT_MOVE(ctx, save, mr_c_function_fix_p);
+    MR_CONTEXT_MOVE(ctx, save, mr_event_function);
+    MR_CONTEXT_MOVE(ctx, save, mr_timer_function);
+    MR_CONTEXT_MOVE(ctx, save, mr_stop_function);
+    MR_CONTEXT_MOVE(ctx, save, mr_pauseApp_function);
+    MR_CONTEXT_MOVE(ctx, save, mr_resumeApp_function);
+    MR_CONTEXT_MOVE(ctx, save, mr_exit_cb);
+    MR_CONTEXT_MOVE(ctx, save, mr_exit_cb_data);
+    MR_CONTEXT_MOVE(ctx, save, mr_pdir_cache);
+    MR_CONTEXT_MOVE(ctx, save, mr_pdir_next);
+    MR_CONTEXT_MOVE(ctx, save, mr_fmap_tab);
+#ifdef MR_ACACHE
+    MR_CONTEXT_MOVE(ctx, save, mr_acache_head);
+    MR_CONTEXT_MOVE(ctx, save, mr_acache_tail);
+    MR_CONTEXT_MOVE(ctx, save, mr_acache_used);
+    MR_CONTEXT_MOVE(ctx, save, mr_acache_budget);
+    MR_CONTEXT_MOVE(ctx, save, mr_acache_hit);
+    MR_CONTEXT_MOVE(ctx, save, mr_acache_miss);
+    MR_CONTEXT_MOVE(ctx, save, mr_acache_saved);
+#endif
+#ifdef MR_PREFETCH
+    MR_CONTEXT_MOVE(ctx, save, mr_prefetch);
+    MR_CONTEXT_MOVE(ctx, save, mr_prefetch_on);
+    MR_CONTEXT_MOVE(ctx, save, mr_prefetch_count);
+    MR_CONTEXT_MOVE(ctx, save, mr_prefetch_bytes);
+#endif
+#ifdef MR_PCACHE
+    MR_CONTEXT_MOVE(ctx, save, mr_pcache_on);
+    MR_CONTEXT_MOVE(ctx, save, mr_pcache_hit);
+    MR_CONTEXT_MOVE(ctx, save, mr_pcache_miss);
+#endif
+    _mr_mem_context(ctx, save);
+}
+
+int32 mr_contextSize(void) {
+    return sizeof(mr_context);
+}
+
+/*把 ctx 初始化为一个没有运行应用的实例*/
+void mr_contextInit(mr_context* ctx) {
+    MEMSET(ctx, 0, sizeof(mr_context));
+    ctx->mr_state = MR_STATE_IDLE;
+    ctx->mr_timer_state = MR_TIMER_STATE_IDLE;
+    ctx->mr_timer_run_without_pause = FALSE;
+    ctx->mr_dealevent_h.ref = MRP_NOREF;
+    ctx->mr_timer_h.ref = MRP_NOREF;
+#ifdef MR_TRACE
+    ctx->mr_trace_h.ref = MRP_NOREF;
+#endif
+#ifdef MR_PCACHE
+    ctx->mr_pcache_on = TRUE;
+#endif
+#ifdef MR_ACACHE
+    ctx->mr_acache_budget = MR_ACACHE_SIZE;
+#endif
+#ifdef MR_PREFETCH
+    ctx->mr_prefetch_on = TRUE;
+#endif
+}
+
+/*
+切换到 ctx 表示的实例，NULL 表示启动时的那个实例，返回之前的实例；
+在虚拟机调用中（例如从插件的回调里）不能切换，返回 NULL。
+*/
+mr_context* mr_contextSwitch(mr_context* ctx) {
+    mr_context* old = mr_context_cur;
+    if (ctx == NULL) {
+        ctx = &mr_context_default;
+    }
+    if (mr_vmcall_depth > 0) {
+        return NULL;
+    }
+    if (ctx != old) {
+        _mr_context(old, TRUE);
+        _mr_context(ctx, FALSE);
+        mr_context_cur = ctx;
+    }
+    return old;
+}
+
+mr_context* mr_contextCurrent(void) {
+    return mr_context_cur;
+}
+
 /*当启动DSM应用的时候，应该调用DSM的初始化函数， 用以对DSM平台进行初始化*/
 int32 mr_start_dsm(char* filename, char* ext, char* entry) {
     mr_screeninfo screeninfo;
@@ -3896,7 +6048,7 @@ int32 mr_stop_ex(int16 freemem) {
     }
 
     if ((mr_state == MR_STATE_RUN) || (mr_state == MR_STATE_PAUSE)) {
-        mrp_getglobal(vm_state, "dealevent");
+        _mr_pushHandler(&mr_dealevent_h, "dealevent");
         if (mrp_isfunction(vm_state, -1)) {
             mrp_pushnumber(vm_state, MR_EXIT_EVENT);
             _mr_pcall(1, 0);
@@ -3938,7 +6090,16 @@ int32 mr_stop_ex(int16 freemem) {
     }
 #endif
 
+#ifdef MR_PREFETCH
+    _mr_prefetchClose();
+#endif
     if (freemem) {
+        _mr_fmapClose();
+        _mr_pdirReset();
+#ifdef MR_ACACHE
+        _mr_acacheReset();
+        LG_mem_reclaim = NULL;
+#endif
         mr_mem_free(Origin_LG_mem_base, Origin_LG_mem_len);
     }
     //mr_timerStop();
@@ -4066,7 +6227,7 @@ int32 mr_event(int16 type, int32 param1, int32 param2) {
                 return status;
         }
 
-        mrp_getglobal(vm_state, "dealevent");
+        _mr_pushHandler(&mr_dealevent_h, "dealevent");
         if (mrp_isfunction(vm_state, -1)) {
             mrp_pushnumber(vm_state, type);
             mrp_pushnumber(vm_state, param1);
@@ -4126,7 +6287,8 @@ int32 mr_timer(void) {
             return status;
     }
 
-    mrp_getglobal(vm_state, (char*)mr_timer_p);
+    _mr_renameHandler(&mr_timer_h, (const char*)mr_timer_p);
+    _mr_pushHandler(&mr_timer_h, (const char*)mr_timer_p);
     if (mrp_isfunction(vm_state, -1)) {
 #if 0
       int status;
@@ -4158,6 +6320,19 @@ int32 mr_timer(void) {
     return MR_SUCCESS;
 }
 
+/*
+平台空闲时(没有事件、定时器没到)调用，做一点后台工作，现在是启动预读；
+还有要做的返回 MR_SUCCESS，平台可以马上再调用，否则返回 MR_IGNORE
+*/
+int32 mr_idle(void) {
+#ifdef MR_PREFETCH
+    if ((mr_state == MR_STATE_RUN) || (mr_state == MR_STATE_PAUSE)) {
+        return _mr_prefetchStep();
+    }
+#endif
+    return MR_IGNORE;
+}
+
 int32 mr_registerAPP(uint8* p, int32 len, int32 index) {
     if (index < (sizeof(mr_m0_files) / sizeof(uint8*))) {
         mr_m0_files[index] = p;
@@ -4770,7 +6945,7 @@ static int32 _mr_smsIndiaction(uint8* pContent, int32 nLen, uint8* pNum, int32 t
 
     if ((mr_state == MR_STATE_RUN) || ((mr_timer_run_without_pause) && (mr_state == MR_STATE_PAUSE))) {
         // int status;
-        mrp_getglobal(vm_state, "dealevent");
+        _mr_pushHandler(&mr_dealevent_h, "dealevent");
         if (mrp_isfunction(vm_state, -1)) {
             mrp_pushnumber(vm_state, MR_SMS_INDICATION);
             mrp_pushlstring(vm_state, (const char*)pContent, nLen);
@@ -5253,6 +7428,21 @@ void mythroad_init(void) {
     phonelib[3].name = "wap", phonelib[3].func = ConnectWAP;
     phonelib[4].name = NULL, phonelib[4].func = NULL;
 
+    bmpbuflib[0].name = "size", bmpbuflib[0].func = MRF_BmpBufSize;
+    bmpbuflib[1].name = "get", bmpbuflib[1].func = MRF_BmpBufGet;
+    bmpbuflib[2].name = "set", bmpbuflib[2].func = MRF_BmpBufSet;
+    bmpbuflib[3].name = "read", bmpbuflib[3].func = MRF_BmpBufRead;
+    bmpbuflib[4].name = "write", bmpbuflib[4].func = MRF_BmpBufWrite;
+    bmpbuflib[5].name = "fill", bmpbuflib[5].func = MRF_BmpBufFill;
+    bmpbuflib[6].name = "blend", bmpbuflib[6].func = MRF_BmpBufBlend;
+    bmpbuflib[7].name = "map", bmpbuflib[7].func = MRF_BmpBufMap;
+    bmpbuflib[8].name = NULL, bmpbuflib[8].func = NULL;
+    rstreamlib[0].name = "read", rstreamlib[0].func = MRF_ReadStreamRead;
+    rstreamlib[1].name = "size", rstreamlib[1].func = MRF_ReadStreamSize;
+    rstreamlib[2].name = "close", rstreamlib[2].func = MRF_ReadStreamClose;
+    rstreamlib[3].name = "__gc", rstreamlib[3].func = MRF_ReadStreamClose;
+    rstreamlib[4].name = NULL, rstreamlib[4].func = NULL;
+
     _mr_c_internal_table_init();
     _mr_c_function_table_init();
 }
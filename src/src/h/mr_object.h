@@ -223,6 +223,8 @@ typedef struct Proto {
   int sizelocvars;
   int lineDefined;
   GCObject *gclist;
+  struct Ubuffer *ubuf;  /* chunk holding the body (if not loaded yet) or `code' */
+  size_t ubpos;  /* offset of the body in `ubuf' */
   lu_byte nups;  /* number of upvalues */
   lu_byte numparams;
   lu_byte is_vararg;
@@ -326,6 +328,9 @@ int mr_O_int2fb (unsigned int x);
 
 int mr_O_rawequalObj (const TObject *t1, const TObject *t2);
 int mr_O_str2d (const char *s, mrp_Number *result);
+#ifdef USE_INT
+int mr_O_num2str (char *s, mrp_Number n);
+#endif
 
 const char *mr_O_pushvfstring (mrp_State *L, const char *fmt, va_list argp);
 const char *mr_O_pushfstring (mrp_State *L, const char *fmt, ...);
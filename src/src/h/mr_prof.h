@@ -0,0 +1,60 @@
+
+
+#ifndef mr_prof_h
+#define mr_prof_h
+
+
+#include "mr_object.h"
+#include "mr_opcodes.h"
+
+
+/*
+** internal hook bit (above the public MRP_MASK* bits): while it is set,
+** `mr_V_execute' calls `mr_R_tick' before every instruction
+*/
+#define MRP_MASKPROF	(1 << 4)
+
+/*
+** internal hook bit: while it is set, `mr_V_execute' charges every
+** instruction to the budget in the global state (see `mrp_setbudget')
+*/
+#define MRP_MASKBUDGET	(1 << 5)
+
+/* hook bits not visible through `mrp_sethook'/`mrp_gethookmask' */
+#define MRP_MASKINTERNAL	(MRP_MASKPROF | MRP_MASKBUDGET)
+
+/* innermost frames kept for each sample */
+#define PROF_MAXDEPTH	12
+
+/* default size of the sample ring */
+#define PROF_NSAMPLES	256
+
+
+typedef struct ProfFrame {
+  TString *source;  /* chunk name; NULL for C functions */
+  int linedefined;
+  int currentline;
+} ProfFrame;
+
+
+typedef struct Profiler {
+  int period;  /* instructions between samples (0: only when signaled) */
+  int count;  /* instructions left until next sample */
+  volatile int pending;  /* sample requested by `mrp_profsignal' */
+  lu_byte on;
+  lu_byte flags;  /* MRP_PROF_* */
+  int nsamples;  /* size of the ring */
+  int next;  /* next slot to be written */
+  lu_mem taken;  /* samples taken so far (may exceed `nsamples') */
+  lu_byte *depth;  /* number of frames in each sample */
+  ProfFrame *frames;  /* `nsamples' * PROF_MAXDEPTH frames, innermost first */
+  lu_mem ops[NUM_OPCODES];  /* executed instructions, by opcode */
+} Profiler;
+
+
+void mr_R_tick (mrp_State *L);
+void mr_R_free (mrp_State *L);
+void mr_R_overbudget (mrp_State *L);
+
+
+#endif
@@ -110,6 +110,11 @@ typedef struct global_State {
   Mbuffer buff;  /* temporary buffer for string concatentation */
   lu_mem GCthreshold;
   lu_mem nblocks;  /* number of `bytes' currently allocated */
+  lu_byte loadmode;  /* MRP_LOAD_* options for `mrp_loadchunk' */
+  lu_mem stripped;  /* bytes of debug info dropped by MRP_LOAD_STRIP */
+  struct Profiler *prof;  /* sampling profiler (see mr_prof.c) or NULL */
+  int budget;  /* instructions allowed per period (0: no budget) */
+  volatile int budgetleft;  /* left in this period; < 0 once exceeded */
   mrp_CFunction panic;  /* to be called in unprotected errors */
   TObject _registry;
   TObject _defaultmeta;
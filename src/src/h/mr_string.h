@@ -23,6 +23,8 @@ void mr_S_resize (mrp_State *L, int newsize);
 Udata *mr_S_newudata (mrp_State *L, size_t s);
 void mr_S_freeall (mrp_State *L);
 TString *mr_S_newlstr (mrp_State *L, const char *str, size_t l);
+TString *mr_S_newraw (mrp_State *L, size_t l);
+TString *mr_S_intern (mrp_State *L, TString *ts);
 
 TString *_mr_newlstr_without_malloc (mrp_State *L, uint8 *str, size_t l);
 
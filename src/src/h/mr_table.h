@@ -18,6 +18,7 @@
 const TObject *mr_H_getnum (Table *t, int key);
 TObject *mr_H_setnum (mrp_State *L, Table *t, int key);
 const TObject *mr_H_getstr (Table *t, TString *key);
+Node *mr_H_getstrnode (Table *t, TString *key);
 const TObject *mr_H_get (Table *t, const TObject *key);
 TObject *mr_H_set (mrp_State *L, Table *t, const TObject *key);
 Table *mr_H_new (mrp_State *L, int narray, int lnhash);
@@ -5,9 +5,32 @@
 #include "mr_object.h"
 #include "mr_zio.h"
 
+/*
+** binary chunk kept in memory after loading, so that lazily loaded
+** functions (see MRP_LOAD_LAZY) can be undumped on first use and code
+** arrays can be used in place (see MRP_LOAD_ALIAS)
+*/
+typedef struct Ubuffer {
+  char *data;
+  size_t size;
+  int ref;  /* loader + protos still reading from `data' */
+  lu_byte mode;
+} Ubuffer;
+
 /* load one chunk; from lundump.c */
 Proto* mr_U_undump (mrp_State* L, ZIO* Z, Mbuffer* buff);
 
+/* chunk buffers; from lundump.c */
+Ubuffer* mr_U_newbuffer (mrp_State* L, char* data, size_t size, int mode);
+void mr_U_unrefbuffer (mrp_State* L, Ubuffer* ub);
+const char* mr_U_chunkreader (mrp_State* L, void* ud, size_t* size);
+
+/* load the body of a lazily loaded function; from lundump.c */
+void mr_U_loadlazy (mrp_State* L, Proto* f);
+void mr_U_loadall (mrp_State* L, Proto* f);
+#define mr_U_islazy(f)	((f)->ubuf != NULL && (f)->sizecode == 0)
+#define mr_U_checklazy(L,f)	{ if (mr_U_islazy(f)) mr_U_loadlazy(L, f); }
+
 /* find byte order; from lundump.c */
 int mr_U_endianness (void);
 
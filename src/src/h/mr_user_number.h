@@ -26,7 +26,7 @@
 #define MRP_NUMBER_FMT		"%d"
 #define mrp_str2number(s,p)     ((int) STRTOL((s), (p), 10))  
 //ouli brew need change
-#define mrp_number2str(s,n)     SPRINTF((s), MRP_NUMBER_FMT, (n))
+#define mrp_number2str(s,n)     mr_O_num2str((s), (n))  /* see mr_object.c */
 //ouli brew
 #endif
 
@@ -17,6 +17,7 @@
 	(ttype(o1) == ttype(o2) && mr_V_equalval(L, o1, o2))
 
 
+int mr_V_strcmp (const TString *ls, const TString *rs);
 int mr_V_lessthan (mrp_State *L, const TObject *l, const TObject *r);
 int mr_V_equalval (mrp_State *L, const TObject *t1, const TObject *t2);
 const TObject *mr_V_tonumber (const TObject *obj, TObject *n);
@@ -0,0 +1,333 @@
+
+
+//#define larraylib_c
+
+
+#include "../../include/mr_auxlib.h"
+#include "../../include/mr_lib.h"
+
+#include "../h/mr_limits.h"
+
+
+/*
+** {======================================================
+** TYPED ARRAYS
+** fixed-size blocks of int8/uint8/int16/uint16/int32 in one userdata:
+** 1-4 bytes per element instead of a TObject (plus a Node in the hash
+** part) per slot, bounds-checked `a[i]' through the metatable, and
+** bulk fill/copy/slice done in C; uint16 arrays hold pixels that the
+** bitmap functions take directly
+** =======================================================
+*/
+
+#define ARRAY		"array"
+
+typedef struct Array {
+  int type;
+  int n;
+} Array;
+
+#define arrdata(a)	(cast(char *, (a) + 1))
+
+/* the metatable of arrays is the first upvalue of all functions below */
+#define ARRAYMETA	mrp_upvalueindex(1)
+
+static const char *arrtypes[MRP_ARRAY_NTYPES + 1];
+static const int arrsizes[MRP_ARRAY_NTYPES] = {1, 1, 2, 2, 4};
+
+
+static Array *newarray (mrp_State *L, int type, int n) {
+  Array *a;
+  if (n < 0 || n > (MAX_INT - cast(int, sizeof(Array))) / 4)
+    mr_L_error(L, "array size %d out of range", n);
+  a = (Array *)mrp_newuserdata(L, sizeof(Array) + n * arrsizes[type]);
+  a->type = type;
+  a->n = n;
+  MEMSET(arrdata(a), 0, n * arrsizes[type]);
+  return a;
+}
+
+
+/* `a' is an array if its metatable is the one on the stack at `meta' */
+static Array *toarray (mrp_State *L, int idx, int meta) {
+  Array *a = NULL;
+  if (mrp_getmetatable(L, idx)) {
+    if (mrp_rawequal(L, -1, meta))
+      a = (Array *)mrp_touserdata(L, idx);
+    mrp_pop(L, 1);
+  }
+  return a;
+}
+
+
+static Array *checkarray (mrp_State *L, int idx) {
+  Array *a = toarray(L, idx, ARRAYMETA);
+  if (a == NULL) mr_L_typerror(L, idx, ARRAY);
+  return a;
+}
+
+
+static mrp_Number getelem (const Array *a, int i) {
+  const char *p = arrdata(a);
+  switch (a->type) {
+    case MRP_ARRAY_INT8: return cast(signed char *, p)[i];
+    case MRP_ARRAY_UINT8: return cast(uint8 *, p)[i];
+    case MRP_ARRAY_INT16: return cast(int16 *, p)[i];
+    case MRP_ARRAY_UINT16: return cast(uint16 *, p)[i];
+    default: return cast(int32 *, p)[i];
+  }
+}
+
+
+static void setelem (Array *a, int i, mrp_Number v) {
+  char *p = arrdata(a);
+  switch (a->type) {
+    case MRP_ARRAY_INT8: cast(signed char *, p)[i] = cast(signed char, v); break;
+    case MRP_ARRAY_UINT8: cast(uint8 *, p)[i] = cast(uint8, v); break;
+    case MRP_ARRAY_INT16: cast(int16 *, p)[i] = cast(int16, v); break;
+    case MRP_ARRAY_UINT16: cast(uint16 *, p)[i] = cast(uint16, v); break;
+    default: cast(int32 *, p)[i] = cast(int32, v); break;
+  }
+}
+
+
+static int checktype (mrp_State *L, int narg) {
+  const char *name = mr_L_checkstring(L, narg);
+  int i;
+  for (i = 0; i < MRP_ARRAY_NTYPES; i++)
+    if (STRCMP(arrtypes[i], name) == 0) return i;
+  return mr_L_argerror(L, narg,
+                       mrp_pushfstring(L, "invalid array type `%s'", name));
+}
+
+
+/* range [i, j] of arguments `narg' and `narg'+1, 0-based; negative
+   positions count from the end; returns the number of elements */
+static int getrange (mrp_State *L, const Array *a, int narg, int *i) {
+  int first = mr_L_optint(L, narg, 1);
+  int last = mr_L_optint(L, narg + 1, -1);
+  if (first < 0) first += a->n + 1;
+  if (last < 0) last += a->n + 1;
+  if (first < 1) first = 1;
+  if (last > a->n) last = a->n;
+  *i = first - 1;
+  return (last >= first) ? last - first + 1 : 0;
+}
+
+
+/*
+** array.new(type, n [, v]) - `n' elements set to `v' (default 0)
+** array.new(type, t)       - the elements t[1..getn(t)]
+** array.new(type, s)       - the raw bytes of string `s'
+*/
+static int arr_new (mrp_State *L) {
+  int type = checktype(L, 1);
+  Array *a;
+  int i;
+  switch (mrp_type(L, 2)) {
+    case MRP_TTABLE: {
+      int n = mr_L_getn(L, 2);
+      a = newarray(L, type, n);
+      for (i = 0; i < n; i++) {
+        mrp_rawgeti(L, 2, i + 1);
+        setelem(a, i, mrp_tonumber(L, -1));
+        mrp_pop(L, 1);
+      }
+      break;
+    }
+    case MRP_TSTRING: {
+      const char *s = mrp_tostring(L, 2);
+      size_t l = mrp_strlen(L, 2);
+      if (l % arrsizes[type] != 0)
+        mr_L_argerror(L, 2, "length is not a multiple of the element size");
+      a = newarray(L, type, cast(int, l / arrsizes[type]));
+      MEMCPY(arrdata(a), s, l);
+      break;
+    }
+    default: {
+      mrp_Number v = mr_L_optnumber(L, 3, 0);
+      a = newarray(L, type, mr_L_checkint(L, 2));
+      if (v != 0)
+        for (i = 0; i < a->n; i++) setelem(a, i, v);
+      break;
+    }
+  }
+  mrp_pushvalue(L, ARRAYMETA);
+  mrp_setmetatable(L, -2);
+  return 1;
+}
+
+
+static int arr_index (mrp_State *L) {
+  Array *a = checkarray(L, 1);
+  if (mrp_type(L, 2) == MRP_TNUMBER) {
+    int i = cast(int, mrp_tonumber(L, 2)) - 1;
+    if (cast(unsigned int, i) >= cast(unsigned int, a->n))
+      mr_L_error(L, "array index %d out of range (1..%d)", i + 1, a->n);
+    mrp_pushnumber(L, getelem(a, i));
+  }
+  else {  /* a method */
+    mrp_pushvalue(L, 2);
+    mrp_rawget(L, ARRAYMETA);
+  }
+  return 1;
+}
+
+
+static int arr_newindex (mrp_State *L) {
+  Array *a = checkarray(L, 1);
+  int i = mr_L_checkint(L, 2) - 1;
+  if (cast(unsigned int, i) >= cast(unsigned int, a->n))
+    mr_L_error(L, "array index %d out of range (1..%d)", i + 1, a->n);
+  setelem(a, i, mr_L_checknumber(L, 3));
+  return 0;
+}
+
+
+static int arr_len (mrp_State *L) {
+  mrp_pushnumber(L, checkarray(L, 1)->n);
+  return 1;
+}
+
+
+static int arr_type (mrp_State *L) {
+  mrp_pushstring(L, arrtypes[checkarray(L, 1)->type]);
+  return 1;
+}
+
+
+/* a:fill(v [, i [, j]]) */
+static int arr_fill (mrp_State *L) {
+  Array *a = checkarray(L, 1);
+  mrp_Number v = mr_L_checknumber(L, 2);
+  int i;
+  int n = getrange(L, a, 3, &i);
+  if (arrsizes[a->type] == 1 || v == 0)
+    MEMSET(arrdata(a) + i * arrsizes[a->type], cast(uint8, v),
+           n * arrsizes[a->type]);
+  else
+    for (n += i; i < n; i++) setelem(a, i, v);
+  mrp_settop(L, 1);
+  return 1;
+}
+
+
+/* a:copy(src [, i [, j [, to]]]) - src[i..j] into `a' from index `to' */
+static int arr_copy (mrp_State *L) {
+  Array *a = checkarray(L, 1);
+  Array *src = checkarray(L, 2);
+  int i, to;
+  int n = getrange(L, src, 3, &i);
+  to = mr_L_optint(L, 5, 1) - 1;
+  mr_L_argcheck(L, src->type == a->type, 2, "array types differ");
+  mr_L_argcheck(L, to >= 0 && to <= a->n, 5, "out of range");
+  if (n > a->n - to) n = a->n - to;
+  MEMMOVE(arrdata(a) + to * arrsizes[a->type],
+          arrdata(src) + i * arrsizes[a->type], n * arrsizes[a->type]);
+  mrp_settop(L, 1);
+  return 1;
+}
+
+
+/* a:slice([i [, j]]) - a new array with a copy of a[i..j] */
+static int arr_slice (mrp_State *L) {
+  Array *a = checkarray(L, 1);
+  int i;
+  int n = getrange(L, a, 2, &i);
+  Array *b = newarray(L, a->type, n);
+  MEMCPY(arrdata(b), arrdata(a) + i * arrsizes[a->type],
+         n * arrsizes[a->type]);
+  mrp_pushvalue(L, ARRAYMETA);
+  mrp_setmetatable(L, -2);
+  return 1;
+}
+
+
+/* a:bytes([i [, j]]) - the raw bytes of a[i..j] as a string */
+static int arr_bytes (mrp_State *L) {
+  Array *a = checkarray(L, 1);
+  int i;
+  int n = getrange(L, a, 2, &i);
+  mrp_pushlstring(L, arrdata(a) + i * arrsizes[a->type],
+                  n * arrsizes[a->type]);
+  return 1;
+}
+
+
+/* a:table([i [, j]]) - the elements of a[i..j] in a new table */
+static int arr_table (mrp_State *L) {
+  Array *a = checkarray(L, 1);
+  int i, k;
+  int n = getrange(L, a, 2, &i);
+  mrp_newtable(L);
+  for (k = 0; k < n; k++) {
+    mrp_pushnumber(L, getelem(a, i + k));
+    mrp_rawseti(L, -2, k + 1);
+  }
+  mr_L_setn(L, -1, n);
+  return 1;
+}
+
+
+MRPLIB_API void *mr_L_toarray (mrp_State *L, int idx, int type, int *n) {
+  Array *a;
+  if (idx < 0 && idx > MRP_REGISTRYINDEX) idx = mrp_gettop(L) + idx + 1;
+  mr_L_getmetatable(L, ARRAY);
+  a = toarray(L, idx, mrp_gettop(L));
+  mrp_pop(L, 1);
+  if (a == NULL || (type >= 0 && a->type != type)) return NULL;
+  if (n) *n = a->n;
+  return arrdata(a);
+}
+
+
+MRPLIB_API void *mr_L_newarray (mrp_State *L, int type, int n) {
+  Array *a = newarray(L, type, n);
+  mr_L_getmetatable(L, ARRAY);
+  mrp_setmetatable(L, -2);
+  return arrdata(a);
+}
+
+/* }====================================================== */
+
+
+static mr_L_reg arraylib[2];
+static mr_L_reg arraymeta[10];
+
+void mr_arraylib_init(void) {
+ arrtypes[MRP_ARRAY_INT8] = "int8";
+ arrtypes[MRP_ARRAY_UINT8] = "uint8";
+ arrtypes[MRP_ARRAY_INT16] = "int16";
+ arrtypes[MRP_ARRAY_UINT16] = "uint16";
+ arrtypes[MRP_ARRAY_INT32] = "int32";
+ arrtypes[MRP_ARRAY_NTYPES] = NULL;
+
+ arraylib[0].name = "new"; arraylib[0].func =  arr_new;
+ arraylib[1].name = NULL; arraylib[1].func =  NULL;
+
+ arraymeta[0].name = "__index"; arraymeta[0].func =  arr_index;
+ arraymeta[1].name = "__newindex"; arraymeta[1].func =  arr_newindex;
+ arraymeta[2].name = "len"; arraymeta[2].func =  arr_len;
+ arraymeta[3].name = "type"; arraymeta[3].func =  arr_type;
+ arraymeta[4].name = "fill"; arraymeta[4].func =  arr_fill;
+ arraymeta[5].name = "copy"; arraymeta[5].func =  arr_copy;
+ arraymeta[6].name = "slice"; arraymeta[6].func =  arr_slice;
+ arraymeta[7].name = "bytes"; arraymeta[7].func =  arr_bytes;
+ arraymeta[8].name = "table"; arraymeta[8].func =  arr_table;
+ arraymeta[9].name = NULL; arraymeta[9].func =  NULL;
+}
+
+/*
+** Open array library
+*/
+MRPLIB_API int mrp_open_array (mrp_State *L) {
+  mr_L_newmetatable(L, ARRAY);
+  mrp_pushliteral(L, "__metatable");
+  mrp_pushliteral(L, ARRAY);
+  mrp_rawset(L, -3);  /* getmetatable(a) gives only the name */
+  mrp_pushvalue(L, -1);
+  mr_L_openlib(L, NULL, arraymeta, 1);
+  mr_L_openlib(L, MRP_ARRAYLIBNAME, arraylib, 1);
+  LUADBGPRINTF("array lib");
+  return 1;
+}
@@ -571,7 +571,7 @@ MRPLIB_API int mr_L_loadfile (mrp_State *L, const char *filename) {
 //  int c;
    int fnameindex = mrp_gettop(L) + 1;  /* index of filename on the stack */
    void* buff;
-   int filelen;
+   int filelen, stripped;
    
    LUADBGPRINTF("mr_L_loadfile sart");
 
@@ -579,7 +579,7 @@ MRPLIB_API int mr_L_loadfile (mrp_State *L, const char *filename) {
    mrp_pushfstring(L, "@%s", filename);
    
 //  change for zip
-   buff = _mr_readFile((const char *)filename, &filelen, 0);
+   buff = _mr_readFile((const char *)filename, &filelen, 4);  /* a script */
 
    if (!buff)
       {
@@ -589,13 +589,12 @@ MRPLIB_API int mr_L_loadfile (mrp_State *L, const char *filename) {
       return errfile(L, fnameindex);
       }
 
-   {
-      LoadS ls;
-      ls.s = buff;
-      ls.size = filelen;
-      status = mrp_load(L, getS, &ls, mrp_tostring(L, -1));
-   }
-   MR_FREE(buff, filelen);
+   /* the buffer is owned by the VM from here on */
+   stripped = mrp_getstripped(L);
+   status = mrp_loadchunk(L, (char *)buff, filelen, mrp_tostring(L, -1));
+   stripped = mrp_getstripped(L) - stripped;
+   if (stripped > 0)
+      MRDBGPRINTF("%s: %d bytes of debug info stripped", filename, stripped);
    LUADBGPRINTF("after free");
    readstatus = 0;
 
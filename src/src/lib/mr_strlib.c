@@ -13,6 +13,7 @@
 #include "../h/mr_string.h"
 #include "../h/mr_gc.h"
 #include "../h/mr_mem.h"
+#include "../h/mr_zio.h"
 
 
 /* macro to `unsign' a character */
@@ -93,6 +94,8 @@ int mr_ispunct(int ch) {
 ** s - zero-terminated string
 ** f - float
 ** d - doulbe
+**
+** `unpackN' unpacks many records of the same format in one call.
 */
 
 
@@ -168,53 +171,226 @@ static int getalign (const char **fmt) {
   }
 }
 
-static int gettoalign (mrp_State *L, int align, int opt, int size) {
+/* alignment of an item, or 0 when it is not a power of 2 */
+static int toalignof (int align, int opt, int size) {
   int toalign = (opt == 'c' || opt == 's' || opt == 'p') ? 1 : size;
   if (toalign > align) toalign = align;
   if (toalign == 0 || (toalign & (toalign - 1)) != 0)
-    mr_L_error(L, "alignment must be 2^n");
+    return 0;
   return toalign;
 }
 
-static void putinteger (mrp_State *L, mr_L_Buffer *b, int arg, int endian,
-                        int size) {
-  unsigned char buff[sizeof(long)];
-  mrp_Number n = mr_L_checknumber(L, arg);
-  unsigned long value;
-  unsigned char *s;
-  int inc, i;
-  if (n < 0) {
-    value = (unsigned long)(-n);
-    value = (~value) + 1;  /* 2's complement */
+
+/*
+** Compiled formats.
+** A format is parsed once into items with their sizes and alignments
+** worked out; a run of the same integer code ("HHHH") becomes a single
+** item, which is converted by one fixed-width loop.  Errors in a format
+** are kept in its items and raised only when the item is reached, as
+** the interpreter did.  The last PACKCACHE formats are kept, least
+** recently used first out.
+*/
+
+#define PACKCACHE	8
+#define MAXPACKFMT	64  /* longer formats are compiled on each call */
+
+typedef struct PackItem {
+  int opt;
+  int size;  /* size of one value */
+  int toalign;  /* 0: invalid alignment */
+  int count;  /* repetitions (runs of integer codes) */
+} PackItem;
+
+typedef struct PackFmt {
+  size_t len;  /* format length; items and format follow this header */
+  lu_mem size;  /* size of the whole block */
+  unsigned long lastuse;
+  int endian;
+  int nitems;
+  int nvalues;  /* values unpacked from one record */
+  PackItem *item;
+} PackFmt;
+
+typedef struct PackCache {
+  PackFmt *slot[PACKCACHE];
+  unsigned long clock;
+} PackCache;
+
+#define packfmtsize(l)	(sizeof(PackFmt) + (l)*sizeof(PackItem) + (l)+1)
+#define fmtstr(pf)	(cast(const char *, (pf)->item + (pf)->len))
+
+#define isintcode(c)	((c) == 'b' || (c) == 'B' || (c) == 'h' || (c) == 'H' || \
+                         (c) == 'l' || (c) == 'L' || (c) == 'i' || (c) == 'I')
+
+
+static void compileformat (PackFmt *pf, const char *fmt, size_t l) {
+  int native, align;
+  PackItem *last = NULL;
+  pf->len = l;
+  pf->size = packfmtsize(l);
+  pf->lastuse = 0;
+  pf->item = cast(PackItem *, pf + 1);
+  MEMCPY(cast(char *, pf->item + l), fmt, l+1);
+  pf->endian = getendianess(&fmt, &native);
+  align = getalign(&fmt);
+  pf->nitems = 0;
+  pf->nvalues = 0;
+  while (*fmt) {
+    int opt = *fmt++;
+    int size = optsize(opt, &fmt);
+    int toalign = toalignof(align, opt, size);
+    if (isintcode(opt) || opt == 'c' || opt == 's' || opt == 'p')
+      pf->nvalues++;
+    if (last != NULL && isintcode(opt) && last->opt == opt &&
+        last->size == size && toalign != 0 && size % toalign == 0) {
+      last->count++;  /* no padding between them: extend the run */
+      continue;
+    }
+    last = &pf->item[pf->nitems++];
+    last->opt = opt;
+    last->size = size;
+    last->toalign = toalign;
+    last->count = 1;
   }
-  else
-    value = (unsigned long)n;
-  if (endian == 0) {
-    inc = 1;
-    s = buff;
+}
+
+
+/*
+** returns the compiled format `fmt', from the cache at stack index
+** `cache' when possible; formats that are not cached are compiled into
+** a new userdata, left on the top of the stack
+*/
+static const PackFmt *getpackfmt (mrp_State *L, int cache, const char *fmt,
+                                  size_t l) {
+  PackCache *pc = (PackCache *)mrp_touserdata(L, cache);
+  PackFmt *pf;
+  int i, victim = 0;
+  if (pc == NULL || l > MAXPACKFMT) {
+    pf = (PackFmt *)mrp_newuserdata(L, packfmtsize(l));
+    compileformat(pf, fmt, l);
+    return pf;
   }
-  else {
-    inc = -1;
-    s = buff+(size-1);
+  for (i = 0; i < PACKCACHE; i++) {
+    pf = pc->slot[i];
+    if (pf == NULL) {
+      victim = i;
+      continue;
+    }
+    if (pf->len == l && MEMCMP(fmtstr(pf), fmt, l) == 0) {
+      pf->lastuse = ++pc->clock;
+      return pf;
+    }
+    if (pc->slot[victim] != NULL && pf->lastuse < pc->slot[victim]->lastuse)
+      victim = i;
   }
-  for (i=0; i<size; i++) {
-    *s = (unsigned char)(value & 0xff);
-    s += inc;
-    value >>= 8;
+  pf = (PackFmt *)mr_M_malloc(L, packfmtsize(l));
+  compileformat(pf, fmt, l);
+  if (pc->slot[victim] != NULL)
+    mr_M_free(L, pc->slot[victim], pc->slot[victim]->size);
+  pf->lastuse = ++pc->clock;
+  pc->slot[victim] = pf;
+  return pf;
+}
+
+
+static const PackFmt *checkpackfmt (mrp_State *L, int narg) {
+  size_t l;
+  const char *fmt = mr_L_checklstring(L, narg, &l);
+  return getpackfmt(L, mrp_upvalueindex(2), fmt, l);
+}
+
+
+static int packcache_gc (mrp_State *L) {
+  PackCache *pc = (PackCache *)mrp_touserdata(L, 1);
+  int i;
+  for (i = 0; i < PACKCACHE; i++) {
+    if (pc->slot[i] != NULL) {
+      mr_M_free(L, pc->slot[i], pc->slot[i]->size);
+      pc->slot[i] = NULL;
+    }
   }
-  mr_L_addlstring(b, (char *)buff, size);
+  return 0;
 }
 
-#if 0
-static void invertbytes (char *b, int size) {
-  int i = 0;
-  while (i < --size) {
-    char temp = b[i];
-    b[i++] = b[size];
-    b[size] = temp;
+
+static void newpackcache (mrp_State *L) {
+  PackCache *pc = (PackCache *)mrp_newuserdata(L, sizeof(PackCache));
+  int i;
+  for (i = 0; i < PACKCACHE; i++) pc->slot[i] = NULL;
+  pc->clock = 0;
+  mrp_newtable(L);
+  mrp_pushliteral(L, "__gc");
+  mrp_pushcfunction(L, packcache_gc);
+  mrp_rawset(L, -3);
+  mrp_setmetatable(L, -2);
+}
+
+
+static void checkalign (mrp_State *L, const PackItem *it) {
+  if (it->toalign == 0)
+    mr_L_error(L, "alignment must be 2^n");
+}
+
+
+/*
+** packs arguments `arg'..`arg+n-1' as integers of `size' bytes, filling
+** the buffer directly in blocks
+*/
+static void putintegers (mrp_State *L, mr_L_Buffer *b, int arg, int endian,
+                         int size, int n) {
+  while (n > 0) {
+    unsigned char *p;
+    int m = (b->buffer + MRP_L_BUFFERSIZE - b->p) / size;  /* room left */
+    if (m == 0) {
+      mr_L_prepbuffer(b);
+      m = MRP_L_BUFFERSIZE / size;
+    }
+    if (m > n) m = n;
+    p = (unsigned char *)b->p;
+    mr_L_addsize(b, m*size);
+    n -= m;
+    switch (size*2 + endian) {
+      case 1*2+0: case 1*2+1:
+        for (; m > 0; m--, p += 1)
+          p[0] = (unsigned char)mr_L_checknumber(L, arg++);
+        break;
+      case 2*2+0:
+        for (; m > 0; m--, p += 2) {
+          unsigned long v = (unsigned long)mr_L_checknumber(L, arg++);
+          p[0] = (unsigned char)v; p[1] = (unsigned char)(v >> 8);
+        }
+        break;
+      case 2*2+1:
+        for (; m > 0; m--, p += 2) {
+          unsigned long v = (unsigned long)mr_L_checknumber(L, arg++);
+          p[1] = (unsigned char)v; p[0] = (unsigned char)(v >> 8);
+        }
+        break;
+      case 4*2+0:
+        for (; m > 0; m--, p += 4) {
+          unsigned long v = (unsigned long)mr_L_checknumber(L, arg++);
+          p[0] = (unsigned char)v; p[1] = (unsigned char)(v >> 8);
+          p[2] = (unsigned char)(v >> 16); p[3] = (unsigned char)(v >> 24);
+        }
+        break;
+      case 4*2+1:
+        for (; m > 0; m--, p += 4) {
+          unsigned long v = (unsigned long)mr_L_checknumber(L, arg++);
+          p[3] = (unsigned char)v; p[2] = (unsigned char)(v >> 8);
+          p[1] = (unsigned char)(v >> 16); p[0] = (unsigned char)(v >> 24);
+        }
+        break;
+      default:
+        for (; m > 0; m--, p += size) {
+          unsigned long v = (unsigned long)mr_L_checknumber(L, arg++);
+          int i;
+          for (i = 0; i < size; i++, v >>= 8)
+            p[endian ? size-1-i : i] = (unsigned char)v;
+        }
+        break;
+    }
   }
 }
-#endif
 
 
 static void invalidformat (mrp_State *L, char c) {
@@ -224,21 +400,17 @@ static void invalidformat (mrp_State *L, char c) {
 
 
 static int b_size (mrp_State *L) {
-  int native;
-  const char *fmt = mr_L_checkstring(L, 1);
-  int align;
+  const PackFmt *pf = checkpackfmt(L, 1);
   int totalsize = 0;
-  getendianess(&fmt, &native);
-  align = getalign(&fmt);
-  while (*fmt) {
-    int opt = *fmt++;
-    int size = optsize(opt, &fmt);
-    int toalign = gettoalign(L, align, opt, size);
-    if (size == 0)
+  int i;
+  for (i = 0; i < pf->nitems; i++) {
+    const PackItem *it = &pf->item[i];
+    checkalign(L, it);
+    if (it->size == 0)
       mr_L_error(L, "meet size 0, check 'c' , 's' or 'p'");
-    totalsize += toalign - 1;
-    totalsize -= totalsize&(toalign-1);
-    totalsize += size;
+    totalsize += it->toalign - 1;
+    totalsize -= totalsize&(it->toalign-1);
+    totalsize += it->size * it->count;
   }
   mrp_pushnumber(L, totalsize);
   return 1;
@@ -247,27 +419,27 @@ static int b_size (mrp_State *L) {
 
 static int b_pack (mrp_State *L) {
   mr_L_Buffer b;
-  int native;
-  const char *fmt = mr_L_checkstring(L, 1);
-  int endian = getendianess(&fmt, &native);
-  int align = getalign(&fmt);
+  const PackFmt *pf = checkpackfmt(L, 1);
   int arg = 2;
   int totalsize = 0;
+  int i;
   mrp_pushnil(L);  /* mark to separate arguments from string buffer */
   mr_L_buffinit(L, &b);
-  for (; *fmt; arg++) {
-    int opt = *fmt++;
-    int size = optsize(opt, &fmt);
-    int toalign = gettoalign(L, align, opt, size);
-    while ((totalsize&(toalign-1)) != 0) {
+  for (i = 0; i < pf->nitems; i++, arg++) {
+    const PackItem *it = &pf->item[i];
+    int size = it->size;
+    checkalign(L, it);
+    while ((totalsize&(it->toalign-1)) != 0) {
        mr_L_putchar(&b, '\0');
        totalsize++;
     }
-    switch (opt) {
+    switch (it->opt) {
       case ' ': break;  /* ignore white spaces */
       case 'b': case 'B': case 'h': case 'H':
       case 'l': case 'L': case 'i': case 'I': {  /* integer types */
-        putinteger(L, &b, arg, endian, size);
+        putintegers(L, &b, arg, pf->endian, size, it->count);
+        arg += it->count - 1;
+        size *= it->count;
         break;
       }
       case 'x': {
@@ -279,31 +451,21 @@ static int b_pack (mrp_State *L) {
         size_t l;
         const char *s = mr_L_checklstring(L, arg, &l);
         if (size == 0) size = l;
-#if 0
-         mr_L_argcheck(L, l >= (size_t)size, arg, "string too short");
-         mr_L_addlstring(&b, s, size);
-#else
-         if(l < (size_t)size){
-            char * temp_buf = MR_MALLOC(size);
-            if (temp_buf){
-               MEMSET(temp_buf, 0, size);
-               MEMCPY(temp_buf, s, l);
-               mr_L_addlstring(&b, temp_buf, size);
-               MR_FREE(temp_buf, size);
-            }else{
-               mr_L_addlstring(&b, s, size);
-            }
-         }else{
-            mr_L_addlstring(&b, s, size);
-         }
-#endif
-        if (opt == 's') {
+        if (l < (size_t)size) {  /* pad short strings with zeros */
+          int k;
+          mr_L_addlstring(&b, s, l);
+          for (k = l; k < size; k++)
+            mr_L_putchar(&b, '\0');
+        }
+        else
+          mr_L_addlstring(&b, s, size);
+        if (it->opt == 's') {
           mr_L_putchar(&b, '\0');  /* add zero at the end */
           size++;
         }
         break;
       }
-      default: invalidformat(L, opt);
+      default: invalidformat(L, it->opt);
     }
     totalsize += size;
   }
@@ -312,59 +474,99 @@ static int b_pack (mrp_State *L) {
 }
 
 
-static void getinteger (mrp_State *L, const char *buff, int endian,
-                        int withsign, int size) {
+static mrp_Number getinteger (const unsigned char *buff, int endian,
+                              int withsign, int size) {
   unsigned long l = 0;
-  int i, inc;
-  if (endian == 1)
-    inc = 1;
-  else {
-    inc = -1;
-    buff += size-1;
+  int i;
+  if (endian == 1) {
+    for (i=0; i<size; i++)
+      l = (l<<8) + buff[i];
   }
-  for (i=0; i<size; i++) {
-    l = (l<<8) + (unsigned char)(*buff);
-    buff += inc;
+  else {
+    for (i=size-1; i>=0; i--)
+      l = (l<<8) + buff[i];
   }
   if (withsign) {  /* signed format? */
     unsigned long mask = ~(0UL) << (size*8 - 1);
     if (l & mask) {  /* negative value? */
       l = (l^~(mask<<1)) + 1;
-      mrp_pushnumber(L, -(mrp_Number)l);
-      return;
+      return -(mrp_Number)l;
     }
   }
-  mrp_pushnumber(L, l);
+  return (mrp_Number)l;
 }
 
-static int b_unpack (mrp_State *L) {
-  int native;
-  const char *fmt = mr_L_checkstring(L, 1);
-  size_t ld;
-  const char *data = mr_L_checklstring(L, 2, &ld);
-  int pos = mr_L_optint(L, 3, 1) - 1;
-  int endian = getendianess(&fmt, &native);
-  int align = getalign(&fmt);
-  mrp_settop(L, 2);
-  while (*fmt) {
-    int opt = *fmt++;
-    int size = optsize(opt, &fmt);
-    int toalign = gettoalign(L, align, opt, size);
-    pos += toalign - 1;
-    pos -= pos&(toalign-1);
-    mr_L_argcheck(L, pos+size <= (int)ld, 2, "unpack:input too short");
-    switch (opt) {
+
+/* pushes `n' integers of `size' bytes from `buff' */
+static void getintegers (mrp_State *L, const unsigned char *p, int endian,
+                         int withsign, int size, int n) {
+  mr_L_checkstack(L, n, "too many results to unpack");
+  switch (size*2 + endian) {
+    case 1*2+0: case 1*2+1:
+      if (withsign)
+        for (; n > 0; n--, p += 1) mrp_pushnumber(L, (signed char)p[0]);
+      else
+        for (; n > 0; n--, p += 1) mrp_pushnumber(L, p[0]);
+      break;
+    case 2*2+0:
+      if (withsign)
+        for (; n > 0; n--, p += 2)
+          mrp_pushnumber(L, (short)(p[0] | (p[1] << 8)));
+      else
+        for (; n > 0; n--, p += 2) mrp_pushnumber(L, p[0] | (p[1] << 8));
+      break;
+    case 2*2+1:
+      if (withsign)
+        for (; n > 0; n--, p += 2)
+          mrp_pushnumber(L, (short)(p[1] | (p[0] << 8)));
+      else
+        for (; n > 0; n--, p += 2) mrp_pushnumber(L, p[1] | (p[0] << 8));
+      break;
+    default:
+      for (; n > 0; n--, p += size)
+        mrp_pushnumber(L, getinteger(p, endian, withsign, size));
+      break;
+  }
+}
+
+
+/* the record does not fit in the input: an error, or -1 when `partial' */
+#define checkinput(L,cond,partial) \
+  { if (!(cond)) { if (partial) return -1; \
+                   mr_L_argerror(L, 2, "unpack:input too short"); } }
+
+
+/*
+** unpacks one record from position `pos' (0-based) of `data', pushing
+** its values; returns the position after it.  When `partial' is set, a
+** record cut short by the end of `data' returns -1 (with some of its
+** values pushed) instead of raising an error.
+*/
+static int unpackrecord (mrp_State *L, const PackFmt *pf, const char *data,
+                         size_t ld, int pos, int partial) {
+  int i;
+  for (i = 0; i < pf->nitems; i++) {
+    const PackItem *it = &pf->item[i];
+    int size = it->size;
+    checkalign(L, it);
+    pos += it->toalign - 1;
+    pos -= pos&(it->toalign-1);
+    checkinput(L, pos+size*it->count <= (int)ld, partial);
+    switch (it->opt) {
       case ' ': break;  /* ignore white spaces */
       case 'b': case 'B': case 'h': case 'H':
       case 'l': case 'L': case 'i':  case 'I': {  /* integer types */
-        int withsign = mr_islower(opt);
-        getinteger(L, data+pos, endian, withsign, size);
+        int withsign = mr_islower(it->opt);
+        getintegers(L, (const unsigned char *)data+pos, pf->endian, withsign,
+                    size, it->count);
+        size *= it->count;
         break;
       }
       case 'x': {
         break;
       }
       case 'c': {
+        mr_L_checkstack(L, 1, "too many results to unpack");
         mrp_pushlstring(L, data+pos, size);
         break;
       }
@@ -373,26 +575,94 @@ static int b_unpack (mrp_State *L) {
            mr_L_error(L, "previous size for `p' missing");
          size = mrp_tonumber(L, -1);
          //mrp_pop(L, 1);
-         mr_L_argcheck(L, pos+size <= (int)ld, 2, "unpack:input too short");
+         mr_L_argcheck(L, size >= 0, 2, "unpack:input too short");
+         checkinput(L, pos+size <= (int)ld, partial);
+         mr_L_checkstack(L, 1, "too many results to unpack");
          mrp_pushlstring(L, data+pos, size);
          break;
       }
       case 's': {
         const char *e = (const char *)MEMCHR(data+pos, '\0', ld - pos);
-        if (e == NULL)
+        if (e == NULL) {
+          if (partial) return -1;
           mr_L_error(L, "unfinished string in input");
+        }
         size = (e - (data+pos)) + 1;
+        mr_L_checkstack(L, 1, "too many results to unpack");
         mrp_pushlstring(L, data+pos, size - 1);
         break;
       }
-      default: invalidformat(L, opt);
+      default: invalidformat(L, it->opt);
     }
     pos += size;
   }
+  return pos;
+}
+
+
+static int b_unpack (mrp_State *L) {
+  const PackFmt *pf;
+  size_t ld;
+  const char *data;
+  int pos, base;
+  mr_L_checkstring(L, 1);
+  data = mr_L_checklstring(L, 2, &ld);
+  pos = mr_L_optint(L, 3, 1) - 1;
+  mrp_settop(L, 2);
+  pf = checkpackfmt(L, 1);
+  base = mrp_gettop(L);
+  pos = unpackrecord(L, pf, data, ld, pos, 0);
+  mr_L_checkstack(L, 1, "too many results to unpack");
+  mrp_pushnumber(L, pos + 1);
+  return mrp_gettop(L) - base;
+}
+
+
+/*
+** unpackN(fmt, data [, n [, init]]): unpacks `n' consecutive records
+** (as many as `data' holds when `n' is absent or not positive; a
+** trailing partial record is then left alone) into a table; each record
+** is a table of its values, or the value itself when the format has
+** only one.  Returns the table and the position after the last record.
+*/
+static int b_unpackn (mrp_State *L) {
+  const PackFmt *pf;
+  size_t ld;
+  const char *data;
+  int n, pos, k = 0;
+  mr_L_checkstring(L, 1);
+  data = mr_L_checklstring(L, 2, &ld);
+  n = mr_L_optint(L, 3, 0);
+  pos = mr_L_optint(L, 4, 1) - 1;
+  mrp_settop(L, 4);
+  pf = checkpackfmt(L, 1);
+  mrp_newtable(L);
+  while ((n > 0) ? k < n : pos < (int)ld) {
+    int res = mrp_gettop(L);
+    int old = pos;
+    if (pf->nvalues != 1)
+      mrp_newtable(L);
+    pos = unpackrecord(L, pf, data, ld, pos, n <= 0);
+    if (pos < 0) {  /* partial record at the end */
+      mrp_settop(L, res);
+      pos = old;
+      break;
+    }
+    if (pf->nvalues == 1)  /* store the value itself */
+      mrp_rawseti(L, res, ++k);
+    else {
+      int j;
+      for (j = mrp_gettop(L) - res - 1; j > 0; j--)
+        mrp_rawseti(L, res + 1, j);
+      mrp_rawseti(L, res, ++k);
+    }
+    if (pos == old && n <= 0) break;  /* empty records: stop */
+  }
   mrp_pushnumber(L, pos + 1);
-  return mrp_gettop(L) - 2;
+  return 2;
 }
 
+
 /////--------------------------------------------
 
 
@@ -563,10 +833,14 @@ static int str_dump (mrp_State *L) {
 #define CAP_UNFINISHED	(-1)
 #define CAP_POSITION	(-2)
 
+typedef struct PatProg PatProg;
+
 typedef struct MatchState {
   const char *src_init;  /* init of source string */
   const char *src_end;  /* end (`\0') of source string */
   mrp_State *L;
+  const PatProg *prog;  /* compiled pattern, or NULL to interpret it */
+  const char *pat;  /* pattern (positions in `prog' are relative to it) */
   int level;  /* total number of captures (finished or unfinished) */
   struct {
     const char *init;
@@ -671,6 +945,358 @@ static int mr_I_singlematch (int c, const char *p, const char *ep) {
 }
 
 
+/*
+** {======================================================
+** Substring search: Horspool for long needles; for short ones a
+** word-at-a-time scan for the first char, candidates are then checked
+** against the last char before being compared
+** =======================================================
+*/
+
+#define MINHORSPOOL	8  /* needles at least this long use Horspool */
+
+#define ONES		((uint32)0x01010101UL)
+#define haszero(w)	(((w) - ONES) & ~(w) & (ONES << 7))
+
+
+static const char *horspool (const char *s1, size_t l1,
+                             const char *s2, size_t l2) {
+  lu_byte skip[256];  /* shifts are capped at 255, which stays safe */
+  const uint8 *p = (const uint8 *)s1;
+  const uint8 *end = p + (l1 - l2);  /* last possible start */
+  size_t last = l2 - 1;
+  size_t i;
+  MEMSET(skip, (l2 < 255) ? (int)l2 : 255, sizeof(skip));
+  for (i = (last > 255) ? last - 255 : 0; i < last; i++)
+    skip[uchar(s2[i])] = cast(lu_byte, last - i);
+  while (p <= end) {
+    uint8 c = p[last];
+    if (c == uchar(s2[last]) && MEMCMP(p, s2, last) == 0)
+      return (const char *)p;
+    p += skip[c];
+  }
+  return NULL;
+}
+
+
+static const char *shortfind (const char *s1, size_t l1,
+                              const char *s2, size_t l2) {
+  const uint8 *p = (const uint8 *)s1;
+  const uint8 *end = p + (l1 - l2);  /* last possible start */
+  uint8 first = uchar(s2[0]);
+  uint8 last = uchar(s2[l2-1]);
+  uint32 mask = first * ONES;
+#define CANDIDATE(q)	(*(q) == first && (q)[l2-1] == last && \
+                         MEMCMP((q)+1, s2+1, l2-2) == 0)
+  while (p <= end && ((size_t)p & 3) != 0) {  /* align */
+    if (CANDIDATE(p)) return (const char *)p;
+    p++;
+  }
+  while (p + 3 <= end) {  /* 4 starts at a time */
+    uint32 w;
+    MEMCPY(&w, p, sizeof(w));  /* no type punning */
+    w ^= mask;
+    if (haszero(w)) {  /* some byte is `first' */
+      if (CANDIDATE(p)) return (const char *)p;
+      if (CANDIDATE(p+1)) return (const char *)(p+1);
+      if (CANDIDATE(p+2)) return (const char *)(p+2);
+      if (CANDIDATE(p+3)) return (const char *)(p+3);
+    }
+    p += 4;
+  }
+  for (; p <= end; p++) {
+    if (CANDIDATE(p)) return (const char *)p;
+  }
+#undef CANDIDATE
+  return NULL;
+}
+
+
+const char *_mr_memfind (const char *s1, size_t l1,
+                             const  char *s2, size_t l2) {
+  if (l2 == 0) return s1;  /* empty strings are everywhere */
+  else if (l2 > l1) return NULL;  /* avoids a negative `l1' */
+  else if (l2 == 1) return (const char *)MEMCHR(s1, *s2, l1);
+  else if (l2 < MINHORSPOOL) return shortfind(s1, l1, s2, l2);
+  else return horspool(s1, l1, s2, l2);
+}
+
+/* }====================================================== */
+
+
+/*
+** Compiled patterns.
+** A pattern is compiled once into, for every position where an item
+** starts, the end of its class and a 256-bit set of the chars it
+** matches; the matcher then skips `mr_I_classend' and the class tests.
+** The chars every match must start with (literal prefix) or the set of
+** its first char are used to jump over impossible starts.  Programs of
+** the last PATCACHE patterns are kept, least recently used first out.
+*/
+
+#define PATCACHE	8
+#define MAXPATPROG	200  /* longer patterns are interpreted */
+#define NOSET		255
+
+struct PatProg {
+  size_t len;  /* pattern length; the pattern follows this header */
+  lu_mem size;  /* size of the whole block */
+  unsigned long lastuse;
+  int body;  /* where matching starts (1 after a leading `^') */
+  int plen;  /* length of `prefix' */
+  int first;  /* set of a mandatory first char when there is no prefix */
+  int nsets;
+  lu_byte *ep;  /* for each item position, position of its class end */
+  lu_byte *setidx;  /* for each item position, its set, or NOSET */
+  lu_byte *sets;  /* 32 bytes per set */
+  char *prefix;  /* literal chars every match (from `body') starts with */
+};
+
+typedef struct PatCache {
+  PatProg *slot[PATCACHE];
+  unsigned long clock;
+} PatCache;
+
+#define patstr(pp)	(cast(const char *, (pp) + 1))
+#define setof(pp,i)	((pp)->sets + ((pp)->setidx[i] << 5))
+#define inset(set,c)	((set)[(c) >> 3] & (1 << ((c) & 7)))
+
+
+/* same as `mr_I_classend', but returns -1 on malformed classes */
+static int safeclassend (const char *p, int i) {
+  switch (p[i++]) {
+    case ESC: {
+      return (p[i] == '\0') ? -1 : i+1;
+    }
+    case '[': {
+      if (p[i] == '^') i++;
+      do {  /* look for a `]' */
+        if (p[i] == '\0') return -1;
+        if (p[i++] == ESC && p[i] != '\0') i++;
+      } while (p[i] != ']');
+      return i+1;
+    }
+    default: {
+      return i;
+    }
+  }
+}
+
+
+/*
+** goes through the pattern from position `i' the way `match' does; with
+** `pp' == NULL only counts the items, otherwise fills their entries
+*/
+static int walkpattern (PatProg *pp, const char *p, int i) {
+  int n = 0;
+  while (p[i] != '\0') {
+    int ep;
+    int frontier = 0;
+    switch (p[i]) {
+      case '(': i += (p[i+1] == ')') ? 2 : 1; continue;
+      case ')': i++; continue;
+      case '$': if (p[i+1] == '\0') return n; break;
+      case ESC: {
+        if (p[i+1] == 'b') {
+          if (p[i+2] == '\0' || p[i+3] == '\0') return -1;
+          i += 4; continue;
+        }
+        if (p[i+1] == 'f') {
+          i += 2;
+          if (p[i] != '[') return -1;
+          frontier = 1;
+        }
+        else if (mr_isdigit(uchar(p[i+1]))) {
+          i += 2; continue;
+        }
+        break;
+      }
+    }
+    ep = safeclassend(p, i);
+    if (ep < 0) return -1;
+    n++;
+    if (pp != NULL && pp->setidx[i] == NOSET) {
+      lu_byte *set = pp->sets + (pp->nsets << 5);
+      int c;
+      for (c = 0; c < 256; c++) {
+        if (mr_I_singlematch(c, p+i, p+ep)) set[c >> 3] |= cast(lu_byte, 1 << (c & 7));
+      }
+      pp->ep[i] = cast(lu_byte, ep);
+      pp->setidx[i] = cast(lu_byte, pp->nsets++);
+    }
+    i = ep;
+    if (!frontier &&  /* a frontier takes no quantifier */
+        (p[i] == '?' || p[i] == '*' || p[i] == '+' || p[i] == '-')) i++;
+  }
+  return n;
+}
+
+
+static void findprefix (PatProg *pp, const char *p) {
+  int i = pp->body;
+  pp->plen = 0;
+  pp->first = NOSET;
+  for (;;) {
+    int c, q, lit;
+    while (p[i] == '(') i += (p[i+1] == ')') ? 2 : 1;  /* consume nothing */
+    c = uchar(p[i]);
+    if (c == '\0' || c == ')' || (c == '$' && p[i+1] == '\0')) return;
+    if (c == ESC && (p[i+1] == 'b' || p[i+1] == 'f' || mr_isdigit(uchar(p[i+1]))))
+      return;
+    q = p[pp->ep[i]];
+    if (q == '?' || q == '*' || q == '-') return;  /* may match nothing */
+    if (c != '.' && c != '[' && c != ESC) lit = c;
+    else if (c == ESC && !mr_isalnum(uchar(p[i+1]))) lit = uchar(p[i+1]);
+    else {  /* a class: remember its set if it comes first */
+      if (pp->plen == 0) pp->first = pp->setidx[i];
+      return;
+    }
+    pp->prefix[pp->plen++] = cast(char, lit);
+    if (q == '+') return;  /* the next char may repeat it */
+    i = pp->ep[i];
+  }
+}
+
+
+static PatProg *compilepattern (mrp_State *L, const char *p, size_t l) {
+  PatProg *pp;
+  lu_mem size;
+  int body = (*p == '^');
+  int n = walkpattern(NULL, p, 0);
+  if (n < 0) return NULL;
+  if (body) {
+    int n1 = walkpattern(NULL, p, 1);
+    if (n1 < 0) return NULL;
+    n += n1;  /* (items seen by both walks are counted twice) */
+  }
+  if (n >= NOSET) return NULL;
+  size = sizeof(PatProg) + 4*(l+1) + (n << 5);
+  pp = (PatProg *)mr_M_malloc(L, size);
+  pp->len = l;
+  pp->size = size;
+  pp->lastuse = 0;
+  pp->body = body;
+  MEMCPY(cast(char *, pp + 1), p, l+1);
+  pp->ep = cast(lu_byte *, pp + 1) + (l+1);
+  pp->setidx = pp->ep + (l+1);
+  pp->prefix = cast(char *, pp->setidx + (l+1));
+  pp->sets = cast(lu_byte *, pp->prefix) + (l+1);
+  MEMSET(pp->setidx, NOSET, l+1);
+  MEMSET(pp->sets, 0, n << 5);
+  pp->nsets = 0;
+  walkpattern(pp, p, 0);
+  if (body) walkpattern(pp, p, 1);
+  findprefix(pp, p);
+  return pp;
+}
+
+
+/*
+** returns the program of pattern `p', compiling it if it is not in the
+** cache at stack index `cache'; NULL means the pattern is interpreted
+*/
+static const PatProg *getprog (mrp_State *L, int cache, const char *p,
+                               size_t l) {
+  PatCache *pc = (PatCache *)mrp_touserdata(L, cache);
+  PatProg *pp;
+  int i, victim = 0;
+  if (pc == NULL || l > MAXPATPROG) return NULL;
+  for (i = 0; i < PATCACHE; i++) {
+    pp = pc->slot[i];
+    if (pp == NULL) {
+      victim = i;
+      continue;
+    }
+    if (pp->len == l && MEMCMP(patstr(pp), p, l) == 0) {
+      pp->lastuse = ++pc->clock;
+      return pp;
+    }
+    if (pc->slot[victim] != NULL && pp->lastuse < pc->slot[victim]->lastuse)
+      victim = i;
+  }
+  pp = compilepattern(L, p, l);
+  if (pp == NULL) return NULL;
+  if (pc->slot[victim] != NULL)
+    mr_M_free(L, pc->slot[victim], pc->slot[victim]->size);
+  pp->lastuse = ++pc->clock;
+  pc->slot[victim] = pp;
+  return pp;
+}
+
+
+static int patcache_gc (mrp_State *L) {
+  PatCache *pc = (PatCache *)mrp_touserdata(L, 1);
+  int i;
+  for (i = 0; i < PATCACHE; i++) {
+    if (pc->slot[i] != NULL) {
+      mr_M_free(L, pc->slot[i], pc->slot[i]->size);
+      pc->slot[i] = NULL;
+    }
+  }
+  return 0;
+}
+
+
+static void newpatcache (mrp_State *L) {
+  PatCache *pc = (PatCache *)mrp_newuserdata(L, sizeof(PatCache));
+  int i;
+  for (i = 0; i < PATCACHE; i++) pc->slot[i] = NULL;
+  pc->clock = 0;
+  mrp_newtable(L);
+  mrp_pushliteral(L, "__gc");
+  mrp_pushcfunction(L, patcache_gc);
+  mrp_rawset(L, -3);
+  mrp_setmetatable(L, -2);
+}
+
+
+/*
+** first position from `s' where a match (from the pattern body) may
+** start, or NULL if there is none
+*/
+static const char *nextstart (MatchState *ms, const char *s) {
+  const PatProg *pp = ms->prog;
+  if (pp == NULL) return s;
+  if (pp->plen > 0)
+    return _mr_memfind(s, ms->src_end - s, pp->prefix, pp->plen);
+  if (pp->first != NOSET) {
+    const lu_byte *set = pp->sets + (pp->first << 5);
+    while (s < ms->src_end && !inset(set, uchar(*s))) s++;
+    return (s < ms->src_end) ? s : NULL;
+  }
+  return s;
+}
+
+
+/* can an anchored match start at `s'? */
+static int canstart (MatchState *ms, const char *s) {
+  const PatProg *pp = ms->prog;
+  if (pp == NULL) return 1;
+  if (pp->plen > 0)
+    return (size_t)(ms->src_end - s) >= (size_t)pp->plen &&
+           MEMCMP(s, pp->prefix, pp->plen) == 0;
+  if (pp->first != NOSET)
+    return s < ms->src_end && inset(pp->sets + (pp->first << 5), uchar(*s));
+  return 1;
+}
+
+
+#define compiled(ms,p)	((ms)->prog && (ms)->prog->setidx[(p) - (ms)->pat] != NOSET)
+
+
+static const char *classend (MatchState *ms, const char *p) {
+  if (compiled(ms, p)) return ms->pat + ms->prog->ep[p - ms->pat];
+  return mr_I_classend(ms, p);
+}
+
+
+static int singlematch (MatchState *ms, int c, const char *p,
+                        const char *ep) {
+  if (compiled(ms, p)) return inset(setof(ms->prog, p - ms->pat), c);
+  return mr_I_singlematch(c, p, ep);
+}
+
+
 static const char *match (MatchState *ms, const char *s, const char *p);
 
 
@@ -697,8 +1323,15 @@ static const char *matchbalance (MatchState *ms, const char *s,
 static const char *max_expand (MatchState *ms, const char *s,
                                  const char *p, const char *ep) {
   sint32 i = 0;  /* counts maximum expand for item */
-  while ((s+i)<ms->src_end && mr_I_singlematch(uchar(*(s+i)), p, ep))
-    i++;
+  if (compiled(ms, p)) {
+    const lu_byte *set = setof(ms->prog, p - ms->pat);
+    while ((s+i)<ms->src_end && inset(set, uchar(*(s+i))))
+      i++;
+  }
+  else {
+    while ((s+i)<ms->src_end && mr_I_singlematch(uchar(*(s+i)), p, ep))
+      i++;
+  }
   /* keeps trying to match with the maximum repetitions */
   while (i>=0) {
     const char *res = match(ms, (s+i), ep+1);
@@ -715,7 +1348,7 @@ static const char *min_expand (MatchState *ms, const char *s,
     const char *res = match(ms, s, ep+1);
     if (res != NULL)
       return res;
-    else if (s<ms->src_end && mr_I_singlematch(uchar(*s), p, ep))
+    else if (s<ms->src_end && singlematch(ms, uchar(*s), p, ep))
       s++;  /* try with one more repetition */
     else return NULL;
   }
@@ -782,10 +1415,10 @@ static const char *match (MatchState *ms, const char *s, const char *p) {
           p += 2;
           if (*p != '[')
             mr_L_error(ms->L, "missing `[' after `%%f' in pattern");
-          ep = mr_I_classend(ms, p);  /* points to what is next */
+          ep = classend(ms, p);  /* points to what is next */
           previous = (s == ms->src_init) ? '\0' : *(s-1);
-          if (matchbracketclass(uchar(previous), p, ep-1) ||
-             !matchbracketclass(uchar(*s), p, ep-1)) return NULL;
+          if (singlematch(ms, uchar(previous), p, ep) ||
+             !singlematch(ms, uchar(*s), p, ep)) return NULL;
           p=ep; goto init;  /* else return match(ms, s, ep); */
         }
         default: {
@@ -807,8 +1440,8 @@ static const char *match (MatchState *ms, const char *s, const char *p) {
       else goto dflt;
     }
     default: dflt: {  /* it is a pattern item */
-      const char *ep = mr_I_classend(ms, p);  /* points to what is next */
-      int m = s<ms->src_end && mr_I_singlematch(uchar(*s), p, ep);
+      const char *ep = classend(ms, p);  /* points to what is next */
+      int m = s<ms->src_end && singlematch(ms, uchar(*s), p, ep);
       switch (*ep) {
         case '?': {  /* optional */
           const char *res;
@@ -836,28 +1469,6 @@ static const char *match (MatchState *ms, const char *s, const char *p) {
 
 
 
-const char *_mr_memfind (const char *s1, size_t l1,
-                             const  char *s2, size_t l2) {
-  if (l2 == 0) return s1;  /* empty strings are everywhere */
-  else if (l2 > l1) return NULL;  /* avoids a negative `l1' */
-  else {
-    const char *init;  /* to search for a `*s2' inside `s1' */
-    l2--;  /* 1st char will be checked by `memchr' */
-    l1 = l1-l2;  /* `s2' cannot be found after that */
-    while (l1 > 0 && (init = (const char *)MEMCHR(s1, *s2, l1)) != NULL) {
-      init++;   /* 1st char is already checked */
-      if (MEMCMP(init, s2+1, l2) == 0)
-        return init-1;
-      else {  /* correct `l1' and `s1' to try again */
-        l1 -= init-s1;
-        s1 = init;
-      }
-    }
-    return NULL;  /* not found */
-  }
-}
-
-
 static void push_onecapture (MatchState *ms, int i) {
   int l = ms->capture[i].len;
   if (l == CAP_UNFINISHED) mr_L_error(ms->L, "unfinished capture");
@@ -902,20 +1513,26 @@ static int str_find (mrp_State *L) {
   }
   else {
     MatchState ms;
-    int anchor = (*p == '^') ? (p++, 1) : 0;
     const char *s1=s+init;
+    int anchor;
     ms.L = L;
     ms.src_init = s;
     ms.src_end = s+l1;
-    do {
+    ms.prog = getprog(L, mrp_upvalueindex(1), p, l2);
+    ms.pat = p;
+    anchor = (*p == '^') ? (p++, 1) : 0;
+    if (anchor && !canstart(&ms, s1)) s1 = NULL;
+    while (s1 != NULL) {
       const char *res;
+      if (!anchor && (s1 = nextstart(&ms, s1)) == NULL) break;
       ms.level = 0;
       if ((res=match(&ms, s1, p)) != NULL) {
         mrp_pushnumber(L, (mrp_Number)(s1-s+1));  /* start */
         mrp_pushnumber(L, (mrp_Number)(res-s));   /* end */
         return push_captures(&ms, NULL, 0) + 2;
       }
-    } while (s1++<ms.src_end && !anchor);
+      if (s1++>=ms.src_end || anchor) break;
+    }
   }
   mrp_pushnil(L);  /* not found */
   return 1;
@@ -931,10 +1548,16 @@ static int gfind_mr_aux (mrp_State *L) {
   ms.L = L;
   ms.src_init = s;
   ms.src_end = s+ls;
+  ms.prog = getprog(L, mrp_upvalueindex(4), p,
+                    mrp_strlen(L, mrp_upvalueindex(2)));
+  ms.pat = p;
+  if (ms.prog && ms.prog->body)  /* prefix is for the text after a `^' */
+    ms.prog = NULL;
   for (src = s + (size_t)mrp_tonumber(L, mrp_upvalueindex(3));
        src <= ms.src_end;
        src++) {
     const char *e;
+    if ((src = nextstart(&ms, src)) == NULL) break;
     ms.level = 0;
     if ((e = match(&ms, src, p)) != NULL) {
       int newstart = e-s;
@@ -953,7 +1576,8 @@ static int gfind (mrp_State *L) {
   mr_L_checkstring(L, 2);
   mrp_settop(L, 2);
   mrp_pushnumber(L, 0);
-  mrp_pushcclosure(L, gfind_mr_aux, 3);
+  mrp_pushvalue(L, mrp_upvalueindex(1));  /* pattern cache */
+  mrp_pushcclosure(L, gfind_mr_aux, 4);
   return 1;
 }
 
@@ -996,8 +1620,10 @@ static void add_s (MatchState *ms, mr_L_Buffer *b,
 static int str_gsub (mrp_State *L) {
   size_t srcl;
   const char *src = mr_L_checklstring(L, 1, &srcl);
-  const char *p = mr_L_checkstring(L, 2);
+  size_t pl;
+  const char *p = mr_L_checklstring(L, 2, &pl);
   int max_s = mr_L_optint(L, 4, srcl+1);
+  const char *pat = p;
   int anchor = (*p == '^') ? (p++, 1) : 0;
   int n = 0;
   MatchState ms;
@@ -1009,13 +1635,26 @@ static int str_gsub (mrp_State *L) {
   ms.L = L;
   ms.src_init = src;
   ms.src_end = src+srcl;
+  ms.prog = getprog(L, mrp_upvalueindex(1), pat, pl);
+  ms.pat = pat;
   while (n < max_s) {
     const char *e;
+    if (anchor) {
+      if (!canstart(&ms, src)) break;
+    }
+    else {
+      const char *next = nextstart(&ms, src);
+      if (next == NULL) break;  /* no more matches: copy the rest */
+      mr_L_addlstring(&b, src, next-src);  /* nothing can match before it */
+      src = next;
+    }
     ms.level = 0;
     e = match(&ms, src, p);
     if (e) {
       n++;
       add_s(&ms, &b, src, e);
+      if (mrp_isfunction(L, 3))  /* it may have pushed `prog' out of the cache */
+        ms.prog = getprog(L, mrp_upvalueindex(1), pat, pl);
     }
     if (e && e>src) /* non empty match? */
       src = e;  /* skip it */
@@ -1318,7 +1957,115 @@ static int str_set (mrp_State *L) {
 }
 
 
-static mr_L_reg strlib[29];
+/*
+** {======================================================
+** STRING BUFFER
+** append-only builder: text assembled piece by piece (every frame, or
+** in a loop) is copied into one growing block and only interned when
+** it is read back with `get'
+** =======================================================
+*/
+
+#define STRBUF		"strbuf"
+#define MINSTRBUF	64
+
+typedef struct StrBuf {
+  Mbuffer b;
+  size_t n;  /* bytes in use */
+} StrBuf;
+
+
+static StrBuf *tostrbuf (mrp_State *L) {
+  StrBuf *sb = (StrBuf *)mr_L_checkudata(L, 1, STRBUF);
+  if (sb == NULL) mr_L_argerror(L, 1, "bad buffer");
+  return sb;
+}
+
+
+static int sb_new (mrp_State *L) {
+  StrBuf *sb = (StrBuf *)mrp_newuserdata(L, sizeof(StrBuf));
+  mr_Z_initbuffer(L, &sb->b);
+  sb->n = 0;
+  mr_L_getmetatable(L, STRBUF);
+  mrp_setmetatable(L, -2);
+  return 1;
+}
+
+
+static int sb_add (mrp_State *L) {
+  StrBuf *sb = tostrbuf(L);
+  int top = mrp_gettop(L);
+  int i;
+  char s[32];
+  for (i = 2; i <= top; i++) {
+    const char *str;
+    size_t l;
+    if (mrp_type(L, i) == MRP_TNUMBER) {  /* no interned copy of numbers */
+      mrp_number2str(s, mrp_tonumber(L, i));
+      str = s;
+      l = STRLEN(s);
+    }
+    else
+      str = mr_L_checklstring(L, i, &l);
+    if (l > mr_Z_sizebuffer(&sb->b) - sb->n) {
+      size_t size = mr_Z_sizebuffer(&sb->b) * 2;
+      if (size < sb->n + l) size = sb->n + l;
+      if (size < MINSTRBUF) size = MINSTRBUF;
+      mr_Z_resizebuffer(L, &sb->b, size);
+    }
+    MEMCPY(mr_Z_buffer(&sb->b) + sb->n, str, l);
+    sb->n += l;
+  }
+  mrp_settop(L, 1);
+  return 1;  /* the buffer itself, so that calls can be chained */
+}
+
+
+static int sb_len (mrp_State *L) {
+  mrp_pushnumber(L, (mrp_Number)tostrbuf(L)->n);
+  return 1;
+}
+
+
+static int sb_get (mrp_State *L) {
+  StrBuf *sb = tostrbuf(L);
+  mrp_pushlstring(L, mr_Z_buffer(&sb->b), sb->n);
+  if (mrp_toboolean(L, 2)) sb->n = 0;  /* get and clear */
+  return 1;
+}
+
+
+static int sb_clear (mrp_State *L) {
+  StrBuf *sb = tostrbuf(L);
+  sb->n = 0;
+  if (mrp_toboolean(L, 2))  /* also give the memory back? */
+    mr_Z_freebuffer(L, &sb->b);
+  return 0;
+}
+
+
+static int sb_gc (mrp_State *L) {
+  StrBuf *sb = tostrbuf(L);
+  mr_Z_freebuffer(L, &sb->b);
+  return 0;
+}
+
+
+static mr_L_reg sblib[7];
+
+static void createbufmeta (mrp_State *L) {
+  mr_L_newmetatable(L, STRBUF);
+  mrp_pushliteral(L, "__index");
+  mrp_pushvalue(L, -2);  /* push metatable */
+  mrp_rawset(L, -3);  /* metatable.__index = metatable */
+  mr_L_openlib(L, NULL, sblib, 0);
+  mrp_pop(L, 1);
+}
+
+/* }====================================================== */
+
+
+static mr_L_reg strlib[31];
 
 void mr_strlib_init(void){
  strlib[0].name = "len"; strlib[0].func =  str_len;
@@ -1351,14 +2098,27 @@ void mr_strlib_init(void){
  strlib[26].name = "findex"; strlib[26].func =  gfind;
  strlib[27].name = "subex"; strlib[27].func =  str_gsub;
 #endif
- strlib[28].name = NULL; strlib[28].func =  NULL;
+ strlib[28].name = "buffer"; strlib[28].func =  sb_new;
+ strlib[29].name = "unpackN"; strlib[29].func =  b_unpackn;
+ strlib[30].name = NULL; strlib[30].func =  NULL;
+
+ sblib[0].name = "add"; sblib[0].func =  sb_add;
+ sblib[1].name = "len"; sblib[1].func =  sb_len;
+ sblib[2].name = "get"; sblib[2].func =  sb_get;
+ sblib[3].name = "clear"; sblib[3].func =  sb_clear;
+ sblib[4].name = "__gc"; sblib[4].func =  sb_gc;
+ sblib[5].name = "__str"; sblib[5].func =  sb_get;
+ sblib[6].name = NULL; sblib[6].func =  NULL;
 }
 
 /*
 ** Open string library
 */
 MRPLIB_API int mrp_open_string (mrp_State *L) {
-  mr_L_openlib(L, MRP_STRLIBNAME, strlib, 0);
+  newpatcache(L);
+  newpackcache(L);
+  mr_L_openlib(L, MRP_STRLIBNAME, strlib, 2);
+  createbufmeta(L);
   LUADBGPRINTF("string lib");
   return 1;
 }
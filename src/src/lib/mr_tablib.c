@@ -7,6 +7,10 @@
 #include "../../include/mr_store.h"
 
 #include "../h/mr_mem.h"
+#include "../h/mr_state.h"
+#include "../h/mr_string.h"
+#include "../h/mr_table.h"
+#include "../h/mr_vm.h"
 
 
 
@@ -100,23 +104,57 @@ static int mr_B_tremove (mrp_State *L) {
 }
 
 
+/*
+** measures the result first and then copies every piece straight into
+** the new string, which is interned once (no intermediate strings)
+*/
+static const char *concatpiece (mrp_State *L, char *s, size_t *l) {
+  if (mrp_type(L, -1) == MRP_TSTRING) {
+    *l = mrp_strlen(L, -1);
+    return mrp_tostring(L, -1);
+  }
+  mrp_number2str(s, mrp_tonumber(L, -1));
+  *l = STRLEN(s);
+  return s;
+}
+
+
 static int str_concat (mrp_State *L) {
-  mr_L_Buffer b;
-  size_t lsep;
+  size_t lsep, tl, l;
   const char *sep = mr_L_optlstring(L, 2, "", &lsep);
-  int i = mr_L_optint(L, 3, 1);
+  int first = mr_L_optint(L, 3, 1);
   int n = mr_L_optint(L, 4, 0);
+  int i;
+  char s[32];
+  TString *ts;
+  char *p;
   mr_L_checktype(L, 1, MRP_TTABLE);
   if (n == 0) n = mr_L_getn(L, 1);
-  mr_L_buffinit(L, &b);
-  for (; i <= n; i++) {
+  tl = 0;
+  for (i = first; i <= n; i++) {  /* check elements and total length */
     mrp_rawgeti(L, 1, i);
     mr_L_argcheck(L, mrp_isstring(L, -1), 1, "table contains non-strings");
-    mr_L_addvalue(&b);
-    if (i != n)
-      mr_L_addlstring(&b, sep, lsep);
+    concatpiece(L, s, &l);
+    tl += l;
+    if (i != n) tl += lsep;
+    mrp_pop(L, 1);
+  }
+  ts = mr_S_newraw(L, tl);  /* nothing below can raise an error */
+  p = cast(char *, getstr(ts));
+  for (i = first; i <= n; i++) {
+    const char *str;
+    mrp_rawgeti(L, 1, i);
+    str = concatpiece(L, s, &l);
+    MEMCPY(p, str, l);
+    p += l;
+    if (i != n) {
+      MEMCPY(p, sep, lsep);
+      p += lsep;
+    }
+    mrp_pop(L, 1);
   }
-  mr_L_pushresult(&b);
+  setsvalue2s(L->top, mr_S_intern(L, ts));
+  L->top++;
   return 1;
 }
 
@@ -150,9 +188,52 @@ static int sort_comp (mrp_State *L, int a, int b) {
     return mrp_lessthan(L, a, b);
 }
 
-static void mr_auxsort (mrp_State *L, int l, int u) {
+/* swaps a[i] and a[j] */
+static void swap2 (mrp_State *L, int i, int j) {
+  mrp_rawgeti(L, 1, i);
+  mrp_rawgeti(L, 1, j);
+  set2(L, i, j);
+}
+
+/* heap sort of a[l..u]; used when quicksort partitions badly */
+static void siftdown (mrp_State *L, int l, int root, int n) {
+  int child;
+  while ((child = 2*root + 1) < n) {
+    if (child + 1 < n) {
+      mrp_rawgeti(L, 1, l+child);
+      mrp_rawgeti(L, 1, l+child+1);
+      if (sort_comp(L, -2, -1)) child++;  /* a[child]<a[child+1]? */
+      mrp_pop(L, 2);
+    }
+    mrp_rawgeti(L, 1, l+root);
+    mrp_rawgeti(L, 1, l+child);
+    if (!sort_comp(L, -2, -1)) {  /* a[root] >= a[child]? */
+      mrp_pop(L, 2);
+      break;
+    }
+    set2(L, l+root, l+child);
+    root = child;
+  }
+}
+
+static void auxheapsort (mrp_State *L, int l, int u) {
+  int n = u - l + 1;
+  int i;
+  for (i = n/2 - 1; i >= 0; i--)
+    siftdown(L, l, i, n);
+  for (i = n - 1; i > 0; i--) {
+    swap2(L, l, l+i);
+    siftdown(L, l, 0, i);
+  }
+}
+
+static void mr_auxsort (mrp_State *L, int l, int u, int depth) {
   while (l < u) {  /* for tail recursion */
     int i, j;
+    if (depth-- == 0) {  /* too many bad partitions? */
+      auxheapsort(L, l, u);
+      return;
+    }
     /* sort elements a[l], a[(l+u)/2] and a[u] */
     mrp_rawgeti(L, 1, l);
     mrp_rawgeti(L, 1, u);
@@ -209,17 +290,231 @@ static void mr_auxsort (mrp_State *L, int l, int u) {
     else {
       j=i+1; i=u; u=j-2;
     }
-    mr_auxsort(L, j, i);  /* call recursively the smaller one */
+    mr_auxsort(L, j, i, depth);  /* call recursively the smaller one */
   }  /* repeat the routine for the larger one */
 }
 
+
+/* depth limit of the quicksorts: 2*log2(n) */
+static int sortdepth (int n) {
+  int d = 0;
+  while (n > 1) { n >>= 1; d += 2; }
+  return d;
+}
+
+
+/*
+** Arrays of only numbers or only strings without an order function
+** are sorted natively: no VM calls, values moved as plain TObjects.
+** Equal numbers or strings cannot be told apart (strings are
+** interned), so the result is the same as with any other algorithm.
+*/
+
+#define NATIVESMALL	16  /* ranges left to the final insertion sort */
+
+#define objlt(a,b)	(ttisnumber(a) ? nvalue(a) < nvalue(b) \
+                                  : mr_V_strcmp(tsvalue(a), tsvalue(b)) < 0)
+
+static void objsiftdown (TObject *a, int root, int n) {
+  int child;
+  while ((child = 2*root + 1) < n) {
+    TObject temp;
+    if (child + 1 < n && objlt(&a[child], &a[child+1])) child++;
+    if (!objlt(&a[root], &a[child])) break;
+    setobj(&temp, &a[root]);
+    setobj(&a[root], &a[child]);
+    setobj(&a[child], &temp);
+    root = child;
+  }
+}
+
+static void objheapsort (TObject *a, int n) {
+  int i;
+  for (i = n/2 - 1; i >= 0; i--)
+    objsiftdown(a, i, n);
+  for (i = n - 1; i > 0; i--) {
+    TObject temp;
+    setobj(&temp, &a[0]);
+    setobj(&a[0], &a[i]);
+    setobj(&a[i], &temp);
+    objsiftdown(a, 0, i);
+  }
+}
+
+static void objinsertsort (TObject *a, int n) {
+  int i, j;
+  for (i = 1; i < n; i++) {
+    TObject v;
+    setobj(&v, &a[i]);
+    for (j = i; j > 0 && objlt(&v, &a[j-1]); j--)
+      setobj(&a[j], &a[j-1]);
+    setobj(&a[j], &v);
+  }
+}
+
+static void objsort (TObject *a, int l, int u, int depth) {
+  while (u - l >= NATIVESMALL) {
+    TObject p, temp;
+    int i = l, j = u, m = l + (u-l)/2;
+    if (depth-- == 0) {
+      objheapsort(a + l, u - l + 1);
+      return;
+    }
+    /* median of a[l], a[m] and a[u] as pivot */
+    if (objlt(&a[m], &a[l])) { setobj(&temp, &a[m]); setobj(&a[m], &a[l]); setobj(&a[l], &temp); }
+    if (objlt(&a[u], &a[m])) {
+      setobj(&temp, &a[u]); setobj(&a[u], &a[m]); setobj(&a[m], &temp);
+      if (objlt(&a[m], &a[l])) { setobj(&temp, &a[m]); setobj(&a[m], &a[l]); setobj(&a[l], &temp); }
+    }
+    setobj(&p, &a[m]);
+    for (;;) {  /* invariant: a[l..i-1] <= p <= a[j+1..u] */
+      while (objlt(&a[i], &p)) i++;
+      while (objlt(&p, &a[j])) j--;
+      if (i >= j) break;
+      setobj(&temp, &a[i]); setobj(&a[i], &a[j]); setobj(&a[j], &temp);
+      i++; j--;
+    }
+    /* a[l..j] <= p <= a[j+1..u]; recurse on the smaller part */
+    if (j - l < u - j) {
+      objsort(a, l, j, depth);
+      l = j + 1;
+    }
+    else {
+      objsort(a, j + 1, u, depth);
+      u = j;
+    }
+  }
+}
+
+
+/*
+** sorts t[1..n] natively if there is no order function and all values
+** are numbers or all are strings; returns 0 if it cannot
+*/
+static int nativesort (mrp_State *L, int n) {
+  Table *t = hvalue(L->base);  /* table is at index 1 */
+  TObject *a;
+  int i, tt;
+  if (!mrp_isnil(L, 2)) return 0;  /* order function */
+  if (n < 2) return 1;
+  tt = ttype(mr_H_getnum(t, 1));
+  if (tt != MRP_TNUMBER && tt != MRP_TSTRING) return 0;
+  for (i = 2; i <= n; i++)
+    if (ttype(mr_H_getnum(t, i)) != tt) return 0;
+  if (n <= t->sizearray)
+    a = t->array;  /* sort the array part in place */
+  else {
+    a = mr_M_newvector(L, n, TObject);
+    for (i = 0; i < n; i++)
+      setobj(&a[i], mr_H_getnum(t, i+1));
+  }
+  objsort(a, 0, n - 1, sortdepth(n));
+  objinsertsort(a, n);
+  if (a != t->array) {
+    for (i = 0; i < n; i++)  /* all keys exist: no allocation here */
+      setobj2t(mr_H_setnum(L, t, i+1), &a[i]);
+    mr_M_freearray(L, a, n, TObject);
+  }
+  return 1;
+}
+
+
 static int mr_B_sort (mrp_State *L) {
   int n = mr_aux_getn(L, 1);
   mr_L_checkstack(L, 40, "");  /* assume array is smaller than 2^40 */
   if (!mrp_isnoneornil(L, 2))  /* is there a 2nd argument? */
     mr_L_checktype(L, 2, MRP_TFUNCTION);
   mrp_settop(L, 2);  /* make sure there is two arguments */
-  mr_auxsort(L, 1, n);
+  if (!nativesort(L, n))
+    mr_auxsort(L, 1, n, sortdepth(n));
+  return 0;
+}
+
+
+/*
+** Stable sort: equal elements (by the order function) keep their
+** order, e.g. sprites with the same depth.  Runs of STABLERUN elements
+** are insertion sorted in place, then merged back and forth between
+** the table and an auxiliary table at index 3.
+*/
+
+#define STABLERUN	8
+
+static void auxinsertsort (mrp_State *L, int l, int u) {
+  int i, j;
+  for (i = l+1; i <= u; i++) {
+    mrp_rawgeti(L, 1, i);  /* a[i] */
+    for (j = i-1; j >= l; j--) {
+      mrp_rawgeti(L, 1, j);
+      if (!sort_comp(L, -2, -1)) {  /* a[i] >= a[j]? */
+        mrp_pop(L, 1);
+        break;
+      }
+      mrp_rawseti(L, 1, j+1);  /* a[j+1] = a[j] */
+    }
+    if (j+1 != i)
+      mrp_rawseti(L, 1, j+1);  /* a[j+1] = a[i] */
+    else
+      mrp_pop(L, 1);
+  }
+}
+
+/* merges src[lo..mid-1] and src[mid..hi-1] into dst[lo..hi-1] */
+static void auxmerge (mrp_State *L, int src, int dst, int lo, int mid,
+                      int hi) {
+  int i = lo, j = mid, k = lo;
+  while (i < mid && j < hi) {
+    mrp_rawgeti(L, src, j);
+    mrp_rawgeti(L, src, i);
+    if (sort_comp(L, -2, -1)) {  /* right < left? */
+      mrp_pop(L, 1);
+      j++;
+    }
+    else {
+      mrp_remove(L, -2);
+      i++;
+    }
+    mrp_rawseti(L, dst, k++);
+  }
+  for (; i < mid; i++) {
+    mrp_rawgeti(L, src, i);
+    mrp_rawseti(L, dst, k++);
+  }
+  for (; j < hi; j++) {
+    mrp_rawgeti(L, src, j);
+    mrp_rawseti(L, dst, k++);
+  }
+}
+
+static int mr_B_stablesort (mrp_State *L) {
+  int n = mr_aux_getn(L, 1);
+  int i, w, src = 1, dst = 3;
+  mr_L_checkstack(L, 10, "");
+  if (!mrp_isnoneornil(L, 2))  /* is there a 2nd argument? */
+    mr_L_checktype(L, 2, MRP_TFUNCTION);
+  mrp_settop(L, 2);  /* make sure there is two arguments */
+  if (nativesort(L, n))
+    return 0;
+  for (i = 1; i <= n; i += STABLERUN)
+    auxinsertsort(L, i, (i+STABLERUN-1 < n) ? i+STABLERUN-1 : n);
+  if (n <= STABLERUN)
+    return 0;
+  mrp_newtable(L);  /* auxiliary table (index 3) */
+  for (w = STABLERUN; w < n; w *= 2) {
+    int lo;
+    for (lo = 1; lo <= n; lo += 2*w) {
+      int mid = (lo+w <= n+1) ? lo+w : n+1;
+      int hi = (lo+2*w <= n+1) ? lo+2*w : n+1;
+      auxmerge(L, src, dst, lo, mid, hi);
+    }
+    src = dst; dst = (dst == 1) ? 3 : 1;
+  }
+  if (src != 1) {  /* result is in the auxiliary table? */
+    for (i = 1; i <= n; i++) {
+      mrp_rawgeti(L, 3, i);
+      mrp_rawseti(L, 1, i);
+    }
+  }
   return 0;
 }
 
@@ -227,9 +522,11 @@ static int mr_B_sort (mrp_State *L) {
 
 static int mr_B_save (mrp_State *L) {
   WriterInfo wi;
+  int count;
   
   wi.buf = NULL;
   wi.buflen = 0;
+  wi.bufsize = 0;
   
   mrp_settop(L, 2);
               /*perms? rootTable?  */
@@ -241,38 +538,45 @@ static int mr_B_save (mrp_State *L) {
   //mrp_insert(L, 1);
               /* perms rootTable */
   
-  mr_store_persist(L, mr_str_bufwriter, &wi);
+  count = mr_store_persist(L, mr_str_bufwriter, &wi);
+  MEMCPY(wi.buf + MR_STORE_COUNTPOS, &count, sizeof(int));
   
   mrp_settop(L, 0);
               /* (empty) */
   mrp_pushlstring(L, wi.buf, wi.buflen);
               /* str */
-  mr_M_freearray(L, wi.buf, wi.buflen, char);
+  mr_M_freearray(L, wi.buf, wi.bufsize, char);
   return 1;
 }
 
+/* The reader points into the string, which must stay on the stack: it may
+ * have no other reference, and unpersist allocates (and collects) a lot */
+static int mr_B_loadstr (mrp_State *L) {
+   LoadInfo *li = (LoadInfo *)mrp_touserdata(L, 2);
+   mrp_settop(L, 1);
+   				/* perms */
+   mr_store_unpersist(L, mr_str_bufreader, li);
+   				/* perms rootobj */
+   return 1;
+}
+
 static int mr_B_load (mrp_State *L) {
    LoadInfo li;
    				/* perms? str? ...? */
    mrp_settop(L, 2);
    				/* perms? str? */
    li.buf = mr_L_checklstring(L, 2, &li.size);
-   				/* perms? str */
-   mrp_pop(L, 1);
-   /* It is conceivable that the buffer might now be collectable,
-    * which would cause problems in the reader. I can't think of
-    * any situation where there would be no other reference to the
-    * buffer, so for now I'll leave it alone, but this is a potential
-    * bug. */
-   				/* perms? */
    mr_L_checktype(L, 1, MRP_TTABLE);
-   				/* perms */
-   mr_store_unpersist(L, mr_str_bufreader, &li);
-   				/* perms rootobj */
+   				/* perms str */
+   mrp_pushcfunction(L, mr_B_loadstr);
+   mrp_pushvalue(L, 1);
+   mrp_pushlightuserdata(L, &li);
+   mrp_call(L, 2, 1);
+   				/* perms str rootobj */
    return 1;
 }
 
-static mr_L_reg tab_funcs[21];
+static mr_L_reg tab_funcs[22];
 
 void mr_tablib_init(void) {
     tab_funcs[0].name = "concat";
@@ -317,8 +621,10 @@ void mr_tablib_init(void) {
     tab_funcs[19].name = "setn";
     tab_funcs[19].func = mr_B_setn;
 #endif
-    tab_funcs[20].name = NULL;
-    tab_funcs[20].func = NULL;
+    tab_funcs[20].name = "stableSort";
+    tab_funcs[20].func = mr_B_stablesort;
+    tab_funcs[21].name = NULL;
+    tab_funcs[21].func = NULL;
 }
 
 MRPLIB_API int mrp_open_table(mrp_State *L) {
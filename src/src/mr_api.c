@@ -4,6 +4,8 @@
 //#define lapi_c
 
 #include "../include/mr.h"
+#include "../include/mem.h"
+#include "../include/mythroad.h"
 
 #include "./h/mr_api.h"
 #include "./h/mr_debug.h"
@@ -558,6 +560,40 @@ MRP_API void mrp_rawgeti (mrp_State *L, int idx, int n) {
 }
 
 
+/*
+** pushes the global named by the string at registry[ref], like
+** mrp_gettable(L, MRP_GLOBALSINDEX). `*slot' remembers the node of the
+** globals table that holds that name: while the node still holds it
+** (no rehash moved it) its value is the current one, so later calls
+** skip hashing; assignments to the global land in that same node.
+*/
+MRP_API void mrp_getglobalref (mrp_State *L, int ref, void **slot) {
+  const TObject *k;
+  Table *g;
+  Node *n;
+  mrp_lock(L);
+  k = mr_H_getnum(hvalue(registry(L)), ref);
+  api_check(L, ttisstring(k));
+  g = hvalue(gt(L));
+  n = cast(Node *, *slot);
+  if (n == NULL || n < g->node || n >= g->node + sizenode(g) ||
+      !ttisstring(gkey(n)) || tsvalue(gkey(n)) != tsvalue(k)) {
+    n = mr_H_getstrnode(g, tsvalue(k));
+    *slot = n;
+  }
+  if (n != NULL && !ttisnil(gval(n))) {
+    setobj2s(L->top, gval(n));
+    api_incr_top(L);
+  }
+  else {  /* not set: let a metatable on the globals answer */
+    setobj2s(L->top, k);
+    api_incr_top(L);
+    setobj2s(L->top - 1, mr_V_gettable(L, gt(L), L->top - 1, 0));
+  }
+  mrp_unlock(L);
+}
+
+
 MRP_API void mrp_newtable (mrp_State *L) {
   mrp_lock(L);
   mr_C_checkGC(L);
@@ -786,6 +822,56 @@ MRP_API int mrp_load (mrp_State *L, mrp_Chunkreader reader, void *data,
 }
 
 
+/*
+** load a chunk held in one block returned by `_mr_readFile'; the block is
+** owned by the VM from now on (functions loaded lazily read from it) and
+** given back with `_mr_readFileRelease'
+*/
+MRP_API int mrp_loadchunk (mrp_State *L, char *buff, size_t size,
+                           const char *chunkname) {
+  ZIO z;
+  Ubuffer *ub;
+  int status;
+  mrp_lock(L);
+  if (!chunkname) chunkname = "?";
+  ub = mr_U_newbuffer(L, buff, size, G(L)->loadmode);
+  if (ub == NULL) {
+    _mr_readFileRelease(buff, size);
+    setsvalue2s(L->top, mr_S_newliteral(L, MEMERRMSG));
+    api_incr_top(L);
+    mrp_unlock(L);
+    return MRP_ERRMEM;
+  }
+  mr_Z_init(&z, mr_U_chunkreader, ub, chunkname);
+  z.n = size;
+  z.p = buff;
+  status = mr_D_protectedparser(L, &z,
+                                (size > 0 && *buff == MRP_SIGNATURE[0]));
+  mr_U_unrefbuffer(L, ub);
+  mrp_unlock(L);
+  return status;
+}
+
+
+MRP_API int mrp_setloadmode (mrp_State *L, int mode) {
+  int old;
+  mrp_lock(L);
+  old = G(L)->loadmode;
+  G(L)->loadmode = cast(lu_byte, mode);
+  mrp_unlock(L);
+  return old;
+}
+
+
+MRP_API int mrp_getstripped (mrp_State *L) {
+  int n;
+  mrp_lock(L);
+  n = cast(int, G(L)->stripped);
+  mrp_unlock(L);
+  return n;
+}
+
+
 MRP_API int mrp_dump (mrp_State *L, mrp_Chunkwriter writer, void *data) {
   int status;
   TObject *o;
@@ -11,6 +11,7 @@
 #include "./h/mr_func.h"
 #include "./h/mr_object.h"
 #include "./h/mr_opcodes.h"
+#include "./h/mr_prof.h"
 #include "./h/mr_state.h"
 #include "./h/mr_string.h"
 #include "./h/mr_table.h"
@@ -38,6 +39,8 @@ static int currentline (CallInfo *ci) {
   int pc = currentpc(ci);
   if (pc < 0)
     return -1;  /* only active lua functions have current-line information */
+  else if (ci_func(ci)->l.p->lineinfo == NULL)
+    return ci_func(ci)->l.p->lineDefined;  /* stripped: where it starts */
   else
     return getline(ci_func(ci)->l.p, pc);
 }
@@ -62,7 +65,7 @@ MRP_API int mrp_sethook (mrp_State *L, mrp_Hook func, int mask, int count) {
   L->hook = func;
   L->basehookcount = count;
   resethookcount(L);
-  L->hookmask = cast(lu_byte, mask);
+  L->hookmask = cast(lu_byte, mask) | (L->hookmask & MRP_MASKINTERNAL);
   L->hookinit = 0;
   return 1;
 }
@@ -74,7 +77,7 @@ MRP_API mrp_Hook mrp_gethook (mrp_State *L) {
 
 
 MRP_API int mrp_gethookmask (mrp_State *L) {
-  return L->hookmask;
+  return L->hookmask & ~MRP_MASKINTERNAL;
 }
 
 
@@ -103,6 +103,7 @@ static void DumpConstants(const Proto* f, DumpState* D) {
 }
 
 static void DumpFunction(const Proto* f, const TString* p, DumpState* D) {
+    mr_U_checklazy(D->L, (Proto*)f);
     DumpString((f->source == p) ? NULL : f->source, D);
     DumpInt(f->lineDefined, D);
     DumpByte(f->nups, D);
@@ -9,6 +9,7 @@
 #include "./h/mr_mem.h"
 #include "./h/mr_object.h"
 #include "./h/mr_state.h"
+#include "./h/mr_undump.h"
 
 
 #define sizeCclosure(n)	(cast(int, sizeof(CClosure)) + \
@@ -88,17 +89,21 @@ Proto *mr_F_newproto (mrp_State *L) {
   f->locvars = NULL;
   f->lineDefined = 0;
   f->source = NULL;
+  f->ubuf = NULL;
+  f->ubpos = 0;
   return f;
 }
 
 
 void mr_F_freeproto (mrp_State *L, Proto *f) {
-  mr_M_freearray(L, f->code, f->sizecode, Instruction);
+  if (f->ubuf == NULL)  /* else `code' is inside the chunk */
+    mr_M_freearray(L, f->code, f->sizecode, Instruction);
   mr_M_freearray(L, f->p, f->sizep, Proto *);
   mr_M_freearray(L, f->k, f->sizek, TObject);
   mr_M_freearray(L, f->lineinfo, f->sizelineinfo, int);
   mr_M_freearray(L, f->locvars, f->sizelocvars, struct LocVar);
   mr_M_freearray(L, f->upvalues, f->sizeupvalues, TString *);
+  if (f->ubuf) mr_U_unrefbuffer(L, f->ubuf);
   mr_M_freelem(L, f);
 }
 
@@ -9,6 +9,7 @@
 #include "./h/mr_gc.h"
 #include "./h/mr_mem.h"
 #include "./h/mr_object.h"
+#include "./h/mr_prof.h"
 #include "./h/mr_state.h"
 #include "./h/mr_string.h"
 #include "./h/mr_table.h"
@@ -436,6 +437,23 @@ void mr_C_sweep (mrp_State *L, int all) {
 }
 
 
+/*
+** the chunk names in the profiler's samples outlive their chunks as long
+** as the samples are kept
+*/
+static void markprofiler (Profiler *pr) {
+  int i, d, n;
+  n = (pr->taken < cast(lu_mem, pr->nsamples)) ? cast(int, pr->taken)
+                                               : pr->nsamples;
+  for (i = 0; i < n; i++) {
+    const ProfFrame *f = pr->frames + i * PROF_MAXDEPTH;
+    for (d = 0; d < pr->depth[i]; d++) {
+      if (f[d].source) stringmark(f[d].source);
+    }
+  }
+}
+
+
 /* mark root set */
 static void markroot (GCState *st, mrp_State *L) {
   global_State *g = st->g;
@@ -444,6 +462,7 @@ static void markroot (GCState *st, mrp_State *L) {
   traversestack(st, g->mainthread);
   if (L != g->mainthread)  /* another thread is running? */
     markvalue(st, L);  /* cannot collect it */
+  if (g->prof) markprofiler(g->prof);
 }
 
 
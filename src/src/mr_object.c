@@ -101,9 +101,77 @@ int mr_O_rawequalObj (const TObject *t1, const TObject *t2) {
 }
 
 
+#ifdef USE_INT
+
+/*
+** integer numbers: decimal conversions without going through the
+** generic printf/strtol code (numbers are converted all the time when
+** scripts build texts); results are the same as "%d" and `strtol'
+*/
+
+static const char digits2[] =
+  "00010203040506070809101112131415161718192021222324252627282930313233343536373839"
+  "40414243444546474849505152535455565758596061626364656667686970717273747576777879"
+  "8081828384858687888990919293949596979899";
+
+
+int mr_O_num2str (char *s, mrp_Number n) {
+  char buff[12];  /* 10 digits and sign */
+  char *p = buff + sizeof(buff);
+  unsigned int u = (n < 0) ? 0u - cast(unsigned int, n) : cast(unsigned int, n);
+  int l;
+  while (u >= 100) {
+    unsigned int i = (u % 100) << 1;
+    u /= 100;
+    *--p = digits2[i+1];
+    *--p = digits2[i];
+  }
+  if (u >= 10) {
+    *--p = digits2[(u << 1) + 1];
+    *--p = digits2[u << 1];
+  }
+  else
+    *--p = cast(char, '0' + u);
+  if (n < 0) *--p = '-';
+  l = cast(int, buff + sizeof(buff) - p);
+  MEMCPY(s, p, l);
+  s[l] = '\0';
+  return l;
+}
+
+
+/* digits that cannot overflow an `int' */
+#define MAXFASTDIGITS	9
+
+
+static int faststr2d (const char *s, mrp_Number *result) {
+  unsigned int acc = 0;
+  int neg = 0, n = 0;
+  while (mr_isspace(cast(unsigned char, *s))) s++;
+  if (*s == '-') { neg = 1; s++; }
+  else if (*s == '+') s++;
+  while (*s >= '0' && *s <= '9') {
+    if (++n > MAXFASTDIGITS) return -1;  /* leave it to `mrp_str2number' */
+    acc = acc*10 + (*s++ - '0');
+  }
+  if (n == 0) return 0;  /* no conversion */
+  while (mr_isspace(cast(unsigned char, *s))) s++;
+  if (*s != '\0') return 0;  /* invalid trailing characters? */
+  *result = neg ? -cast(mrp_Number, acc) : cast(mrp_Number, acc);
+  return 1;
+}
+
+#endif
+
+
 int mr_O_str2d (const char *s, mrp_Number *result) {
   char *endptr;
-  mrp_Number res = mrp_str2number(s, &endptr);
+  mrp_Number res;
+#ifdef USE_INT
+  int r = faststr2d(s, result);
+  if (r >= 0) return r;
+#endif
+  res = mrp_str2number(s, &endptr);
   if (endptr == s) return 0;  /* no conversion */
   while (mr_isspace((unsigned char)(*endptr))) endptr++;
   if (*endptr != '\0') return 0;  /* invalid trailing characters? */
@@ -0,0 +1,317 @@
+
+
+//#define lprof_c
+
+#include "../include/mr.h"
+
+#include "./h/mr_debug.h"
+#include "./h/mr_do.h"
+#include "./h/mr_mem.h"
+#include "./h/mr_object.h"
+#include "./h/mr_opcodes.h"
+#include "./h/mr_prof.h"
+#include "./h/mr_state.h"
+#include "./h/mr_string.h"
+#include "./h/mr_table.h"
+#include "./h/mr_zio.h"
+
+
+/*
+** Sampling profiler.
+** While it runs, every thread that executes Lua code has MRP_MASKPROF
+** set in its hook mask; `mr_R_tick' then takes a sample of the call
+** chain every `period' instructions, or at the next instruction after
+** the host called `mrp_profsignal' (e.g. from a timer).  Samples go to
+** a ring; `mrp_profdump' aggregates them in folded-stack format
+** ("outer;inner count" per line), which flame graph tools read directly.
+*/
+
+
+static void takesample (mrp_State *L, Profiler *pr) {
+  ProfFrame *f = pr->frames + pr->next * PROF_MAXDEPTH;
+  CallInfo *ci;
+  int d = 0;
+  for (ci = L->ci; ci != L->base_ci && d < PROF_MAXDEPTH; ci--, d++) {
+    if (ci->state & CI_C) {
+      f[d].source = NULL;
+      f[d].linedefined = f[d].currentline = -1;
+    }
+    else {
+      Proto *p = ci_func(ci)->l.p;
+      const Instruction *pc = (ci->state & CI_HASFRAME) ? *ci->u.l.pc
+                                                        : ci->u.l.savedpc;
+      f[d].source = p->source;  /* kept alive by the GC (see `markroot') */
+      f[d].linedefined = p->lineDefined;
+      f[d].currentline = (p->lineinfo) ? getline(p, pcRel(pc, p))
+                                       : p->lineDefined;
+    }
+  }
+  pr->depth[pr->next] = cast(lu_byte, d);
+  if (++pr->next == pr->nsamples) pr->next = 0;
+  pr->taken++;
+}
+
+
+void mr_R_tick (mrp_State *L) {
+  Profiler *pr = G(L)->prof;
+  if (pr == NULL || !pr->on) {  /* stopped while this thread had the bit? */
+    L->hookmask &= ~MRP_MASKPROF;
+    return;
+  }
+  if (pr->flags & MRP_PROF_OPS)
+    pr->ops[GET_OPCODE(*(*L->ci->u.l.pc - 1))]++;
+  if (pr->pending || (pr->period > 0 && --pr->count == 0)) {
+    pr->pending = 0;
+    pr->count = pr->period;
+    takesample(L, pr);
+  }
+}
+
+
+void mr_R_free (mrp_State *L) {
+  Profiler *pr = G(L)->prof;
+  if (pr == NULL) return;
+  G(L)->prof = NULL;
+  mr_M_freearray(L, pr->frames, pr->nsamples * PROF_MAXDEPTH, ProfFrame);
+  mr_M_freearray(L, pr->depth, pr->nsamples, lu_byte);
+  mr_M_freelem(L, pr);
+}
+
+
+struct ProfStart {
+  int period;
+  int nsamples;
+  int flags;
+};
+
+
+static void f_profstart (mrp_State *L, void *ud) {
+  struct ProfStart *ps = cast(struct ProfStart *, ud);
+  Profiler *pr = mr_M_new(L, Profiler);
+  int i;
+  pr->period = pr->count = ps->period;
+  pr->pending = 0;
+  pr->on = 0;
+  pr->flags = cast(lu_byte, ps->flags);
+  pr->nsamples = 0;
+  pr->next = 0;
+  pr->taken = 0;
+  pr->depth = NULL;
+  pr->frames = NULL;
+  for (i = 0; i < NUM_OPCODES; i++) pr->ops[i] = 0;
+  G(L)->prof = pr;  /* from now on `mr_R_free' can clean up */
+  pr->depth = mr_M_newvector(L, ps->nsamples, lu_byte);
+  pr->nsamples = ps->nsamples;
+  pr->frames = mr_M_newvector(L, ps->nsamples * PROF_MAXDEPTH, ProfFrame);
+  pr->on = 1;
+}
+
+
+/*
+** (re)starts the profiler, discarding previous samples;
+** `period' <= 0 takes samples only when signaled
+*/
+MRP_API int mrp_profstart (mrp_State *L, int period, int nsamples, int flags) {
+  struct ProfStart ps;
+  int status;
+  mrp_lock(L);
+  mr_R_free(L);
+  ps.period = (period > 0) ? period : 0;
+  ps.nsamples = (nsamples > 0) ? nsamples : PROF_NSAMPLES;
+  ps.flags = flags;
+  status = mr_D_rawrunprotected(L, f_profstart, &ps);
+  if (status != 0)
+    mr_R_free(L);
+  else {
+    L->hookmask |= MRP_MASKPROF;
+    G(L)->mainthread->hookmask |= MRP_MASKPROF;
+  }
+  mrp_unlock(L);
+  return status;
+}
+
+
+MRP_API void mrp_profstop (mrp_State *L) {
+  mrp_lock(L);
+  if (G(L)->prof) G(L)->prof->on = 0;  /* other threads clear their bit */
+  L->hookmask &= ~MRP_MASKPROF;
+  G(L)->mainthread->hookmask &= ~MRP_MASKPROF;
+  mrp_unlock(L);
+}
+
+
+/*
+** this function can be called asynchronous (e.g. from a timer or signal)
+*/
+MRP_API void mrp_profsignal (mrp_State *L) {
+  Profiler *pr = G(L)->prof;
+  if (pr) pr->pending = 1;
+}
+
+
+static void addlstr (mrp_State *L, size_t *n, const char *s, size_t l) {
+  char *b = mr_Z_openspace(L, &G(L)->buff, *n + l);
+  MEMCPY(b + *n, s, l);
+  *n += l;
+}
+
+
+static void addframe (mrp_State *L, size_t *n, const ProfFrame *f,
+                      int lines) {
+  char s[32];
+  if (f->source == NULL) {
+    addlstr(L, n, "[C]", 3);
+  }
+  else {
+    const char *src = getstr(f->source);
+    size_t l = f->source->tsv.len;
+    if (l > 0 && (*src == '@' || *src == '=')) { src++; l--; }
+    addlstr(L, n, src, l);
+    if (lines)
+      SPRINTF(s, ":%d:%d", f->linedefined, f->currentline);
+    else
+      SPRINTF(s, ":%d", f->linedefined);
+    addlstr(L, n, s, STRLEN(s));
+  }
+}
+
+
+/*
+** pushes the folded stacks of all samples in the ring (plus opcode
+** counts as "[opcodes];OPn count" when MRP_PROF_OPS is on) and returns
+** how many samples were aggregated
+*/
+MRP_API int mrp_profdump (mrp_State *L) {
+  Profiler *pr;
+  Table *t;
+  TObject key;
+  TObject *v;
+  mrp_Number c;
+  StkId k;
+  size_t n;
+  int i, d, first, count;
+  char s[32];
+  mrp_lock(L);
+  mr_D_checkstack(L, 3);  /* table, key, value */
+  pr = G(L)->prof;
+  t = mr_H_new(L, 0, 0);
+  sethvalue(L->top, t);  /* anchor it while strings are created */
+  L->top++;
+  count = 0;
+  if (pr) {
+    count = (pr->taken < cast(lu_mem, pr->nsamples)) ? cast(int, pr->taken)
+                                                     : pr->nsamples;
+    first = (pr->taken > cast(lu_mem, pr->nsamples)) ? pr->next : 0;
+    for (i = 0; i < count; i++) {
+      int slot = (first + i) % pr->nsamples;
+      const ProfFrame *f = pr->frames + slot * PROF_MAXDEPTH;
+      n = 0;
+      for (d = pr->depth[slot] - 1; d >= 0; d--) {  /* outermost first */
+        addframe(L, &n, f + d, pr->flags & MRP_PROF_LINES);
+        if (d > 0) addlstr(L, &n, ";", 1);
+      }
+      setsvalue(&key, mr_S_newlstr(L, mr_Z_buffer(&G(L)->buff), n));
+      v = mr_H_set(L, t, &key);
+      c = ttisnil(v) ? 0 : nvalue(v);
+      setnvalue(v, c + 1);
+    }
+  }
+  /* write one line per distinct stack */
+  n = 0;
+  k = L->top;
+  L->top += 2;
+  setnilvalue(k);
+  while (mr_H_next(L, t, k)) {
+    addlstr(L, &n, svalue(k), tsvalue(k)->tsv.len);
+    SPRINTF(s, " %d\n", cast(int, nvalue(k + 1)));
+    addlstr(L, &n, s, STRLEN(s));
+  }
+  if (pr && (pr->flags & MRP_PROF_OPS)) {
+    for (i = 0; i < NUM_OPCODES; i++) {
+      if (pr->ops[i] == 0) continue;
+#ifdef MRP_OPNAMES
+      SPRINTF(s, "[opcodes];%s %lu\n", mr_P_opnames[i],
+              cast(unsigned long, pr->ops[i]));
+#else
+      SPRINTF(s, "[opcodes];OP%d %lu\n", i, cast(unsigned long, pr->ops[i]));
+#endif
+      addlstr(L, &n, s, STRLEN(s));
+    }
+  }
+  L->top -= 2;
+  setsvalue2s(L->top - 1, mr_S_newlstr(L, mr_Z_buffer(&G(L)->buff), n));
+  mrp_unlock(L);
+  return count;
+}
+
+
+/*
+** Instruction budget.
+** While a budget is set, every thread has MRP_MASKBUDGET in its hook
+** mask and `mr_V_execute' decrements `budgetleft' before each
+** instruction; when it runs out, `mr_R_overbudget' raises an error.
+** `budgetleft' stays negative until the budget is set again, so every
+** further instruction raises too and a script cannot `pcall' its way
+** past the limit: the error reaches the host's call.
+*/
+
+
+void mr_R_overbudget (mrp_State *L) {
+  global_State *g = G(L);
+  if (g->budget == 0) {  /* turned off while this thread had the bit? */
+    L->hookmask &= ~MRP_MASKBUDGET;
+    g->budgetleft = MAX_INT;
+    return;
+  }
+  g->budgetleft = -1;
+  mr_G_runerror(L, "instruction budget exceeded");
+}
+
+
+/*
+** gives the state `limit' instructions (until the next call);
+** `limit' <= 0 removes the budget
+*/
+MRP_API void mrp_setbudget (mrp_State *L, int limit) {
+  global_State *g;
+  mrp_lock(L);
+  g = G(L);
+  if (limit <= 0) {
+    g->budget = 0;  /* threads clear their bit in `mr_R_overbudget' */
+    g->budgetleft = MAX_INT;
+    L->hookmask &= ~MRP_MASKBUDGET;
+    g->mainthread->hookmask &= ~MRP_MASKBUDGET;
+  }
+  else {
+    if (g->budget == 0) {  /* arm every existing thread */
+      GCObject *o;
+      for (o = g->rootgc; o != NULL; o = o->gch.next) {
+        if (o->gch.tt == MRP_TTHREAD)
+          gcototh(o)->hookmask |= MRP_MASKBUDGET;
+      }
+      g->mainthread->hookmask |= MRP_MASKBUDGET;
+    }
+    g->budget = limit;
+    g->budgetleft = limit;
+  }
+  mrp_unlock(L);
+}
+
+
+/*
+** instructions executed since the budget was set; more than the limit
+** when it was exceeded
+*/
+MRP_API int mrp_budgetused (mrp_State *L) {
+  global_State *g = G(L);
+  return (g->budget == 0) ? 0 : g->budget - g->budgetleft;
+}
+
+
+/*
+** ends the current period at the next instruction;
+** can be called asynchronous (e.g. from a watchdog timer)
+*/
+MRP_API void mrp_budgetstop (mrp_State *L) {
+  if (G(L)->budget != 0) G(L)->budgetleft = 0;
+}
@@ -9,6 +9,7 @@
 #include "./h/mr_gc.h"
 #include "./h/mr_lex.h"
 #include "./h/mr_mem.h"
+#include "./h/mr_prof.h"
 #include "./h/mr_state.h"
 #include "./h/mr_string.h"
 #include "./h/mr_table.h"
@@ -93,6 +94,11 @@ static void f_mrpopen (mrp_State *L, void *ud) {
   setnilvalue(registry(L));
   mr_Z_initbuffer(L, &g->buff);
   g->panic = default_panic;
+  g->loadmode = 0;
+  g->stripped = 0;
+  g->prof = NULL;
+  g->budget = 0;
+  g->budgetleft = MAX_INT;
   g->rootgc = NULL;
   g->rootudata = NULL;
   g->tmudata = NULL;
@@ -136,6 +142,7 @@ static void preinit_state (mrp_State *L) {
 static void close_state (mrp_State *L) {
   mr_F_close(L, L->stack);  /* close all upvalues for this thread */
   if (G(L)) {  /* close global state */
+    mr_R_free(L);
     mr_C_sweep(L, 1);  /* collect all elements */
     mrp_assert(G(L)->rootgc == NULL);
     mrp_assert(G(L)->rootudata == NULL);
@@ -156,6 +163,7 @@ mrp_State *mr_E_newthread (mrp_State *L) {
   mr_C_link(L, valtogco(L1), MRP_TTHREAD);
   preinit_state(L1);
   L1->l_G = L->l_G;
+  L1->hookmask = L->hookmask & MRP_MASKINTERNAL;  /* coroutines too */
   stack_init(L1, L);  /* init stack */
   setobj2n(gt(L1), gt(L));  /* share table of globals */
   return L1;
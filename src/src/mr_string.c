@@ -40,17 +40,9 @@ void mr_S_resize (mrp_State *L, int newsize) {
 }
 
 
-static TString *newlstr (mrp_State *L, const char *str, size_t l, lu_hash h) {
-  TString *ts = cast(TString *, mr_M_malloc(L, sizestring(l)));
-  stringtable *tb;
-  ts->tsv.len = l;
+static TString *linkstr (mrp_State *L, TString *ts, lu_hash h) {
+  stringtable *tb = &G(L)->strt;
   ts->tsv.hash = h;
-  ts->tsv.marked = 0;
-  ts->tsv.tt = MRP_TSTRING;
-  ts->tsv.reserved = 0;
-  MEMCPY(ts+1, str, l*sizeof(char));//ouli brew
-  ((char *)(ts+1))[l] = '\0';  /* ending 0 */
-  tb = &G(L)->strt;
   h = lmod(h, tb->size);
   ts->tsv.next = tb->hash[h];  /* chain new entry */
   tb->hash[h] = valtogco(ts);
@@ -61,13 +53,18 @@ static TString *newlstr (mrp_State *L, const char *str, size_t l, lu_hash h) {
 }
 
 
-TString *mr_S_newlstr (mrp_State *L, const char *str, size_t l) {
-  GCObject *o;
+static lu_hash hashstr (const char *str, size_t l) {
   lu_hash h = (lu_hash)l;  /* seed */
   size_t step = (l>>5)+1;  /* if string is too long, don't hash all its chars */
   size_t l1;
   for (l1=l; l1>=step; l1-=step)  /* compute hash */
     h = h ^ ((h<<5)+(h>>2)+(unsigned char)(str[l1-1]));
+  return h;
+}
+
+
+static TString *findstr (mrp_State *L, const char *str, size_t l, lu_hash h) {
+  GCObject *o;
   for (o = G(L)->strt.hash[lmod(h, G(L)->strt.size)];
        o != NULL;
        o = o->gch.next) {
@@ -75,7 +72,47 @@ TString *mr_S_newlstr (mrp_State *L, const char *str, size_t l) {
     if (ts->tsv.len == l && (MEMCMP(str, getstr(ts), l) == 0))
       return ts;
   }
-  return newlstr(L, str, l, h);  /* not found */
+  return NULL;
+}
+
+
+/*
+** creates a string that is not in the string table yet; the caller
+** fills its `l' chars and must hand it to `mr_S_intern' before anything
+** else can raise an error or run a collection
+*/
+TString *mr_S_newraw (mrp_State *L, size_t l) {
+  TString *ts = cast(TString *, mr_M_malloc(L, sizestring(l)));
+  ts->tsv.len = l;
+  ts->tsv.hash = 0;
+  ts->tsv.marked = 0;
+  ts->tsv.tt = MRP_TSTRING;
+  ts->tsv.reserved = 0;
+  ts->tsv.next = NULL;
+  ((char *)(ts+1))[l] = '\0';  /* ending 0 */
+  return ts;
+}
+
+
+TString *mr_S_intern (mrp_State *L, TString *ts) {
+  size_t l = ts->tsv.len;
+  lu_hash h = hashstr(getstr(ts), l);
+  TString *old = findstr(L, getstr(ts), l, h);
+  if (old != NULL) {  /* already there: drop the new copy */
+    mr_M_free(L, ts, sizestring(l));
+    return old;
+  }
+  return linkstr(L, ts, h);
+}
+
+
+TString *mr_S_newlstr (mrp_State *L, const char *str, size_t l) {
+  lu_hash h = hashstr(str, l);
+  TString *ts = findstr(L, str, l, h);
+  if (ts != NULL) return ts;
+  ts = mr_S_newraw(L, l);  /* not found */
+  MEMCPY(ts+1, str, l*sizeof(char));//ouli brew
+  return linkstr(L, ts, h);
 }
 
 
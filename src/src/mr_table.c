@@ -440,6 +440,21 @@ const TObject *mr_H_getstr (Table *t, TString *key) {
 }
 
 
+/*
+** node holding string `key', or NULL; stays valid until `t' is resized
+** (see mrp_getglobalref)
+*/
+Node *mr_H_getstrnode (Table *t, TString *key) {
+  Node *n = hashstr(t, key);
+  do {
+    if (ttisstring(gkey(n)) && tsvalue(gkey(n)) == key)
+      return n;
+    else n = n->next;
+  } while (n);
+  return NULL;
+}
+
+
 /*
 ** main search function
 */
@@ -8,10 +8,13 @@
 
 
 #include "./h/mr_undump.h"
+#include "../include/mem.h"
+#include "../include/mythroad.h"
 #include "./h/mr_debug.h"
 #include "./h/mr_func.h"
 #include "./h/mr_mem.h"
 #include "./h/mr_opcodes.h"
+#include "./h/mr_state.h"
 #include "./h/mr_string.h"
 #include "./h/mr_zio.h"
 
@@ -23,6 +26,7 @@ typedef struct {
     Mbuffer* b;
     int swap;
     const char* name;
+    Ubuffer* ub; /* whole chunk in memory (see mrp_loadchunk) */
 } LoadState;
 
 static void unexpectedEOZ(LoadState* S) {
@@ -40,6 +44,14 @@ static void ezread(LoadState* S, void* b, int n) {
     if (r != 0) unexpectedEOZ(S);
 }
 
+/* only used when the whole chunk is in `S->ub' */
+static void ezskip(LoadState* S, int m, size_t size) {
+    ZIO* Z = S->Z;
+    if ((size_t)m > Z->n / size) unexpectedEOZ(S);
+    Z->n -= m * size;
+    Z->p += m * size;
+}
+
 static void LoadBlock(LoadState* S, void* b, size_t size) {
     if (S->swap) {
         char* p = (char*)b + size - 1;
@@ -85,15 +97,36 @@ static TString* LoadString(LoadState* S) {
     size_t size = LoadSize(S);
     if (size == 0)
         return NULL;
-    else {
+    else if (S->ub) { /* intern it straight from the chunk */
+        const char* s = S->Z->p;
+        ezskip(S, 1, size);
+        return mr_S_newlstr(S->L, s, size - 1);
+    } else {
         char* s = mr_Z_openspace(S->L, S->b, size);
         ezread(S, s, size);
         return mr_S_newlstr(S->L, s, size - 1); /* remove trailing '\0' */
     }
 }
 
+static void SkipString(LoadState* S) {
+    size_t size = LoadSize(S);
+    if (size != 0) ezskip(S, 1, size);
+}
+
+#define Stripping(S) ((S)->ub && ((S)->ub->mode & MRP_LOAD_STRIP))
+
 static void LoadCode(LoadState* S, Proto* f) {
     int size = LoadInt(S);
+    if (S->ub && (S->ub->mode & MRP_LOAD_ALIAS) &&
+        (cast(lu_mem, S->Z->p) & (sizeof(Instruction) - 1)) == 0) {
+        const char* p = S->Z->p;
+        ezskip(S, size, sizeof(Instruction));
+        f->code = cast(Instruction*, p);
+        f->sizecode = size;
+        f->ubuf = S->ub;
+        S->ub->ref++;
+        return;
+    }
     f->code = mr_M_newvector(S->L, size, Instruction);
     f->sizecode = size;
     LoadVector(S, f->code, size, sizeof(*f->code));
@@ -102,6 +135,14 @@ static void LoadCode(LoadState* S, Proto* f) {
 static void LoadLocals(LoadState* S, Proto* f) {
     int i, n;
     n = LoadInt(S);
+    if (Stripping(S)) {
+        for (i = 0; i < n; i++) {
+            SkipString(S);
+            ezskip(S, 2, sizeof(int));
+        }
+        G(S->L)->stripped += n * sizeof(LocVar);
+        return;
+    }
     f->locvars = mr_M_newvector(S->L, n, LocVar);
     f->sizelocvars = n;
     for (i = 0; i < n; i++) {
@@ -113,6 +154,11 @@ static void LoadLocals(LoadState* S, Proto* f) {
 
 static void LoadLines(LoadState* S, Proto* f) {
     int size = LoadInt(S);
+    if (Stripping(S)) {
+        ezskip(S, size, sizeof(int));
+        G(S->L)->stripped += size * sizeof(int);
+        return;
+    }
     f->lineinfo = mr_M_newvector(S->L, size, int);
     f->sizelineinfo = size;
     LoadVector(S, f->lineinfo, size, sizeof(*f->lineinfo));
@@ -124,12 +170,18 @@ static void LoadUpvalues(LoadState* S, Proto* f) {
     if (n != 0 && n != f->nups)
         mr_G_runerror(S->L, "err:1002 in %s:%d:%d",
                       S->name, n, f->nups);  //bad nupvalues in %s: read %d; expected %d
+    if (Stripping(S)) {
+        for (i = 0; i < n; i++) SkipString(S);
+        G(S->L)->stripped += n * sizeof(TString*);
+        return;
+    }
     f->upvalues = mr_M_newvector(S->L, n, TString*);
     f->sizeupvalues = n;
     for (i = 0; i < n; i++) f->upvalues[i] = LoadString(S);
 }
 
 static Proto* LoadFunction(LoadState* S, TString* p);
+static Proto* LoadStub(LoadState* S, TString* p);
 
 static void LoadConstants(LoadState* S, Proto* f) {
     int i, n;
@@ -150,18 +202,21 @@ static void LoadConstants(LoadState* S, Proto* f) {
                 setnilvalue(o);
                 break;
             default:
-                mr_G_runerror(S->L, "err:1003 in %s:%d", t, S->name);  //bad constant type (%d) in %s
+                mr_G_runerror(S->L, "err:1003 in %s:%d", S->name, t);  //bad constant type (%d) in %s
                 break;
         }
     }
     n = LoadInt(S);
     f->p = mr_M_newvector(S->L, n, Proto*);
     f->sizep = n;
-    for (i = 0; i < n; i++) f->p[i] = LoadFunction(S, f->source);
+    if (S->ub && (S->ub->mode & MRP_LOAD_LAZY)) {
+        for (i = 0; i < n; i++) f->p[i] = LoadStub(S, f->source);
+    } else {
+        for (i = 0; i < n; i++) f->p[i] = LoadFunction(S, f->source);
+    }
 }
 
-static Proto* LoadFunction(LoadState* S, TString* p) {
-    Proto* f = mr_F_newproto(S->L);
+static void LoadProtoHeader(LoadState* S, Proto* f, TString* p) {
     f->source = LoadString(S);
     if (f->source == NULL) f->source = p;
     f->lineDefined = LoadInt(S);
@@ -169,6 +224,9 @@ static Proto* LoadFunction(LoadState* S, TString* p) {
     f->numparams = LoadByte(S);
     f->is_vararg = LoadByte(S);
     f->maxstacksize = LoadByte(S);
+}
+
+static void LoadBody(LoadState* S, Proto* f) {
     LoadLines(S, f);
     LoadLocals(S, f);
     LoadUpvalues(S, f);
@@ -177,6 +235,61 @@ static Proto* LoadFunction(LoadState* S, TString* p) {
 #ifndef TRUST_BINARIES
     if (!mr_G_checkcode(f)) mr_G_runerror(S->L, "err:1004 in %s", S->name);  //bad code in %s
 #endif
+}
+
+static Proto* LoadFunction(LoadState* S, TString* p) {
+    Proto* f = mr_F_newproto(S->L);
+    LoadProtoHeader(S, f, p);
+    LoadBody(S, f);
+    return f;
+}
+
+/*
+** lazy mode: skip a function body, checking only its layout
+*/
+static void SkipBody(LoadState* S) {
+    int i, n;
+    ezskip(S, LoadInt(S), sizeof(int)); /* lineinfo */
+    n = LoadInt(S);
+    for (i = 0; i < n; i++) {
+        SkipString(S);
+        ezskip(S, 2, sizeof(int));
+    }
+    n = LoadInt(S);
+    for (i = 0; i < n; i++) SkipString(S);
+    n = LoadInt(S);
+    for (i = 0; i < n; i++) {
+        int t = LoadByte(S);
+        switch (t) {
+            case MRP_TNUMBER:
+                ezskip(S, 1, sizeof(mrp_Number));
+                break;
+            case MRP_TSTRING:
+                SkipString(S);
+                break;
+            case MRP_TNIL:
+                break;
+            default:
+                mr_G_runerror(S->L, "err:1003 in %s:%d", S->name, t);  //bad constant type (%d) in %s
+                break;
+        }
+    }
+    n = LoadInt(S);
+    for (i = 0; i < n; i++) {
+        SkipString(S);
+        ezskip(S, 1, sizeof(int) + 4); /* lineDefined, nups ... maxstacksize */
+        SkipBody(S);
+    }
+    ezskip(S, LoadInt(S), sizeof(Instruction));
+}
+
+static Proto* LoadStub(LoadState* S, TString* p) {
+    Proto* f = mr_F_newproto(S->L);
+    LoadProtoHeader(S, f, p);
+    f->ubpos = S->Z->p - S->ub->data;
+    SkipBody(S);
+    f->ubuf = S->ub;
+    S->ub->ref++;
     return f;
 }
 
@@ -241,6 +354,7 @@ static void LoadHeader(LoadState* S) {
 
 static Proto* LoadChunk(LoadState* S) {
     LoadHeader(S);
+    if (S->swap) S->ub = NULL; /* bodies must be read byte by byte */
     return LoadFunction(S, NULL);
 }
 
@@ -259,9 +373,106 @@ Proto* mr_U_undump(mrp_State* L, ZIO* Z, Mbuffer* buff) {
     S.L = L;
     S.Z = Z;
     S.b = buff;
+    S.ub = (Z->reader == mr_U_chunkreader) ? (Ubuffer*)Z->data : NULL;
     return LoadChunk(&S);
 }
 
+/*
+** undump the body of a function skipped by LoadStub; the body is read
+** into a scratch proto and only moved into `f' when it loaded and checked,
+** so an error leaves `f' lazy (the next call raises again) and the
+** scratch proto to the collector
+*/
+void mr_U_loadlazy(mrp_State* L, Proto* f) {
+    LoadState S;
+    ZIO z;
+    Ubuffer* ub = f->ubuf;
+    Proto* t;
+    S.name = getstr(f->source);
+    if (*S.name == '$' || *S.name == '@') S.name++;
+    mr_Z_init(&z, mr_U_chunkreader, ub, S.name);
+    z.n = ub->size - f->ubpos;
+    z.p = ub->data + f->ubpos;
+    S.L = L;
+    S.Z = &z;
+    S.b = &G(L)->buff;
+    S.swap = 0;
+    S.ub = ub;
+    t = mr_F_newproto(L);
+    t->source = f->source;
+    t->lineDefined = f->lineDefined;
+    t->nups = f->nups;
+    t->numparams = f->numparams;
+    t->is_vararg = f->is_vararg;
+    t->maxstacksize = f->maxstacksize;
+    LoadBody(&S, t);
+    f->lineinfo = t->lineinfo;
+    f->sizelineinfo = t->sizelineinfo;
+    f->locvars = t->locvars;
+    f->sizelocvars = t->sizelocvars;
+    f->upvalues = t->upvalues;
+    f->sizeupvalues = t->sizeupvalues;
+    f->k = t->k;
+    f->sizek = t->sizek;
+    f->p = t->p;
+    f->sizep = t->sizep;
+    f->code = t->code;
+    f->sizecode = t->sizecode;
+    f->ubuf = t->ubuf; /* the chunk if `code' is inside it */
+    t->lineinfo = NULL;
+    t->sizelineinfo = 0;
+    t->locvars = NULL;
+    t->sizelocvars = 0;
+    t->upvalues = NULL;
+    t->sizeupvalues = 0;
+    t->k = NULL;
+    t->sizek = 0;
+    t->p = NULL;
+    t->sizep = 0;
+    t->code = NULL;
+    t->sizecode = 0;
+    t->ubuf = NULL;
+    mr_U_unrefbuffer(L, ub);
+}
+
+void mr_U_loadall(mrp_State* L, Proto* f) {
+    int i;
+    mr_U_checklazy(L, f);
+    for (i = 0; i < f->sizep; i++) mr_U_loadall(L, f->p[i]);
+}
+
+/*
+** chunk buffers: `data' comes from _mr_readFile (heap or a file
+** mapping) and is owned by the buffer from now on; the last unref gives
+** it back through _mr_readFileRelease
+*/
+Ubuffer* mr_U_newbuffer(mrp_State* L, char* data, size_t size, int mode) {
+    Ubuffer* ub = (Ubuffer*)MR_MALLOC(sizeof(Ubuffer));
+    if (ub == NULL) return NULL;
+    ub->data = data;
+    ub->size = size;
+    ub->ref = 1;
+    ub->mode = (lu_byte)mode;
+    G(L)->nblocks += size;
+    return ub;
+}
+
+void mr_U_unrefbuffer(mrp_State* L, Ubuffer* ub) {
+    if (--ub->ref == 0) {
+        G(L)->nblocks -= ub->size;
+        _mr_readFileRelease(ub->data, ub->size);
+        MR_FREE(ub, sizeof(Ubuffer));
+    }
+}
+
+/* the ZIO is set up over the whole buffer beforehand */
+const char* mr_U_chunkreader(mrp_State* L, void* ud, size_t* size) {
+    (void)L;
+    (void)ud;
+    *size = 0;
+    return NULL;
+}
+
 /*
 ** find byte order
 */
@@ -10,10 +10,12 @@
 #include "./h/mr_gc.h"
 #include "./h/mr_object.h"
 #include "./h/mr_opcodes.h"
+#include "./h/mr_prof.h"
 #include "./h/mr_state.h"
 #include "./h/mr_string.h"
 #include "./h/mr_table.h"
 #include "./h/mr_tm.h"
+#include "./h/mr_undump.h"
 #include "./h/mr_vm.h"
 
 
@@ -54,6 +56,8 @@ int mr_V_tostring (mrp_State *L, StkId obj) {
 
 static void traceexec (mrp_State *L) {
   lu_byte mask = L->hookmask;
+  if (mask & MRP_MASKPROF)  /* profiler running? */
+    mr_R_tick(L);
   if (mask & MRP_MASKCOUNT) {  /* instruction-hook set? */
     if (L->hookcount == 0) {
       resethookcount(L);
@@ -221,7 +225,7 @@ static int call_orderTM (mrp_State *L, const TObject *p1, const TObject *p2,
 }
 
 
-static int mr_V_strcmp (const TString *ls, const TString *rs) {
+int mr_V_strcmp (const TString *ls, const TString *rs) {
   const char *l = getstr(ls);
   size_t ll = ls->tsv.len;
   const char *r = getstr(rs);
@@ -300,46 +304,68 @@ int mr_V_equalval (mrp_State *L, const TObject *t1, const TObject *t2) {
 }
 
 
+/*
+** results at least this long are assembled directly inside their new
+** string instead of going through `G(L)->buff' (one copy less, and the
+** shared buffer does not stay at the size of the largest result)
+*/
+#define MINRAWCONCAT	256
+
+#define isconcatable(o)	(ttisstring(o) || ttisnumber(o))
+
+
+/*
+** numbers are formatted straight into the result, so they do not leave
+** interned intermediate strings behind
+*/
+static const char *concatstr (const TObject *o, char *s, size_t *l) {
+  if (ttisstring(o)) {
+    *l = tsvalue(o)->tsv.len;
+    return svalue(o);
+  }
+  mrp_number2str(s, nvalue(o));
+  *l = STRLEN(s);
+  return s;
+}
+
+
 void mr_V_concat (mrp_State *L, int total, int last) {
   do {
     StkId top = L->base + last + 1;
     int n = 2;  /* number of elements handled in this pass (at least 2) */
-    if (!tostring(L, top-2) || !tostring(L, top-1)) {
+    if (!isconcatable(top-2) || !isconcatable(top-1)) {
       if (!call_binTM(L, top-2, top-1, top-2, TM_CONCAT))
         mr_G_concaterror(L, top-2, top-1);
-    } else if (tsvalue(top-1)->tsv.len > 0) {  /* if len=0, do nothing */
+    } else if (ttisstring(top-1) && tsvalue(top-1)->tsv.len == 0) {
+      (void)tostring(L, top-2);  /* result is the first operand, as a string */
+    } else {
       /* at least two string values; get as many as possible */
-#if 0
-      lu_mem tl = cast(lu_mem, tsvalue(top-1)->tsv.len) +
-                  cast(lu_mem, tsvalue(top-2)->tsv.len);
-#else
-      size_t tl = tsvalue(top-1)->tsv.len;
-#endif
+      char s[32];  /* 16 digits, sign, point and \0  (+ some extra...) */
+      size_t tl, l;
+      TString *ts = NULL;
       char *buffer;
       int i;
-#if 0 
-      while (n < total && tostring(L, top-n-1)) {  /* collect total length */
-        tl += tsvalue(top-n-1)->tsv.len;
-        n++;
-#else
+      concatstr(top-1, s, &tl);
       /* collect total length */
-      for (n = 1; n < total && tostring(L, top-n-1); n++) {
-        size_t l = tsvalue(top-n-1)->tsv.len;
+      for (n = 1; n < total && isconcatable(top-n-1); n++) {
+        concatstr(top-n-1, s, &l);
         if (l >= MAX_SIZET - tl) mr_G_runerror(L, "string err:2030");  //string length overflow
         tl += l;
-#endif
       }
-#if 0 
-      if (tl > MAX_SIZET) mr_G_runerror(L, "string size overflow");
-#endif
-      buffer = mr_Z_openspace(L, &G(L)->buff, tl);
+      if (tl >= MINRAWCONCAT) {
+        ts = mr_S_newraw(L, tl);
+        buffer = cast(char *, getstr(ts));
+      }
+      else
+        buffer = mr_Z_openspace(L, &G(L)->buff, tl);
       tl = 0;
       for (i=n; i>0; i--) {  /* concat all strings */
-        size_t l = tsvalue(top-i)->tsv.len;
-        MEMCPY(buffer+tl, svalue(top-i), l);//ouli brew
+        const char *str = concatstr(top-i, s, &l);
+        MEMCPY(buffer+tl, str, l);//ouli brew
         tl += l;
       }
-      setsvalue2s(top-n, mr_S_newlstr(L, buffer, tl));
+      setsvalue2s(top-n, (ts != NULL) ? mr_S_intern(L, ts)
+                                      : mr_S_newlstr(L, buffer, tl));
     }
     total -= n-1;  /* got `n' strings to create 1 new */
     last -= n-1;
@@ -417,13 +443,17 @@ StkId mr_V_execute (mrp_State *L) {
   for (;;) {
     const Instruction i = *pc++;
     StkId base, ra;
-    if ((L->hookmask & (MRP_MASKLINE | MRP_MASKCOUNT)) &&
-        (--L->hookcount == 0 || L->hookmask & MRP_MASKLINE)) {
-      traceexec(L);
-      if (L->ci->state & CI_YIELD) {  /* did hook yield? */
-        L->ci->u.l.savedpc = pc - 1;
-        L->ci->state = CI_YIELD | CI_SAVEDPC;
-        return NULL;
+    if (L->hookmask & (MRP_MASKLINE | MRP_MASKCOUNT | MRP_MASKINTERNAL)) {
+      if ((L->hookmask & MRP_MASKBUDGET) && --G(L)->budgetleft < 0)
+        mr_R_overbudget(L);
+      if ((L->hookmask & (MRP_MASKLINE | MRP_MASKCOUNT | MRP_MASKPROF)) &&
+          (--L->hookcount == 0 || L->hookmask & (MRP_MASKLINE | MRP_MASKPROF))) {
+        traceexec(L);
+        if (L->ci->state & CI_YIELD) {  /* did hook yield? */
+          L->ci->u.l.savedpc = pc - 1;
+          L->ci->state = CI_YIELD | CI_SAVEDPC;
+          return NULL;
+        }
       }
     }
     /* warning!! several calls may realloc the stack and invalidate `ra' */
@@ -761,6 +791,7 @@ StkId mr_V_execute (mrp_State *L) {
         Closure *ncl;
         int nup, j;
         p = cl->p->p[GETARG_Bx(i)];
+        mr_U_checklazy(L, p);
         nup = p->nups;
         ncl = mr_F_newLclosure(L, nup, &cl->g);
         ncl->l.p = p;
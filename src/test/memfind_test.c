@@ -0,0 +1,76 @@
+/*
+ * _mr_memfind 对照测试：随机的文本和子串（小字母表，多出现部分匹配），
+ * 各种长度和起始对齐，结果必须和 memchr+memcmp 的朴素查找一致。
+ *
+ * make test
+ */
+#include "../include/mythroad.h"
+
+int puts(const char* s); /* type.h 按32位目标定义 size_t，不能包含系统头文件 */
+
+/* 只链接虚拟机核心，平台函数用空实现 */
+void mr_printf(const char* format, ...) {}
+int32 mr_mem_get(char** mem_base, uint32* mem_len) { return MR_FAILED; }
+int32 mr_open(const char* filename, uint32 mode) { return 0; }
+int32 mr_close(int32 f) { return MR_FAILED; }
+int32 mr_write(int32 f, void* p, uint32 l) { return MR_FAILED; }
+int32 mr_crc32(uint32* crc, const uint8* buf, uint32 len) { return MR_IGNORE; }
+int mr_Gb2312toUnicode(mrp_State* L) { return 0; }
+int _mr_pcall(int nargs, int nresults) { return 0; }
+void* _mr_readFile(const char* filename, int* filelen, int lookfor) { return NULL; }
+void _mr_readFileRelease(void* p, int filelen) {}
+
+static uint32 seed = 12345;
+
+static int32 rnd(void) {
+    seed = seed * 1103515245 + 12345;
+    return (int32)((seed >> 8) & 0x7fffff);
+}
+
+static const char* naive(const char* s1, size_t l1, const char* s2, size_t l2) {
+    const char* p = s1;
+    const char* end = s1 + l1;
+    if (l2 == 0) return s1;
+    while (p + l2 <= end) {
+        p = MEMCHR(p, s2[0], end - p - l2 + 1);
+        if (p == NULL) return NULL;
+        if (MEMCMP(p, s2, l2) == 0) return p;
+        p++;
+    }
+    return NULL;
+}
+
+int main(void) {
+    static char buf[600 + 8];
+    char needle[40];
+    char msg[128];
+    int i, fails = 0;
+    for (i = 0; i < 200000; i++) {
+        int alpha = 2 + rnd() % 4; /* a..e, many near misses */
+        size_t off = rnd() % 8;
+        size_t l1 = rnd() % 600;
+        size_t l2 = rnd() % ((i & 1) ? 12 : 40);
+        char* s1 = buf + off;
+        const char *got, *want;
+        size_t k;
+        for (k = 0; k < l1; k++) s1[k] = (char)('a' + rnd() % alpha);
+        if (l2 > 0 && l2 <= l1 && (rnd() & 1)) { /* often take it from the text */
+            MEMCPY(needle, s1 + rnd() % (l1 - l2 + 1), l2);
+            if (rnd() % 3 == 0) needle[rnd() % l2] ^= 1;
+        } else {
+            for (k = 0; k < l2; k++) needle[k] = (char)('a' + rnd() % alpha);
+        }
+        if (l2 > 1 && rnd() % 16 == 0) needle[0] = (char)0xe1; /* high bytes */
+        got = _mr_memfind(s1, l1, needle, l2);
+        want = naive(s1, l1, needle, l2);
+        if (got != want) {
+            SPRINTF(msg, "round %d: l1 %u l2 %u off %u: got %d want %d", i, (unsigned)l1, (unsigned)l2, (unsigned)off,
+                    got ? (int)(got - s1) : -1, want ? (int)(want - s1) : -1);
+            puts(msg);
+            if (++fails > 10) break;
+        }
+    }
+    SPRINTF(msg, "memfind: %d rounds, %d fails", i, fails);
+    puts(msg);
+    return fails != 0;
+}